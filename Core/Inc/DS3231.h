@@ -13,12 +13,48 @@ extern "C" {
 
 #define DS3231_ADDRESS	0x68	// 7-bit address (does not include I2C R/W bit)
 
+// Raw image of the DS3231 time/date registers 00h - 06h, packed BCD as read from the device
+// Each nibble is a decimal digit, ready to be displayed without conversion.
+typedef struct {
+	uint8_t ss;  // 00h seconds 00-59
+	uint8_t mm;  // 01h minutes 00-59
+	uint8_t hh;  // 02h hours 00-23 (24 hour mode)
+	uint8_t dow; // 03h day of week 1-7
+	uint8_t d;   // 04h date 01-31
+	uint8_t m;   // 05h month 01-12, bit 7 century
+	uint8_t y;   // 06h year 00-99
+} DS3231_TIME_BCD;
+
+// Return non-zero if the hh:mm of two time images differ
+static inline int ds3231_minute_changed(const DS3231_TIME_BCD * a, const DS3231_TIME_BCD * b)
+{
+	return a->mm != b->mm || a->hh != b->hh;
+}
+
+// Return non-zero if two time images are in different minutes, date included
+static inline int ds3231_date_minute_changed(const DS3231_TIME_BCD * a, const DS3231_TIME_BCD * b)
+{
+	return a->mm != b->mm || a->hh != b->hh || a->d != b->d || a->m != b->m || a->y != b->y;
+}
+
+// Return non-zero if the next seconds roll-over is also a minute roll-over
+static inline int ds3231_last_second(const DS3231_TIME_BCD * t)
+{
+	return t->ss == 0x59;
+}
+
 //=============================================================================
 // Implement a "generic I2C API" for writing to and then reading from an I2C device (in that order)
 HAL_StatusTypeDef i2c_write_read(uint16_t DevAddress, uint8_t * write_data, uint16_t write_count, uint8_t * read_data, uint16_t read_count);
 HAL_StatusTypeDef init_ds3231(void);
 HAL_StatusTypeDef read_ds3231(DATE_TIME * dt);
+HAL_StatusTypeDef read_ds3231_bcd(DS3231_TIME_BCD * t);
+void ds3231_bcd_to_dt(const DS3231_TIME_BCD * t, DATE_TIME * dt);
+void ds3231_dt_to_bcd(const DATE_TIME * dt, DS3231_TIME_BCD * t);
+void ds3231_bcd_next_minute(DS3231_TIME_BCD * t);
 HAL_StatusTypeDef write_ds3231(const DATE_TIME * dt);
+HAL_StatusTypeDef ds3231_check(void);
+void ds3231_clearOSF(void);
 
 int cl_time(void);
 int cl_date(void);
@@ -0,0 +1,36 @@
+// DS3231_cal.h, DS3231 aging offset calibration against the HSE derived 72MHz clock
+
+#ifndef __DS3231_CAL_H__
+#define __DS3231_CAL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h" // HAL includes
+#include "cal_estimator.h" // CAL_DEADBAND_PPB, CAL_PPB_PER_LSB, CAL_MAX_STEP
+#include "DS3231_sqw.h"
+
+#define CAL_REF_HZ          SQW_TICKS_PER_SECOND
+#define CAL_WINDOW_DEFAULT  3600     // seconds of SQW edges per estimate (1 hour)
+#define CAL_WINDOW_MAX      86400    // keep the estimator's 64-bit math from overflowing
+
+// STM32 backup registers (battery backed) used to persist calibration state
+#define CAL_BKP_MAGIC       RTC_BKP_DR2
+#define CAL_BKP_FLAGS       RTC_BKP_DR3
+#define CAL_BKP_PPB_LO      RTC_BKP_DR4
+#define CAL_BKP_PPB_HI      RTC_BKP_DR5
+#define CAL_BKP_ESTIMATES   RTC_BKP_DR6
+#define CAL_BKP_MAGIC_VALUE 0xCA1B
+
+void ds3231_cal_init(void);
+void ds3231_cal_task(void);
+int ds3231_cal_start(void);
+void ds3231_cal_stop(void);
+int cl_cal(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __DS3231_CAL_H__
@@ -0,0 +1,28 @@
+// DS3231_sqw.h, DS3231 1Hz SQW edge capture (TIM2_CH1, PA0)
+
+#ifndef __DS3231_SQW_H__
+#define __DS3231_SQW_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "main.h" // HAL includes
+
+#define SQW_TICKS_PER_SECOND 72000000 // TIM2 counts at the 72MHz timer clock, no prescaler
+#define SQW_TICKS_PER_US     (SQW_TICKS_PER_SECOND / 1000000)
+#define SQW_TIMEOUT_MS       1500     // no edge within this time: SQW is not running
+
+HAL_StatusTypeDef sqw_start(void);
+void sqw_overflow(void);
+uint64_t sqw_now(void);
+int sqw_edge_get(uint64_t * ts);
+int sqw_edge_pending(uint64_t * ts);
+int sqw_active(void);
+uint32_t sqw_queue_drops(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __DS3231_SQW_H__
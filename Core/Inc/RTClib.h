@@ -18,6 +18,7 @@ extern "C" {
 #define SECONDS_PER_DAY 86400L ///< 60 * 60 * 24
 #define SECONDS_FROM_1970_TO_2000                                              \
   946684800 ///< Unixtime for 2000-01-01 00:00:00, useful for initialization
+#define DAYS_FROM_1970_TO_2000 10957 ///< SECONDS_FROM_1970_TO_2000 / SECONDS_PER_DAY
 
 
 // Structure to hold/record time read from to written to an external RTC module (DS3231)
@@ -35,6 +36,9 @@ void unix2rtc(DATE_TIME * dt, uint32_t t);
 uint8_t dayOfTheWeek(DATE_TIME * dt);
 uint32_t rtc2unix(DATE_TIME * dt);
 uint32_t rtc2seconds(DATE_TIME * dt);
+void rtcAddSeconds(DATE_TIME * dt, uint32_t seconds);
+void rtcAddMinutes(DATE_TIME * dt, uint32_t minutes);
+void rtcNextMinute(DATE_TIME * dt);
 void buildTime(DATE_TIME *dt, const char *date, const char *time);
 
 #ifdef __cplusplus
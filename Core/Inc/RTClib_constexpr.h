@@ -0,0 +1,53 @@
+// RTClib_constexpr.h, compile time versions of RTClib conversions (C++ only)
+//
+// The compiler evaluates these, so tables and constants built with them cost no code or
+// run time.  Results match the RTClib.c functions of the same purpose.
+
+#ifndef __RTCLIB_CONSTEXPR_H__
+#define __RTCLIB_CONSTEXPR_H__
+
+#include "RTClib.h" // DATE_TIME definition
+
+// Days since 1970-01-01 of a civil date (see days_from_civil() in RTClib.c)
+static constexpr uint32_t rtc_days_from_civil(uint32_t y, uint32_t m, uint32_t d)
+{
+	y -= m <= 2;
+	const uint32_t era = y / 400;
+	const uint32_t yoe = y - era * 400;
+	const uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+// Unix time of a DATE_TIME (see rtc2unix())
+static constexpr uint32_t rtc_unix(const DATE_TIME & dt)
+{
+	return ((rtc_days_from_civil(2000 + dt.yOff, dt.m, dt.d) * 24UL + dt.hh) * 60 + dt.mm) * 60 + dt.ss;
+}
+
+// Two digit string to number, a leading space or other non-digit counts as zero (see conv2d())
+static constexpr uint8_t rtc_conv2d(const char * p)
+{
+	return 10 * (('0' <= p[0] && p[0] <= '9') ? p[0] - '0' : 0) + (p[1] - '0');
+}
+
+// Month number of a __DATE__ string, "Jan" - "Dec"
+static constexpr uint8_t rtc_month(const char * date)
+{
+	return date[0] == 'J' ? (date[1] == 'a' ? 1 : (date[2] == 'n' ? 6 : 7)) :
+	       date[0] == 'F' ? 2 :
+	       date[0] == 'M' ? (date[2] == 'r' ? 3 : 5) :
+	       date[0] == 'A' ? (date[2] == 'r' ? 4 : 8) :
+	       date[0] == 'S' ? 9 :
+	       date[0] == 'O' ? 10 :
+	       date[0] == 'N' ? 11 : 12;
+}
+
+// DATE_TIME from __DATE__ ("Apr 16 2020") and __TIME__ ("18:34:56") (see buildTime())
+static constexpr DATE_TIME rtc_build_time(const char * date, const char * time)
+{
+	return DATE_TIME{rtc_conv2d(date + 9), rtc_month(date), rtc_conv2d(date + 4),
+			rtc_conv2d(time), rtc_conv2d(time + 3), rtc_conv2d(time + 6)};
+}
+
+#endif // __RTCLIB_CONSTEXPR_H__
@@ -80,6 +80,15 @@ public:
   //! @param pos The position from which to start the modification (0 - leftmost, 3 - rightmost)
   void setSegments(const uint8_t segments[], uint8_t length = 4, uint8_t pos = 0);
 
+  //! Display 4 digits of raw segment data, writing only the digits that changed
+  //!
+  //! Sends the first to last changed digit in one address command, without the data command
+  //! and display control setSegments() sends, so one changed digit is 2 bytes on the bus
+  //! instead of 7.  Falls back to setSegments() after a brightness change.
+  //!
+  //! @param segments An array of 4 raw segment values, leftmost digit first
+  void updateSegments(const uint8_t segments[4]);
+
   //! Clear the display
   void clear();
 
@@ -157,6 +166,15 @@ public:
   //!         bit 6 - segment G; bit 7 - always zero)
   uint8_t encodeDigit(uint8_t digit);
 
+  //! Translate a packed BCD byte into two 7 segment codes
+  //!
+  //! The BCD nibbles already are the decimal digits, so no divide/modulo is needed.
+  //!
+  //! @param bcd Two BCD digits, 0x00 - 0x99
+  //! @param segments Receives the code of the tens digit, then the ones digit
+  //! @param leading_zero When false, a tens digit of zero is blank
+  void encodeBCD(uint8_t bcd, uint8_t segments[2], bool leading_zero = true);
+
 protected:
    void bitDelay();
 
@@ -176,6 +194,8 @@ private:
     STM32Gpio m_pinDIO;
     uint8_t m_brightness;
 	unsigned int m_bitDelay;
+	uint8_t m_shown[4];          // segments last written to each digit
+	uint8_t m_shownBrightness;   // m_brightness last written, 0xFF before the first write
 };
 
 #ifdef __cplusplus
@@ -8,6 +8,7 @@ extern "C" {
 #endif
 
 #include "main.h"
+#include "delay.h"
 
 /**
   * @brief  Basic GPIO class defining an STM32 GPIO pin (peripheral port / pin)
@@ -32,18 +33,23 @@ extern void pinMode(STM32Gpio pin,uint8_t mode);
 // Define Arduino digitalRead()
 extern int digitalRead(STM32Gpio pin);
 
-extern uint16_t timer_delay_us(uint16_t delay_us);
+extern uint32_t timer_delay_us(uint32_t delay_us);
 
 // Arduino pinMode values:
 #define INPUT   0
 #define OUTPUT  1
 
-// Redefine Arduino API to use our own microsecond delay
-#define delayMicroseconds timer_delay_us
+// Redefine Arduino API to use our own microsecond delay (delay.c, sleeps through longer delays)
+#define delayMicroseconds delay_us
 
 void tm1637_test(void);
 void init_tm1637(void);
 void update_clock(void);
+void clock_sqw_edge(uint64_t edge);
+void clock_task(void);
+void clock_set_brightness(uint8_t level, uint8_t on);
+uint8_t clock_brightness(void);
+int cl_clock(void);
 int cl_tm1637_count(void);
 
 #ifdef __cplusplus
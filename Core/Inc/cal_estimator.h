@@ -0,0 +1,42 @@
+// cal_estimator.h, frequency error estimator for the DS3231 aging offset calibration
+//
+// The estimator only sees timestamps (reference clock ticks) of 1Hz SQW edges.  It has no
+// hardware dependencies, allowing it to be compiled on a host and fed synthetic edge streams
+// (Tools/cal_test.c).
+
+#ifndef _CAL_ESTIMATOR_H_
+#define _CAL_ESTIMATOR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define CAL_EST_TOLERANCE_PPM	500	// reject SQW intervals further than this from the reference
+#define CAL_DEADBAND_PPB	50	// don't trim when within +/- 0.05ppm
+#define CAL_PPB_PER_LSB		100	// DS3231 aging offset: ~0.1ppm per LSB at 25C
+#define CAL_MAX_STEP		10	// largest aging offset change per estimate (LSBs)
+
+typedef struct {
+	uint32_t ref_hz;     // reference clock ticks per nominal second
+	uint32_t window_s;   // seconds of SQW edges per estimate
+	uint64_t first_ts;   // timestamp of the first edge in the current window
+	uint64_t last_ts;    // timestamp of the most recent accepted edge
+	uint32_t seconds;    // seconds accumulated in the current window
+	uint32_t rejected;   // edges rejected (glitch, or interval out of tolerance)
+	uint32_t estimates;  // completed estimates
+	int32_t  ppb;        // last estimate, parts per billion (positive: DS3231 runs fast)
+	uint8_t  started;    // first edge of the window has been seen
+} CAL_ESTIMATOR;
+
+void cal_est_init(CAL_ESTIMATOR * est, uint32_t ref_hz, uint32_t window_s);
+void cal_est_restart(CAL_ESTIMATOR * est);
+int cal_est_edge(CAL_ESTIMATOR * est, uint64_t ts);
+int8_t cal_est_aging(int8_t aging, int32_t ppb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _CAL_ESTIMATOR_H_
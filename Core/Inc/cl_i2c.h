@@ -17,12 +17,25 @@ extern "C" {
 #define I2C_ADDRESS_MAX 0x77
 #define HAL_I2C_SMALL_TIMEOUT 50
 
+// i2c_write_read() bus traffic counters
+typedef struct {
+	uint32_t transactions; // START ... STOP sequences
+	uint32_t bytes;        // bytes on the bus, including address bytes
+	uint32_t errors;       // failed transfers
+	uint32_t injected;     // failures injected by "i2cfault"
+} I2C_STATS;
+
+extern I2C_STATS i2c_stats;
+
 // Prototypes:
 int cl_i2c_validate_address(uint16_t i2c_address); // I2C helper function that validates I2C address is within range
 HAL_StatusTypeDef i2c_write_read(uint16_t DevAddress, uint8_t * write_data, uint16_t write_count, uint8_t * read_data, uint16_t read_count);
+HAL_StatusTypeDef i2c_write_read_prio(uint8_t priority, uint16_t DevAddress, uint8_t * write_data, uint16_t write_count, uint8_t * read_data, uint16_t read_count);
 int cl_i2c_scan(void);
 int cl_i2c_write(void);
 int cl_i2c_read(void);
+int cl_i2c_stat(void);
+int cl_i2c_fault(void);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,18 @@
+// File: cl_rtclib.h
+//
+// RTClib self test and benchmark for the command line interface
+//
+#ifndef _CL_RTCLIB_H_
+#define _CL_RTCLIB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int cl_rtctest(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CL_RTCLIB_H_ */
@@ -0,0 +1,32 @@
+// cmd_hash.h, command name lookup - open addressing hash of a command table
+//
+// This module has no HAL or board dependencies.  The firmware (command_line.c) and the host
+// benchmark (Tools/cmd_hash_bench.c) compile the same cmd_hash.c.
+//
+// The table is an array of structures whose first member is the name (const char *), stride
+// bytes apart, ended by an entry with a NULL name.  Each slot holds a table index + 1, 0 is
+// empty.  With at most half the slots used, a lookup is a hash, usually one strcmp(), and
+// rarely a second probe - independent of the number of commands.
+
+#ifndef __CMD_HASH_H__
+#define __CMD_HASH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint16_t CMD_HASH_SLOT;
+
+uint32_t cmd_hash_name(const char * s);
+int cmd_hash_build(CMD_HASH_SLOT * slots, unsigned size, const void * table, size_t stride);
+int cmd_hash_find(const CMD_HASH_SLOT * slots, unsigned size, const void * table, size_t stride,
+		const char * name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CMD_HASH_H__ */
@@ -54,6 +54,8 @@ void cl_process_buffer(void);
 // command line functions
 char * PrintHalStatus(int status);
 int cl_help(void);
+int cl_cmdbench(void);
+int cl_perf(void);
 int cl_add(void);
 int cl_id(void);
 int cl_info(void);
@@ -0,0 +1,33 @@
+// delay.h, microsecond and sub-microsecond delays - timer compare with WFI, calibrated cycle loops
+
+#ifndef __DELAY_H__
+#define __DELAY_H__
+
+#include "main.h" // HAL functions and defines
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DELAY_WFI_MIN_US 20 // shorter delays spin, longer ones sleep until a TIM4 compare
+#define DELAY_WAKE_US    3  // compare fires this early, covers the wake-up and interrupt entry
+
+typedef struct {
+	uint32_t spins;    // delays spun on the timebase
+	uint32_t sleeps;   // delays that slept (WFI) until the compare
+	uint32_t wakes;    // WFI wake-ups, including other interrupts
+	uint32_t overhead; // calibrated delay_cycles() call overhead, cycles
+} DELAY_STATS;
+
+extern DELAY_STATS delay_stats;
+
+void delay_init(void);
+void delay_cycles(uint32_t cycles);
+void delay_ns(uint32_t ns);
+uint32_t delay_us(uint32_t us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __DELAY_H__
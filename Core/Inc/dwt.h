@@ -0,0 +1,28 @@
+// dwt.h, Cortex-M3 DWT cycle counter (72 cycles per microsecond at 72MHz)
+
+#ifndef __DWT_H__
+#define __DWT_H__
+
+#include "main.h" // CMSIS DWT and CoreDebug definitions
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Enable the cycle counter.  Safe to call more than once.
+static inline void dwt_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static inline uint32_t dwt_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __DWT_H__
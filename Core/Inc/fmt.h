@@ -0,0 +1,36 @@
+// fmt.h, small integer / fixed-point formatter writing into the UART TX ring
+
+#ifndef __FMT_H__
+#define __FMT_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FMT_BUF_SIZE 48 // bytes collected before a write to the TX ring
+
+// Output line under construction, lives on the caller's stack (no heap)
+typedef struct {
+	uint8_t len;
+	char buf[FMT_BUF_SIZE];
+} FMT;
+
+void fmt_begin(FMT * f);
+void fmt_end(FMT * f);
+void fmt_char(FMT * f, char c);
+void fmt_str(FMT * f, const char * s);
+void fmt_str_w(FMT * f, const char * s, uint8_t width); // "%-Ns"
+void fmt_u(FMT * f, uint32_t v, uint8_t width, char pad); // "%u", "%02u", "%4u"
+void fmt_d(FMT * f, int32_t v, uint8_t width);           // "%d", "%4d"
+void fmt_x(FMT * f, uint32_t v, uint8_t width);          // "%02X", upper case, zero padded
+void fmt_fixed(FMT * f, int32_t v, uint8_t frac_bits, uint8_t decimals); // signed fixed-point, IE: 23.25
+
+int cl_fmtbench(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __FMT_H__
@@ -0,0 +1,36 @@
+// i2c_probe.h, fast I2C1 bus inventory
+
+#ifndef _I2C_PROBE_H_
+#define _I2C_PROBE_H_
+
+#include "main.h" // HAL functions and defines
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define I2C_PROBE_TIMEOUT_US 300 // START + address + ACK is 10 bit times, 100us at 100kHz
+
+// Cached result of the last bus scan
+typedef struct {
+	uint8_t present[16];  // bit map of addresses that ACKed, bit (addr & 7) of present[addr >> 3]
+	uint8_t expected[16]; // addresses probed by i2c_probe_rescan()
+	uint32_t ticks;       // HAL_GetTick() at the end of the last scan
+	uint32_t scan_us;     // duration of the last scan
+	uint8_t probed;       // addresses probed by the last scan
+	uint8_t bus_errors;   // probes that timed out (bus stuck, arbitration lost)
+	uint8_t changes;      // addresses that appeared / disappeared in the last scan
+} I2C_INVENTORY;
+
+extern I2C_INVENTORY i2c_inventory;
+
+void i2c_probe_init(void);
+void i2c_probe_scan(void);
+void i2c_probe_rescan(void);
+int i2c_probe_present(uint8_t addr);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _I2C_PROBE_H_ */
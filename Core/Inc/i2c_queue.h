@@ -0,0 +1,73 @@
+// i2c_queue.h, prioritized I2C1 transaction queue
+//
+// All I2C1 traffic goes through this queue.  Requests are owned by the caller (no heap),
+// sorted by priority then deadline, and serviced back-to-back from the I2C1 interrupts.
+
+#ifndef _I2C_QUEUE_H_
+#define _I2C_QUEUE_H_
+
+#include "main.h" // HAL functions and defines
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Priorities, lower value is serviced first
+#define I2C_PRIO_TIME    0 // time reads for the clock display
+#define I2C_PRIO_NORMAL  1
+#define I2C_PRIO_DIAG    2 // command line diagnostics
+
+#define I2C_BURST_MAX    32 // largest merged register read (bytes)
+#define I2C_XFER_TIMEOUT 50 // ms before a stuck transfer is aborted and the bus re-initialized
+
+typedef enum {
+	I2C_OP_MEM_READ,  // write register index, repeated start, read len bytes
+	I2C_OP_MEM_WRITE, // write register index followed by len bytes
+	I2C_OP_READ,      // read len bytes
+	I2C_OP_WRITE,     // write len bytes
+} I2C_OP;
+
+typedef enum {
+	I2C_REQ_IDLE,
+	I2C_REQ_QUEUED,
+	I2C_REQ_ACTIVE,
+	I2C_REQ_DONE,
+} I2C_REQ_STATE;
+
+typedef struct I2C_REQUEST {
+	struct I2C_REQUEST * next;
+	uint8_t dev;       // 7-bit address
+	uint8_t op;        // I2C_OP
+	uint8_t reg;       // first register (I2C_OP_MEM_xxx)
+	uint8_t priority;  // I2C_PRIO_xxx
+	uint16_t len;
+	uint8_t * data;
+	uint32_t deadline; // HAL_GetTick() value after which the request is dropped, 0: none
+	void (*done)(struct I2C_REQUEST * req); // called from interrupt context, may be NULL
+	void * context;
+	volatile uint8_t state;  // I2C_REQ_STATE
+	volatile HAL_StatusTypeDef status;
+} I2C_REQUEST;
+
+typedef struct {
+	uint32_t requests;  // requests submitted
+	uint32_t merged;    // reads satisfied by another request's burst
+	uint32_t expired;   // requests dropped at their deadline
+	uint32_t aborts;    // stuck transfers recovered
+	uint8_t depth_max;  // most requests queued at once
+} I2C_QUEUE_STATS;
+
+extern I2C_QUEUE_STATS i2c_queue_stats;
+
+HAL_StatusTypeDef i2c_submit(I2C_REQUEST * req);
+HAL_StatusTypeDef i2c_transfer(I2C_REQUEST * req);
+void i2c_queue_poll(void);
+HAL_StatusTypeDef i2c_queue_acquire(void);
+void i2c_queue_release(void);
+int i2c_queue_busy(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _I2C_QUEUE_H_ */
@@ -0,0 +1,45 @@
+// mem.h, static RAM arena - fixed-size block pools and the boot-time newlib heap
+
+#ifndef __MEM_H__
+#define __MEM_H__
+
+#include "main.h" // HAL functions and defines
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pool of count fixed-size blocks, each holding one object.  The storage is placed in the
+// .arena section (linker script), so pools that don't fit in _Arena_Size fail to link.
+typedef struct POOL {
+	const char * name;
+	uint16_t size;          // block size, bytes
+	uint16_t count;         // blocks
+	uint8_t * blocks;
+	void * free;            // free list, linked through the first word of each free block
+	uint16_t used;
+	uint16_t high_water;    // most blocks in use at once
+	uint32_t allocs;
+	uint32_t failures;      // pool_alloc() found no free block
+	struct POOL * next;     // pools list, for "mem"
+} POOL;
+
+// Define a pool of count blocks of type (file scope), pool_init() it before use
+#define POOL_DEFINE(pool, type, count) \
+	static union { type object; void * link; } pool##_blocks[count] __attribute__((section(".arena"), aligned(8))); \
+	static POOL pool = {#pool, sizeof(pool##_blocks[0]), (count), (uint8_t *)pool##_blocks}
+
+#define POOL_ALLOC(pool, type) ((type *)pool_alloc(&(pool)))
+
+void pool_init(POOL * pool);
+void * pool_alloc(POOL * pool);
+void pool_free(POOL * pool, void * block);
+void mem_seal(void);
+void * mem_sbrk(ptrdiff_t incr);
+int cl_mem(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __MEM_H__
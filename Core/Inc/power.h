@@ -0,0 +1,46 @@
+// power.h, STOP mode between minute updates
+
+#ifndef __POWER_H__
+#define __POWER_H__
+
+#include "main.h" // HAL functions and defines
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POWER_AWAKE_MS 30000 // stay out of STOP this long after console input
+
+// Wake-up sources
+typedef enum {
+	POWER_WAKE_ALARM,  // DS3231 INT (PA0, EXTI0 event), once a minute alarm 2
+	POWER_WAKE_UART,   // USART2 RX start bit (PA3, EXTI3 pending, NVIC disabled)
+	POWER_WAKE_BUTTON, // B1 (PC13, EXTI13 interrupt)
+	POWER_WAKE_OTHER,
+	POWER_WAKE_COUNT
+} POWER_WAKE;
+
+typedef struct {
+	uint32_t stops;                    // times STOP mode was entered
+	uint32_t wakes[POWER_WAKE_COUNT];
+	uint32_t restore_us;               // last clock restore (HSE, PLL) after STOP
+	uint32_t awake_us_last;            // time awake during the last full minute
+	uint32_t awake_us_max;
+	uint32_t display_us_last;          // last alarm wake-up to display updated
+	uint32_t display_us_max;
+} POWER_STATS;
+
+extern POWER_STATS power_stats;
+
+HAL_StatusTypeDef power_enable(int on);
+int power_enabled(void);
+HAL_StatusTypeDef power_int_restore(void);
+int power_stop(void);
+void power_alarm(void);
+int cl_power(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __POWER_H__
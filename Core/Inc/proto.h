@@ -0,0 +1,39 @@
+// proto.h, framed binary control protocol alongside the text command line
+
+#ifndef __PROTO_H__
+#define __PROTO_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Two SYN characters typed at the command line switch to binary mode.  A terminal never
+// sends them, the text parser ignores control characters.
+#define PROTO_SYN      0x16
+#define PROTO_IDLE_MS  10000 // no frame for this long returns to the text command line
+
+typedef struct {
+	uint32_t sessions;   // binary mode entered
+	uint32_t frames;     // good frames processed
+	uint32_t ops;        // operations executed
+	uint32_t bad_crc;    // frames discarded, CRC mismatch
+	uint32_t bad_len;    // frames discarded, invalid length
+	uint32_t timeouts;   // sessions ended by PROTO_IDLE_MS
+} PROTO_STATS;
+
+extern PROTO_STATS proto_stats;
+
+void proto_init(void);
+void proto_enter(void);
+int proto_active(void);
+void proto_rx(uint8_t c);
+void proto_poll(void);
+int cl_proto(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __PROTO_H__
@@ -0,0 +1,115 @@
+// proto_frame.h, framed binary control protocol - frame and operation encoding
+//
+// This module has no HAL or board dependencies.  The firmware (proto.c) and host tooling
+// compile the same proto_frame.c, so both ends agree on the encoding.
+//
+// Frame:
+//   SOF      0xA5
+//   LEN      payload length, 1 - PROTO_PAYLOAD_MAX
+//   SEQ      sequence number, echoed in the response frame
+//   PAYLOAD  LEN bytes, one or more operations (pipelined, processed in order)
+//   CRC      CRC-16/CCITT-FALSE of LEN, SEQ and PAYLOAD, least significant byte first
+//
+// Request operation:  OP, ARG_LEN, ARG_LEN bytes of arguments
+// Response operation: OP, STATUS, DATA_LEN, DATA_LEN bytes of data
+// Both are self-describing - a receiver can skip an operation it doesn't know.
+// Multi-byte values are little endian.
+// Every response frame holds at least one operation: a truncated request operation is answered
+// with PROTO_ERR_ARG, one that might not fit the response with PROTO_ERR_ROOM.
+
+#ifndef __PROTO_FRAME_H__
+#define __PROTO_FRAME_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROTO_SOF          0xA5
+#define PROTO_PAYLOAD_MAX  240
+#define PROTO_FRAME_MAX    (PROTO_PAYLOAD_MAX + 5) // SOF, LEN, SEQ, payload, CRC
+#define PROTO_DATA_MAX     32  // largest response data, PROTO_OP_READ_REG
+
+// Operations                  request arguments         response data
+#define PROTO_OP_GET_TIME   0x01 // -                    hh mm ss (local time)
+#define PROTO_OP_SET_TIME   0x02 // hh mm ss (local)     -
+#define PROTO_OP_GET_DATE   0x03 // -                    d m y (local, y: years since 2000)
+#define PROTO_OP_SET_DATE   0x04 // d m y                -
+#define PROTO_OP_GET_UNIX   0x05 // -                    uint32 seconds since 1970, UTC
+#define PROTO_OP_SET_UNIX   0x06 // uint32 UTC           -
+#define PROTO_OP_GET_BRIGHT 0x07 // -                    level (0-7), on (0/1)
+#define PROTO_OP_SET_BRIGHT 0x08 // level (0-7), on      -
+#define PROTO_OP_READ_REG   0x09 // dev, reg, len        len register bytes (len <= 32)
+#define PROTO_OP_GET_STATS  0x0A // -                    PROTO_STATS_COUNT uint32 counters
+#define PROTO_OP_EXIT       0x7F // -                    - (return to the text command line)
+
+// Response status
+#define PROTO_OK            0
+#define PROTO_ERR_OP        1 // unknown operation
+#define PROTO_ERR_ARG       2 // wrong argument length or value out of range
+#define PROTO_ERR_DEVICE    3 // RTC / I2C device error
+#define PROTO_ERR_ROOM      4 // response frame full, operation not executed
+
+// GET_STATS counters, in order
+#define PROTO_STATS_COUNT   7 // i2c transactions, i2c errors, i2c bytes, uart tx bytes,
+                              // uart tx dropped, protocol frames, protocol frame errors
+
+// Frame decoder results
+typedef enum {
+	PROTO_MORE,      // byte consumed, no frame yet
+	PROTO_FRAME,     // complete frame with good CRC in the decoder
+	PROTO_BAD_CRC,   // frame discarded
+	PROTO_BAD_LEN,   // LEN of 0 or above PROTO_PAYLOAD_MAX, frame discarded
+} PROTO_RESULT;
+
+// Frame decoder, fed one byte at a time
+typedef struct {
+	uint8_t state;
+	uint8_t len;
+	uint8_t seq;
+	uint8_t pos;
+	uint16_t crc;
+	uint8_t payload[PROTO_PAYLOAD_MAX];
+} PROTO_DECODER;
+
+// Frame encoder, operations are appended to buf
+typedef struct {
+	uint16_t len; // bytes in buf
+	uint8_t buf[PROTO_FRAME_MAX];
+} PROTO_ENCODER;
+
+// One operation taken from a payload
+typedef struct {
+	uint8_t op;
+	uint8_t status; // response operations only
+	uint8_t len;
+	const uint8_t * data;
+} PROTO_ITEM;
+
+// Executes one checked request operation: fill in data[PROTO_DATA_MAX] and *len, return the status
+typedef uint8_t (*PROTO_HANDLER)(const PROTO_ITEM * req, uint8_t * data, uint8_t * len, void * ctx);
+
+uint16_t proto_crc16(uint16_t crc, const uint8_t * data, uint16_t len);
+
+void proto_decoder_reset(PROTO_DECODER * d);
+PROTO_RESULT proto_decode(PROTO_DECODER * d, uint8_t c);
+
+void proto_encode_begin(PROTO_ENCODER * e, uint8_t seq);
+int proto_encode_request(PROTO_ENCODER * e, uint8_t op, const uint8_t * args, uint8_t len);
+int proto_encode_response(PROTO_ENCODER * e, uint8_t op, uint8_t status, const uint8_t * data, uint8_t len);
+uint16_t proto_encode_end(PROTO_ENCODER * e);
+uint16_t proto_encode_room(const PROTO_ENCODER * e);
+
+int proto_next_request(const uint8_t * payload, uint8_t len, uint8_t * pos, PROTO_ITEM * item);
+int proto_next_response(const uint8_t * payload, uint8_t len, uint8_t * pos, PROTO_ITEM * item);
+
+uint8_t proto_check_request(const PROTO_ITEM * req);
+uint8_t proto_serve(const uint8_t * payload, uint8_t len, uint8_t seq, PROTO_ENCODER * out,
+		PROTO_HANDLER handler, void * ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __PROTO_FRAME_H__
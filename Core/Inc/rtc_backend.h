@@ -0,0 +1,39 @@
+// rtc_backend.h, RTC backend interface - DS3231 and STM32 internal RTC
+
+#ifndef __RTC_BACKEND_H__
+#define __RTC_BACKEND_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "RTClib.h" // DATE_TIME definition
+#include "main.h" // HAL includes
+
+#define RTC_CROSSCHECK_MS  60000 // compare backends once a minute
+#define RTC_PROBE_MS       10000 // retry unhealthy backends every 10 seconds
+#define RTC_MAX_SKEW_S     1     // backends within this many seconds are in agreement
+
+// A source of time.  The first entry in the backend table is the reference (most accurate).
+typedef struct {
+	const char * name;
+	HAL_StatusTypeDef (*read)(DATE_TIME * dt);
+	HAL_StatusTypeDef (*write)(const DATE_TIME * dt);
+	HAL_StatusTypeDef (*check)(void); // HAL_OK if the device responds and its time is valid
+	uint32_t cost_us;  // read cost estimate, measured and smoothed
+	uint32_t reads;
+	uint32_t failures;
+	uint8_t healthy;
+} RTC_BACKEND;
+
+void rtc_init(void);
+void rtc_task(void);
+HAL_StatusTypeDef rtc_read(DATE_TIME * dt);
+HAL_StatusTypeDef rtc_write(const DATE_TIME * dt);
+int cl_rtc(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __RTC_BACKEND_H__
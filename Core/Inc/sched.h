@@ -0,0 +1,36 @@
+// sched.h, event driven superloop - handlers run on interrupt events and timer deadlines,
+// the core sleeps (WFI) in between
+
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include "main.h" // HAL functions and defines
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Event sources, posted from interrupt handlers
+typedef enum {
+	SCHED_EV_UART_RX, // USART2 receive (IDLE line, DMA half / full)
+	SCHED_EV_SQW,     // DS3231 SQW edge captured by TIM2
+	SCHED_EV_I2C,     // clock time registers read complete
+	SCHED_EV_BUTTON,  // B1 pressed (EXTI13)
+	SCHED_EV_ALARM,   // woke from STOP on the DS3231 once a minute alarm
+	SCHED_EV_COUNT
+} SCHED_EVENT;
+
+#define SCHED_TIMER_MAX 8
+
+void sched_init(void);
+void sched_post(SCHED_EVENT ev);
+void sched_on(SCHED_EVENT ev, void (*handler)(void));
+void sched_every(const char * name, void (*handler)(void), uint32_t period_ms);
+void sched_run(void);
+int cl_sched(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __SCHED_H__
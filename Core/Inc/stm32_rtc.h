@@ -0,0 +1,26 @@
+// stm32_rtc.h, STM32F103 internal RTC (LSE clocked) used as a DATE_TIME clock
+
+#ifndef __STM32_RTC_H__
+#define __STM32_RTC_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "RTClib.h" // DATE_TIME definition
+#include "main.h" // HAL includes
+
+// Backup register marking the RTC counter as holding valid time
+#define STM32_RTC_BKP_VALID        RTC_BKP_DR1
+#define STM32_RTC_BKP_VALID_VALUE  0x32F2
+
+HAL_StatusTypeDef stm32_rtc_read(DATE_TIME * dt);
+HAL_StatusTypeDef stm32_rtc_write(const DATE_TIME * dt);
+HAL_StatusTypeDef stm32_rtc_check(void);
+uint32_t stm32_rtc_counter(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __STM32_RTC_H__
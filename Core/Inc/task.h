@@ -0,0 +1,73 @@
+// task.h, cooperative background tasks for long running commands
+//
+// A task is a protothread: its run function is called once per superloop pass and returns
+// after a short slice of work.  TASK_YIELD() / TASK_SLEEP() / TASK_WAIT_UNTIL() return to the
+// superloop and resume at the same place on the next call.  Local variables are not kept
+// across a yield - keep state in static variables or the structure that embeds the TASK.
+// Don't use switch statements across a yield (the macros are a switch on the resume line).
+//
+// Example:
+//   static TASK blink_task = {"blink", blink_run};
+//   static TASK_STATUS blink_run(TASK * t)
+//   {
+//       TASK_BEGIN(t);
+//       for(;;) {
+//           HAL_GPIO_TogglePin(LD2_GPIO_Port, LD2_Pin);
+//           TASK_SLEEP(t, 500);
+//       }
+//       TASK_END(t);
+//   }
+//   ...
+//   task_start(&blink_task);
+
+#ifndef __TASK_H__
+#define __TASK_H__
+
+#include "main.h" // HAL_GetTick()
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TASK_MAX 4 // tasks running at once
+
+typedef enum {
+	TASK_RUNNING, // call again on the next superloop pass
+	TASK_DONE,    // finished, remove from the task list
+} TASK_STATUS;
+
+typedef struct TASK {
+	const char * name;
+	TASK_STATUS (*run)(struct TASK * t);
+	void (*stop)(struct TASK * t); // called when the task is killed, may be NULL
+	uint16_t resume;   // line to resume at, 0: start
+	uint8_t id;        // job number shown by "jobs", 0: not running
+	uint8_t yielded;   // TASK_YIELD() - run again on the next pass, don't sleep
+	uint32_t wake;     // HAL_GetTick() value TASK_SLEEP() waits for
+	uint32_t started;  // HAL_GetTick() at task_start()
+	uint32_t slices;   // run() calls
+	uint16_t slice_max_us; // longest run() call - how long the superloop was held
+} TASK;
+
+#define TASK_BEGIN(t)     switch((t)->resume) { case 0:
+#define TASK_END(t)       } (t)->resume = 0; return TASK_DONE
+#define TASK_YIELD(t)     do { (t)->resume = __LINE__; (t)->yielded = 1; return TASK_RUNNING; case __LINE__:; } while(0)
+#define TASK_WAIT_UNTIL(t, cond) \
+	do { (t)->resume = __LINE__; case __LINE__: if(!(cond)) return TASK_RUNNING; } while(0)
+#define TASK_SLEEP(t, ms) \
+	do { (t)->wake = HAL_GetTick() + (ms); \
+	     TASK_WAIT_UNTIL(t, (int32_t)(HAL_GetTick() - (t)->wake) >= 0); } while(0)
+
+int task_start(TASK * t);
+void task_kill(TASK * t);
+int task_running(const TASK * t);
+int task_count(void);
+int task_run(void);
+int cl_jobs(void);
+int cl_kill(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TASK_H__
@@ -0,0 +1,21 @@
+// timebase.h, 64-bit microsecond timebase - TIM4 extended by its update (overflow) count
+
+#ifndef __TIMEBASE_H__
+#define __TIMEBASE_H__
+
+#include "main.h" // HAL functions and defines
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void timebase_overflow(void);
+uint64_t timebase_us(void);
+uint32_t timebase_us32(void);
+uint32_t timebase_overflows(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TIMEBASE_H__
@@ -0,0 +1,31 @@
+// timezone.h, local time from the UTC time kept by the DS3231
+
+#ifndef __TIMEZONE_H__
+#define __TIMEZONE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "RTClib.h" // DATE_TIME definition
+
+// Local time zone: US Central (Dallas, TX) - CST UTC-6, CDT UTC-5
+// DST rules are US rules: 2007 on, second Sunday in March to first Sunday in November;
+// before 2007, first Sunday in April to last Sunday in October.  Both at 02:00 local time.
+#define TZ_STD_OFFSET_S  (-6 * 3600L) // standard time offset from UTC
+#define TZ_DST_SAVE_S    3600L        // added during daylight saving time
+#define TZ_FIRST_YEAR    2000
+#define TZ_LAST_YEAR     2099
+
+int32_t tz_offset(uint32_t utc);
+uint32_t tz_local(uint32_t utc);
+uint32_t tz_utc(uint32_t local);
+void tz_to_local(DATE_TIME * dt);
+void tz_to_utc(DATE_TIME * dt);
+int cl_tz(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TIMEZONE_H__
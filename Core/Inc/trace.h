@@ -0,0 +1,53 @@
+// trace.h, hot path trace - enter/exit events with DWT cycle counts in a RAM ring
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "main.h" // CMSIS DWT and interrupt mask functions
+#include "trace_format.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Events kept, power of 2, 5 bytes of RAM each.  0 compiles the trace points out.
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 256
+#endif
+
+#if TRACE_RING_SIZE
+
+extern volatile uint32_t trace_head;  // events recorded, the next slot is trace_head % TRACE_RING_SIZE
+extern volatile uint8_t trace_enabled;
+extern uint32_t trace_cycles[TRACE_RING_SIZE];
+extern uint8_t trace_ids[TRACE_RING_SIZE];
+
+// Record one event, safe from interrupt handlers.  About 20 cycles.
+static inline void trace_record(uint8_t id)
+{
+	if(!trace_enabled) return;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint32_t slot = trace_head++ & (TRACE_RING_SIZE - 1);
+	trace_cycles[slot] = DWT->CYCCNT;
+	trace_ids[slot] = id;
+	__set_PRIMASK(primask);
+}
+
+#define TRACE_ENTER(id) trace_record(TRACE_##id)
+#define TRACE_EXIT(id)  trace_record(TRACE_##id | TRACE_EXIT_FLAG)
+
+#else
+
+#define TRACE_ENTER(id) ((void)0)
+#define TRACE_EXIT(id)  ((void)0)
+
+#endif // TRACE_RING_SIZE
+
+int cl_trace(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TRACE_H__
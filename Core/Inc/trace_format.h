@@ -0,0 +1,54 @@
+// trace_format.h, hot path trace - IDs and dump format
+//
+// No HAL or board dependencies: the firmware (trace.c) and the host analyzer
+// (Tools/trace_analyze.c) include the same definitions.
+//
+// Dump ("trace dump"), multi-byte values little endian:
+//   MAGIC    "TRC1"
+//   HZ       uint32 core clock, DWT cycles per second
+//   TOTAL    uint32 events recorded since the ring was cleared (TOTAL - COUNT were overwritten)
+//   COUNT    uint16 events that follow, oldest first
+//   EVENTS   COUNT x {uint32 DWT cycle count, uint8 ID (TRACE_EXIT_FLAG set on exit)}
+//   CRC      CRC-16/CCITT-FALSE (proto_crc16()) of HZ through EVENTS, least significant byte first
+
+#ifndef __TRACE_FORMAT_H__
+#define __TRACE_FORMAT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRACE_MAGIC      "TRC1"
+#define TRACE_EXIT_FLAG  0x80
+#define TRACE_EVENT_SIZE 5 // bytes per event in the dump
+
+// Traced functions and interrupt handlers: enum name, name in the analyzer output
+#define TRACE_IDS(X) \
+	X(CMD,         "cl_process_buffer") \
+	X(SEGMENTS,    "setSegments") \
+	X(WRITE_BYTE,  "writeByte") \
+	X(I2C,         "i2c_write_read") \
+	X(DS3231_READ, "read_ds3231") \
+	X(IRQ_TIM2,    "TIM2_IRQHandler") \
+	X(IRQ_I2C_EV,  "I2C1_EV_IRQHandler") \
+	X(IRQ_I2C_ER,  "I2C1_ER_IRQHandler") \
+	X(IRQ_USART2,  "USART2_IRQHandler") \
+	X(IRQ_DMA_RX,  "DMA1_Channel6_IRQHandler") \
+	X(IRQ_DMA_TX,  "DMA1_Channel7_IRQHandler") \
+	X(IRQ_EXTI,    "EXTI15_10_IRQHandler")
+
+#define TRACE_ENUM(id, name) TRACE_##id,
+typedef enum {
+	TRACE_NONE,
+	TRACE_IDS(TRACE_ENUM)
+	TRACE_ID_COUNT
+} TRACE_ID;
+#undef TRACE_ENUM
+
+#define TRACE_IRQ_FIRST TRACE_IRQ_TIM2 // this ID and above are interrupt handlers
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __TRACE_FORMAT_H__
@@ -0,0 +1,36 @@
+// uart_rx.h, USART2 receive ring filled by circular DMA (DMA1 channel 6)
+
+#ifndef __UART_RX_H__
+#define __UART_RX_H__
+
+#include "main.h" // HAL functions and defines
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UART_RX_RING_SIZE 512 // bytes, power of 2.  ~44ms of input at 115200 baud.
+
+typedef struct {
+	uint32_t bytes;      // bytes taken by uart_rx_getchar()
+	uint32_t idle;       // IDLE line events (end of a burst)
+	uint32_t half;       // DMA half transfer events
+	uint32_t full;       // DMA transfer complete events (ring wrapped)
+	uint32_t overruns;   // reader fell more than a ring behind the DMA
+	uint32_t lost;       // bytes overwritten before they were read
+	uint32_t errors;     // UART errors (overrun, framing, noise), reception restarted
+	uint16_t high_water; // most unread bytes at once
+} UART_RX_STATS;
+
+extern UART_RX_STATS uart_rx_stats;
+
+void uart_rx_start(void);
+int uart_rx_getchar(void);
+uint16_t uart_rx_available(void);
+int cl_rx(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UART_RX_H__
@@ -0,0 +1,41 @@
+// uart_tx.h, USART2 transmit ring buffer drained by DMA (DMA1 channel 7)
+
+#ifndef __UART_TX_H__
+#define __UART_TX_H__
+
+#include "main.h" // HAL functions and defines
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UART_TX_RING_SIZE 1024 // bytes, power of 2.  ~89ms of output at 115200 baud.
+
+// What uart_tx_write() does when the ring is full
+typedef enum {
+	UART_TX_BLOCK, // wait for the DMA to make room (drops if called from an interrupt)
+	UART_TX_DROP,  // discard the bytes that don't fit
+	UART_TX_COUNT, // discard, then insert "[n bytes dropped]" once there is room
+} UART_TX_POLICY;
+
+typedef struct {
+	uint32_t bytes;      // bytes accepted into the ring
+	uint32_t transfers;  // DMA transfers started
+	uint32_t dropped;    // bytes discarded, ring full
+	uint32_t blocked;    // writes that waited for room
+	uint16_t high_water; // most bytes queued at once
+} UART_TX_STATS;
+
+extern UART_TX_STATS uart_tx_stats;
+
+int uart_tx_write(const uint8_t * data, int len);
+void uart_tx_flush(void);
+int uart_tx_busy(void);
+void uart_tx_set_policy(UART_TX_POLICY policy);
+int cl_tx(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UART_TX_H__
@@ -8,6 +8,12 @@
 #ifndef SRC_VERSION_H__
 #define SRC_VERSION_H__
 
+#include "RTClib.h" // DATE_TIME definition
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define VERSION_MAJOR	1
 #define VERSION_MINOR   3
 #define VERSION_BUILD	0
@@ -20,7 +26,18 @@ typedef struct {
 } VERSION_MAJOR_MINOR;
 
 
+// Firmware build time, local time from __DATE__ / __TIME__, parsed by the compiler
+typedef struct {
+	DATE_TIME dt;
+	uint32_t unix_local; // dt as seconds since 1970
+} BUILD_TIME;
+
 extern const VERSION_MAJOR_MINOR fw_version; // command_line.c
+extern const BUILD_TIME fw_build;            // build_time.cpp
 extern char szversion[];                     // command_line.c
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* SRC_VERSION_H__ */
@@ -14,6 +14,14 @@
 #include "DS3231.h"
 #include <stdio.h> // printf()
 #include "command_line.h"
+#include "rtc_backend.h"
+#include "i2c_queue.h"
+#include "timezone.h"
+#include "fmt.h"
+#include "DS3231_sqw.h"
+#include "task.h"
+#include "power.h"
+#include "trace.h"
 
 /*====================================================================================================
 | DS3231 Index Registers (See DS3231.pdf, Figure 1, Timekeeping Registers)
@@ -105,6 +113,18 @@ uint8_t ds3231_read_status(void)
 
 //=============================================================================
 
+// Return HAL_OK if the DS3231 responds and its time is valid (Oscillator Stop Flag clear)
+HAL_StatusTypeDef ds3231_check(void)
+{
+	uint8_t index = 0x0F;
+	uint8_t reg_data;
+	HAL_StatusTypeDef rc = i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), &reg_data, sizeof(reg_data));
+	if(HAL_OK != rc) return rc;
+	return (reg_data & 0x80) ? HAL_ERROR : HAL_OK;
+}
+
+//=============================================================================
+
 void ds3231_clearOSF(void)
 {
 	// Clear the status register (index 0Fh) OSF bit
@@ -115,22 +135,60 @@ void ds3231_clearOSF(void)
 
 //=============================================================================
 
+// Convert the DS3231 time/date registers (index 00h - 06h) into DATE_TIME format
+void ds3231_bcd_to_dt(const DS3231_TIME_BCD * t, DATE_TIME * dt)
+{
+	dt->ss = bcd2bin(t->ss);
+	dt->mm = bcd2bin(t->mm);
+	dt->hh = bcd2bin(t->hh); // bit 6 should be low (We can force it...)
+	dt->d  = bcd2bin(t->d);
+	dt->m  = bcd2bin(t->m & 0x1F); // remove century bit
+	dt->yOff = bcd2bin(t->y);
+}
+
+// Convert a DATE_TIME into DS3231 time/date register format (day of week not set)
+void ds3231_dt_to_bcd(const DATE_TIME * dt, DS3231_TIME_BCD * t)
+{
+	t->ss = bin2bcd(dt->ss);
+	t->mm = bin2bcd(dt->mm);
+	t->hh = bin2bcd(dt->hh);
+	t->dow = 0;
+	t->d  = bin2bcd(dt->d);
+	t->m  = bin2bcd(dt->m);
+	t->y  = bin2bcd(dt->yOff);
+}
+
+// Advance hh:mm of a BCD time image to the next minute, seconds become 00
+// The date registers are not carried, the display only needs hh:mm
+void ds3231_bcd_next_minute(DS3231_TIME_BCD * t)
+{
+	t->ss = 0x00;
+	if((t->mm & 0x0F) < 9) { t->mm++; return; }      // x0 - x8 -> x1 - x9
+	if(t->mm < 0x50) { t->mm = (t->mm & 0xF0) + 0x10; return; } // x9 -> (x+1)0
+	t->mm = 0x00;
+	if(t->hh == 0x23) t->hh = 0x00;
+	else if((t->hh & 0x0F) < 9) t->hh++;
+	else t->hh = (t->hh & 0xF0) + 0x10;
+}
+
+// Read the raw DS3231 time/date registers (index 00h - 06h), no conversion
+HAL_StatusTypeDef read_ds3231_bcd(DS3231_TIME_BCD * t)
+{
+	uint8_t index = 0;
+	return i2c_write_read_prio(I2C_PRIO_TIME, DS3231_ADDRESS, &index, sizeof(index), (uint8_t *)t, sizeof(*t));
+}
+
 // The Time/Date registers are located at index 00h - 06h
 // Use a "generic I2C API" to read index registers 000h - 06h
 // Read the DS3231 time/date registers into a DATE_TIME structure
 HAL_StatusTypeDef read_ds3231(DATE_TIME * dt)
 {
-	uint8_t index = 0;
-	uint8_t reg_data[7];
-	HAL_StatusTypeDef rc = i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), reg_data, sizeof(reg_data));
-	if(HAL_OK != rc) return rc; // if not success, return now
+	DS3231_TIME_BCD t;
+	TRACE_ENTER(DS3231_READ);
+	HAL_StatusTypeDef rc = read_ds3231_bcd(&t);
 	// Convert DS3231 register data into DATE_TIME format
-	dt->ss = bcd2bin(reg_data[0]);
-	dt->mm = bcd2bin(reg_data[1]);
-	dt->hh = bcd2bin(reg_data[2]); // bit 6 should be low (We can force it...)
-	dt->d  = bcd2bin(reg_data[4]);
-	dt->m  = bcd2bin(reg_data[5] & 0x1F); // remove century bit
-	dt->yOff = bcd2bin(reg_data[6]);
+	if(HAL_OK == rc) ds3231_bcd_to_dt(&t, dt);
+	TRACE_EXIT(DS3231_READ);
 	return rc;
 }
 
@@ -166,22 +224,30 @@ HAL_StatusTypeDef write_ds3231(const DATE_TIME * dt)
 int cl_time(void)
 {
 	DATE_TIME dt;
-	read_ds3231(&dt); // read in time and date values into DATE_TIME structure
+	rtc_read(&dt); // read in time and date values into DATE_TIME structure
+	tz_to_local(&dt); // the RTCs keep UTC, the user works in local time
 
 	if(4 == argc) {
 		// Set the time using arguments at index 1 <hours>, 2 <minutes>, 3 <seconds>
 		dt.hh = strtol(argv[1], NULL, 10); // user will use decimal
 		dt.mm = strtol(argv[2], NULL, 10);
 		dt.ss = strtol(argv[3], NULL, 10);
-		// Write new time values to DS3231
-		write_ds3231(&dt);
+		// Write new time values to DS3231 and the internal RTC
+		tz_to_utc(&dt);
+		rtc_write(&dt);
 	    // Reset the OSF bit
 	    ds3231_clearOSF();
 	}
 
-	// Always read the DS3231 and display the time
-	read_ds3231(&dt);
-	printf("%02u:%02u:%02u\r\n",dt.hh,dt.mm,dt.ss);
+	// Always read the RTC and display the time
+	rtc_read(&dt);
+	tz_to_local(&dt);
+	FMT f;
+	fmt_begin(&f);
+	fmt_u(&f, dt.hh, 2, '0'); fmt_char(&f, ':');
+	fmt_u(&f, dt.mm, 2, '0'); fmt_char(&f, ':');
+	fmt_u(&f, dt.ss, 2, '0'); fmt_str(&f, "\r\n");
+	fmt_end(&f);
 	return 0;
 }
 
@@ -189,7 +255,8 @@ int cl_time(void)
 int cl_date(void)
 {
 	DATE_TIME dt;
-	read_ds3231(&dt); // read in time and date values into DATE_TIME structure
+	rtc_read(&dt); // read in time and date values into DATE_TIME structure
+	tz_to_local(&dt); // the RTCs keep UTC, the user works in local time
 
 	if(4 == argc) {
 		// Set the date using arguments at index 1 <day>, 2 <month>, 3 <year>
@@ -198,13 +265,20 @@ int cl_date(void)
 		uint16_t year = strtol(argv[3], NULL, 10);
 		if(year >= 2000) year -= 2000; // convert to offset
 		dt.yOff = (uint8_t)year;
-		// Write new date values to DS3231
-		write_ds3231(&dt);
+		// Write new date values to DS3231 and the internal RTC
+		tz_to_utc(&dt);
+		rtc_write(&dt);
 	}
 
-	// Always read the DS3231 and display the date
-	read_ds3231(&dt);
-	printf("%02u/%02u/%04u\r\n",dt.d,dt.m,dt.yOff + 2000);
+	// Always read the RTC and display the date
+	rtc_read(&dt);
+	tz_to_local(&dt);
+	FMT f;
+	fmt_begin(&f);
+	fmt_u(&f, dt.d, 2, '0'); fmt_char(&f, '/');
+	fmt_u(&f, dt.m, 2, '0'); fmt_char(&f, '/');
+	fmt_u(&f, dt.yOff + 2000U, 4, '0'); fmt_str(&f, "\r\n");
+	fmt_end(&f);
 	return 0;
 }
 
@@ -220,12 +294,21 @@ int cl_ds3231_dump(void)
         "Alarm1 Sec","Alarm1 Min","Alarm1 Hr","Alarm1 Day-Date",
         "Alarm2 Min","Alarm2 Hr","Alarm2 Day-Date",
         "Control","Cntrl/Status","Aging Offset","MSB of Temp","LSB of Temp"};
-    i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), reg_data, sizeof(reg_data));
-    printf("Indx Data   Register name\n");
+    i2c_write_read_prio(I2C_PRIO_DIAG, DS3231_ADDRESS, &index, sizeof(index), reg_data, sizeof(reg_data));
+    FMT f;
+    fmt_begin(&f);
+    fmt_str(&f, "Indx Data   Register name\n");
     for(unsigned i=0;i<19;i++) {
-        printf("%02X   0x%02X   %s\n",i,reg_data[i],reg_name[i]);
+        fmt_x(&f, i, 2); fmt_str(&f, "   0x");
+        fmt_x(&f, reg_data[i], 2); fmt_str(&f, "   ");
+        fmt_str(&f, reg_name[i]); fmt_char(&f, '\n');
     }
-	printf("\n");
+    // 11h: signed integer degrees, 12h bits 7:6: quarter degrees
+    int16_t quarters = (int16_t)(((uint16_t)reg_data[0x11] << 8) | reg_data[0x12]) >> 6;
+    fmt_str(&f, "Temperature: ");
+    fmt_fixed(&f, quarters, 2, 2);
+    fmt_str(&f, " C\n\n");
+    fmt_end(&f);
 	return 0;
 }
 
@@ -255,21 +338,64 @@ int cl_sqw_test(void)
   return 0;
 }
 
-// Configure SQW/INT pin for alarm interrupt output)
-// Spin, watching the A1F flash
+// Configure SQW/INT pin for alarm interrupt output
+// A background task (see task.c) polls the A1F flag every 200ms until alarm 1 fires, then
+// restores the 1Hz SQW output the clock uses.  The command line and clock keep running.
 // Example serial output:
-//   Display status of A1F flag...
-//   Press any key to exit...
-//   000000000000000000000011111111111111111111111111   (22 '0's, 200ms delay each)
-// This command works great, except it doesn't reset....  May need to write 1's to bits to clear them vs 0
+//   Setting alarm for 5 seconds from now...
+//   (register dump)
+//   [1] alarm
+//   A1F set 5012 ms after the alarm was set
+//   [1] alarm done
+#define ALARM_POLL_MS    200
+#define ALARM_TIMEOUT_MS 10000
+
+static TASK_STATUS alarm_run(TASK * t);
+static void alarm_stop(TASK * t);
+static TASK alarm_task = {"alarm", alarm_run, alarm_stop};
+static uint32_t alarm_set_ticks;
+
+static TASK_STATUS alarm_run(TASK * t)
+{
+	uint8_t index = 0x0F;
+	uint8_t status = 0;
+
+	TASK_BEGIN(t);
+	for(;;) {
+		TASK_SLEEP(t, ALARM_POLL_MS);
+		i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), &status, sizeof(status));
+		if(status & 1) {
+			printf("A1F set %lu ms after the alarm was set\n", HAL_GetTick() - alarm_set_ticks);
+			break;
+		}
+		if(HAL_GetTick() - alarm_set_ticks > ALARM_TIMEOUT_MS) {
+			printf("A1F not set within %u ms\n", ALARM_TIMEOUT_MS);
+			break;
+		}
+	}
+	alarm_stop(t);
+	TASK_END(t);
+}
+
+// Disable alarm 1 and return SQW/INT to the 1Hz output, or to the power mode's minute alarm
+static void alarm_stop(TASK * t)
+{
+	power_int_restore();
+}
+
 int cl_alarm(void)
 {
+	if(task_running(&alarm_task)) {
+		printf("alarm is already running\n");
+		return 1;
+	}
+
 	// Begin by disabling the alarm - Read Control register, index 0Eh
 	uint8_t index = 0x0E;
 	uint8_t control_reg;
 	i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), &control_reg, sizeof(control_reg));
 
-	control_reg &= 0xFC; // Clear alarm enable bits,
+	control_reg &= 0xFE; // Clear the alarm 1 enable bit (A2IE belongs to the power mode),
 	control_reg |= 4;    // Set INTCN to 1 (Let's use SQW/INT pin for alarm interrupt output)
 	uint8_t index_control[3] = {index,control_reg,0};
 
@@ -283,12 +409,9 @@ int cl_alarm(void)
 
     DATE_TIME dt;
     printf("Setting alarm for 5 seconds from now...\n");
-    // Get current time and convert it to unix seconds count
+    // Get current time, advance it 5 seconds
     read_ds3231(&dt); // fill in DATE_TIME structure
-    uint32_t ut_now = rtc2unix(&dt);
-    uint32_t ut_future = ut_now + 5; // 5 seconds from now
-    // Convert back into DATE-TIME format
-    unix2rtc(&dt, ut_future); // DATE_TIME is now 3 seconds in the future
+    rtcAddSeconds(&dt, 5); // DATE_TIME is now 5 seconds in the future
 
     // If we wish to alarm on a second boundary, we need to use Alarm1 that includes a seconds register
     // Looking at Table 2. Alarm Mask Bits, we want A1M4:A1M1 set as 0b1000, Alarm when hours, minutes, and seconds match
@@ -304,19 +427,9 @@ int cl_alarm(void)
 	// Dump registers as we begin to wait
 	cl_ds3231_dump();
 
-	// While we wait, show the status of A1F
-	index = 0x0F;
-	uint8_t status;
-	printf("Display status of A1F flag...\nPress any key to exit...\n");
-
-	while(EOF == __io_getchar() ) {
-		i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), &status, sizeof(status));
-		//printf("\b \b%c",(status&1)?'1':'0');
-		printf("%c",(status&1)?'1':'0');
-		HAL_Delay(200); // display a '1' or '0' every 200ms
-	}
-	printf("\n");
-
+	// Watch A1F in the background
+	alarm_set_ticks = HAL_GetTick();
+	task_start(&alarm_task);
     return 0;
 }
 
@@ -0,0 +1,176 @@
+// DS3231_cal.c, DS3231 aging offset calibration against the HSE derived 72MHz clock
+//
+// The DS3231's 1Hz SQW edges are timestamped by TIM2 at 72MHz (PLL, HSE derived), see DS3231_sqw.c.
+//
+// Edge timestamps are queued by the capture interrupt and fed to the estimator from the
+// superloop (ds3231_cal_task).  Each time the estimator completes a window (default one hour)
+// the residual frequency error is used to nudge the DS3231 Aging Offset register (10h).
+// A positive aging offset adds capacitance to the crystal, slowing the oscillator.
+//
+// Notes:
+// * The DS3231 Control register (0Eh) must keep INTCN = 0, RS2:RS1 = 00 for the 1Hz output.
+//   "alarm" and "sqw" commands change these bits, restarting the current window.
+// * The aging offset register is battery backed within the DS3231.  The estimator state
+//   is kept in STM32 backup registers (see DS3231_cal.h).
+// * The result can only be as good as the HSE reference (NUCLEO: ST-LINK 8MHz MCO).
+
+#include "main.h" // HAL error definitions
+#include <stdio.h> // printf()
+#include <string.h> // strcmp()
+#include "DS3231.h"
+#include "DS3231_cal.h"
+#include "DS3231_sqw.h"
+#include "cal_estimator.h"
+#include "command_line.h"
+#include "power.h"
+
+extern RTC_HandleTypeDef hrtc; // main.c
+
+static CAL_ESTIMATOR est;
+static uint8_t cal_enabled;
+static int8_t aging_offset; // last value written to / read from the DS3231
+
+//=============================================================================
+// DS3231 register access
+
+static HAL_StatusTypeDef ds3231_read_aging(int8_t * value)
+{
+	uint8_t index = 0x10;
+	return i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), (uint8_t *)value, 1);
+}
+
+// Write the aging offset, then request a temperature conversion (CONV) so
+// the new value is applied now rather than at the next 64 second conversion
+static HAL_StatusTypeDef ds3231_write_aging(int8_t value)
+{
+	uint8_t index_aging[2] = {0x10, (uint8_t)value};
+	HAL_StatusTypeDef rc = i2c_write_read(DS3231_ADDRESS, index_aging, sizeof(index_aging), NULL, 0);
+	if(HAL_OK != rc) return rc;
+
+	uint8_t index = 0x0E;
+	uint8_t control;
+	rc = i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), &control, sizeof(control));
+	if(HAL_OK != rc) return rc;
+	uint8_t index_control[2] = {0x0E, control | 0x20}; // CONV
+	return i2c_write_read(DS3231_ADDRESS, index_control, sizeof(index_control), NULL, 0);
+}
+
+//=============================================================================
+// Persistence (STM32 backup registers)
+
+static void cal_save(void)
+{
+	uint32_t window_min = est.window_s / 60;
+	HAL_RTCEx_BKUPWrite(&hrtc, CAL_BKP_MAGIC, CAL_BKP_MAGIC_VALUE);
+	HAL_RTCEx_BKUPWrite(&hrtc, CAL_BKP_FLAGS, (cal_enabled ? 0x8000 : 0) | (window_min & 0x7FFF));
+	HAL_RTCEx_BKUPWrite(&hrtc, CAL_BKP_PPB_LO, (uint32_t)est.ppb & 0xFFFF);
+	HAL_RTCEx_BKUPWrite(&hrtc, CAL_BKP_PPB_HI, ((uint32_t)est.ppb >> 16) & 0xFFFF);
+	HAL_RTCEx_BKUPWrite(&hrtc, CAL_BKP_ESTIMATES, est.estimates & 0xFFFF);
+}
+
+// Restore calibration state.  Return 1 if calibration was running before reset.
+static int cal_restore(void)
+{
+	if(HAL_RTCEx_BKUPRead(&hrtc, CAL_BKP_MAGIC) != CAL_BKP_MAGIC_VALUE) return 0;
+	uint32_t flags = HAL_RTCEx_BKUPRead(&hrtc, CAL_BKP_FLAGS);
+	uint32_t window_min = flags & 0x7FFF;
+	if(window_min) cal_est_init(&est, CAL_REF_HZ, window_min * 60);
+	est.ppb = (int32_t)(HAL_RTCEx_BKUPRead(&hrtc, CAL_BKP_PPB_LO) | (HAL_RTCEx_BKUPRead(&hrtc, CAL_BKP_PPB_HI) << 16));
+	est.estimates = HAL_RTCEx_BKUPRead(&hrtc, CAL_BKP_ESTIMATES);
+	return (flags & 0x8000) != 0;
+}
+
+//=============================================================================
+
+// Called once at power-up, resumes calibration if it was running
+void ds3231_cal_init(void)
+{
+	cal_est_init(&est, CAL_REF_HZ, CAL_WINDOW_DEFAULT);
+	if(cal_restore()) ds3231_cal_start();
+}
+
+// Configure the DS3231 for 1Hz SQW and begin feeding edges to the estimator.  While the power
+// mode owns INT/SQW there are no edges, calibration resumes with "power off".
+int ds3231_cal_start(void)
+{
+	if(!power_enabled() && HAL_OK != sqw_start()) return -1;
+	if(HAL_OK != ds3231_read_aging(&aging_offset)) return -1;
+	cal_est_restart(&est);
+	cal_enabled = 1;
+	cal_save();
+	return 0;
+}
+
+// Stop using edges, SQW capture continues for the clock display
+void ds3231_cal_stop(void)
+{
+	cal_enabled = 0;
+	cal_save();
+}
+
+// Superloop task - feed captured edges to the estimator, trim the aging offset when
+// an estimate completes
+void ds3231_cal_task(void)
+{
+	uint64_t ts;
+	while(sqw_edge_get(&ts)) {
+		if(!cal_enabled || !cal_est_edge(&est, ts)) continue;
+
+		// New estimate, trim the aging offset
+		int8_t aging = cal_est_aging(aging_offset, est.ppb);
+		if(aging != aging_offset && HAL_OK == ds3231_write_aging(aging)) {
+			aging_offset = aging;
+			cal_est_restart(&est); // window spanning the change is not representative
+		}
+		cal_save();
+	}
+}
+
+// Print parts per billion as +/-x.xxx ppm
+static void print_ppm(int32_t ppb)
+{
+	uint32_t mag = ppb < 0 ? -ppb : ppb;
+	printf("%c%lu.%03lu ppm", ppb < 0 ? '-' : '+', mag / 1000, mag % 1000);
+}
+
+// Command line method to control / report the aging offset calibration
+// cal             : display status
+// cal on | off    : start / stop calibration
+// cal reset       : discard estimates and set the aging offset to 0
+// cal window <m>  : minutes of SQW edges per estimate
+int cl_cal(void)
+{
+	if(argc > 1) {
+		if(strcmp(argv[1], "on") == 0) {
+			if(ds3231_cal_start()) printf("Unable to configure DS3231\n");
+		} else if(strcmp(argv[1], "off") == 0) {
+			ds3231_cal_stop();
+		} else if(strcmp(argv[1], "reset") == 0) {
+			cal_est_init(&est, CAL_REF_HZ, est.window_s);
+			if(HAL_OK == ds3231_write_aging(0)) aging_offset = 0;
+			cal_save();
+		} else if(strcmp(argv[1], "window") == 0 && argc > 2) {
+			uint32_t minutes = strtoul(argv[2], NULL, 10);
+			if(minutes < 1 || minutes > CAL_WINDOW_MAX / 60) {
+				printf("Window: 1 - %u minutes\n", CAL_WINDOW_MAX / 60);
+				return 1;
+			}
+			est.window_s = minutes * 60;
+			cal_est_restart(&est);
+			cal_save();
+		} else {
+			printf("cal <on | off | reset | window minutes>\n");
+			return 1;
+		}
+	}
+
+	ds3231_read_aging(&aging_offset);
+	printf("Calibration: %s\n", cal_enabled ? "on" : "off");
+	printf("Window:      %lu / %lu s\n", est.seconds, est.window_s);
+	printf("Aging:       %d\n", aging_offset);
+	printf("Residual:    ");
+	if(est.estimates) print_ppm(est.ppb); else printf("(none)");
+	printf("\nEstimates:   %lu\n", est.estimates);
+	printf("Rejected:    %lu edges, %lu dropped\n", est.rejected, sqw_queue_drops());
+	return 0;
+}
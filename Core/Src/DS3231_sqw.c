@@ -0,0 +1,131 @@
+// DS3231_sqw.c, DS3231 1Hz SQW edge capture
+//
+// The DS3231's INT/SQW pin, configured for a 1Hz square wave, is connected to PA0 (TIM2_CH1).
+// The DS3231 seconds register increments on the falling edge of the 1Hz output.
+// TIM2 runs at 72MHz (PLL, HSE derived) with no prescaler, and captures each falling SQW edge.
+// The 16-bit capture value is extended to 64 bits by counting TIM2 update (overflow) interrupts.
+//
+// Each edge is delivered two ways:
+// * A small queue of timestamps, consumed by the aging offset calibration (DS3231_cal.c)
+// * A "pending" flag holding the latest 1Hz edge, consumed by the clock display
+
+#include "main.h" // HAL error definitions
+#include "DS3231.h"
+#include "DS3231_sqw.h"
+#include "sched.h"
+
+extern TIM_HandleTypeDef htim2; // main.c
+
+// Queue of captured SQW edge timestamps (written by interrupt, read by superloop)
+#define SQW_EDGE_QUEUE_SIZE 4 // power of 2
+static volatile uint64_t edge_queue[SQW_EDGE_QUEUE_SIZE];
+static volatile uint8_t edge_in;
+static volatile uint8_t edge_out;
+static volatile uint32_t edge_drops;  // edges lost due to a full queue
+static volatile uint32_t overflows;   // TIM2 update count, upper bits of the timestamp
+
+// Latest edge that is at least ~1 second after the previous one (ignores 1024Hz+ SQW rates)
+static volatile uint64_t edge_last;
+static volatile uint8_t edge_flag;
+static volatile uint32_t edge_tick;   // HAL_GetTick() at the latest edge
+
+//=============================================================================
+// TIM2 interrupt callbacks (see HAL_TIM_IRQHandler())
+
+// TIM2 update, from HAL_TIM_PeriodElapsedCallback() (main.c)
+void sqw_overflow(void)
+{
+	overflows++;
+}
+
+void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim)
+{
+	if(htim->Instance != TIM2) return;
+	uint32_t capture = HAL_TIM_ReadCapturedValue(htim, TIM_CHANNEL_1);
+	uint32_t upper = overflows;
+	// HAL_TIM_IRQHandler() services capture before update.  If an update is pending and the
+	// captured value is small, the capture happened after the roll-over that isn't counted yet.
+	if(__HAL_TIM_GET_FLAG(htim, TIM_FLAG_UPDATE) && capture < 0x8000) upper++;
+	uint64_t ts = ((uint64_t)upper << 16) | capture;
+	sched_post(SCHED_EV_SQW);
+
+	if(ts - edge_last >= SQW_TICKS_PER_SECOND - SQW_TICKS_PER_SECOND / 10) {
+		edge_last = ts;
+		edge_flag = 1;
+		edge_tick = HAL_GetTick();
+	}
+
+	uint8_t next = (edge_in + 1) & (SQW_EDGE_QUEUE_SIZE - 1);
+	if(next == edge_out) {
+		edge_drops++;
+		return;
+	}
+	edge_queue[edge_in] = ts;
+	edge_in = next;
+}
+
+//=============================================================================
+
+// Configure INT/SQW for a 1Hz square wave (INTCN = 0, RS2:RS1 = 00, alarm interrupts off)
+// and begin capturing edges
+HAL_StatusTypeDef sqw_start(void)
+{
+	uint8_t index = 0x0E;
+	uint8_t control;
+	HAL_StatusTypeDef rc = i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), &control, sizeof(control));
+	if(HAL_OK != rc) return rc;
+	uint8_t index_control[2] = {0x0E, control & ~0x1F}; // clear RS2, RS1, INTCN, A2IE, A1IE
+	rc = i2c_write_read(DS3231_ADDRESS, index_control, sizeof(index_control), NULL, 0);
+	if(HAL_OK != rc) return rc;
+
+	if(htim2.ChannelState[0] != HAL_TIM_CHANNEL_STATE_BUSY) {
+		__HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE);
+		__HAL_TIM_ENABLE_IT(&htim2, TIM_IT_UPDATE);
+		rc = HAL_TIM_IC_Start_IT(&htim2, TIM_CHANNEL_1);
+	}
+	return rc;
+}
+
+// Return the current TIM2 time, in the same units as the edge timestamps
+uint64_t sqw_now(void)
+{
+	uint32_t upper, count;
+	do {
+		upper = overflows;
+		count = TIM2->CNT;
+	} while(upper != overflows);
+	// Roll-over not yet serviced (called with interrupts masked)
+	if(__HAL_TIM_GET_FLAG(&htim2, TIM_FLAG_UPDATE) && count < 0x8000) upper++;
+	return ((uint64_t)upper << 16) | count;
+}
+
+// Remove an edge timestamp from the queue.  Return 1 if one was available.
+int sqw_edge_get(uint64_t * ts)
+{
+	if(edge_out == edge_in) return 0;
+	*ts = edge_queue[edge_out];
+	edge_out = (edge_out + 1) & (SQW_EDGE_QUEUE_SIZE - 1);
+	return 1;
+}
+
+// Return 1 (and the edge timestamp) if a 1Hz edge occurred since the last call
+int sqw_edge_pending(uint64_t * ts)
+{
+	if(!edge_flag) return 0;
+	__disable_irq();
+	*ts = edge_last;
+	edge_flag = 0;
+	__enable_irq();
+	return 1;
+}
+
+// Return 1 if 1Hz edges are arriving
+int sqw_active(void)
+{
+	return edge_tick && (HAL_GetTick() - edge_tick) < SQW_TIMEOUT_MS;
+}
+
+uint32_t sqw_queue_drops(void)
+{
+	return edge_drops;
+}
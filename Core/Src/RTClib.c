@@ -20,6 +20,50 @@
 */
 const uint8_t daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
 
+/**************************************************************************/
+/*!
+    @brief  Days since 1970/01/01 of a civil date, closed form.
+            Howard Hinnant's days_from_civil(), with March as the first
+            month of the year so the leap day is last.  Unsigned: valid
+            for years after 0000-03-01.
+            http://howardhinnant.github.io/date_algorithms.html
+    @param y Year
+    @param m Month 1-12
+    @param d Day 1-31
+    @return Days since 1970-01-01
+*/
+/**************************************************************************/
+static uint32_t days_from_civil(uint32_t y, uint32_t m, uint32_t d) {
+  y -= m <= 2;
+  const uint32_t era = y / 400;
+  const uint32_t yoe = y - era * 400;                                 // [0, 399]
+  const uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1; // [0, 365]
+  const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;         // [0, 146096]
+  return era * 146097 + doe - 719468;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Civil date of a day number, closed form.
+            Howard Hinnant's civil_from_days(), the inverse of
+            days_from_civil().
+    @param dt DATE_TIME, yOff, m and d are set
+    @param z Days since 1970-01-01, on or after 2000-01-01
+*/
+/**************************************************************************/
+static void civil_from_days(DATE_TIME * dt, uint32_t z) {
+  z += 719468;
+  const uint32_t era = z / 146097;
+  const uint32_t doe = z - era * 146097;                                 // [0, 146096]
+  const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; // [0, 399]
+  const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);          // [0, 365]
+  const uint32_t mp = (5 * doy + 2) / 153;                               // [0, 11]
+  const uint32_t m = mp < 10 ? mp + 3 : mp - 9;                          // [1, 12]
+  dt->d = doy - (153 * mp + 2) / 5 + 1;
+  dt->m = m;
+  dt->yOff = yoe + era * 400 + (m <= 2) - 2000;
+}
+
 /**************************************************************************/
 /*!
     @brief  Given a date, return number of days since 2000/01/01,
@@ -31,14 +75,9 @@ const uint8_t daysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
 */
 /**************************************************************************/
 static uint16_t date2days(uint16_t y, uint8_t m, uint8_t d) {
-  if (y >= 2000U)
-    y -= 2000U;
-  uint16_t days = d;
-  for (uint8_t i = 1; i < m; ++i)
-    days += daysInMonth[i - 1];
-  if (m > 2 && y % 4 == 0)
-    ++days;
-  return days + 365 * y + (y + 3) / 4 - 1;
+  if (y < 2000U)
+    y += 2000U;
+  return days_from_civil(y, m, d) - DAYS_FROM_1970_TO_2000;
 }
 
 /**************************************************************************/
@@ -85,30 +124,14 @@ static uint32_t time2ulong(uint16_t days, uint8_t h, uint8_t m, uint8_t s) {
 */
 /**************************************************************************/
 void unix2rtc(DATE_TIME * dt, uint32_t t){
-  t -= SECONDS_FROM_1970_TO_2000; // bring to 2000 timestamp from 1970
-
-  dt->ss = t % 60;
-  t /= 60;
-  dt->mm = t % 60;
-  t /= 60;
-  dt->hh = t % 24;
-  uint16_t days = t / 24;
-  uint8_t leap;
-  for (dt->yOff = 0;; ++dt->yOff) {
-    leap = dt->yOff % 4 == 0;
-    if (days < 365U + leap)
-      break;
-    days -= 365 + leap;
-  }
-  for (dt->m = 1; dt->m < 12; ++dt->m) {
-    uint8_t daysPerMonth = daysInMonth[dt->m - 1];
-    if (leap && dt->m == 2)
-      ++daysPerMonth;
-    if (days < daysPerMonth)
-      break;
-    days -= daysPerMonth;
-  }
-  dt->d = days + 1;
+  uint32_t days = t / SECONDS_PER_DAY;
+  uint32_t secs = t - days * SECONDS_PER_DAY;
+
+  dt->hh = secs / 3600;
+  secs -= dt->hh * 3600U;
+  dt->mm = secs / 60;
+  dt->ss = secs - dt->mm * 60U;
+  civil_from_days(dt, days);
 }
 
 /**************************************************************************/
@@ -153,6 +176,93 @@ uint32_t rtc2seconds(DATE_TIME * dt) {
   return t;
 }
 
+/**************************************************************************/
+/*!
+    @brief  Number of days in a month, valid for 2000--2099
+    @param yOff Year offset from 2000
+    @param m Month 1-12
+*/
+/**************************************************************************/
+static uint8_t monthDays(uint8_t yOff, uint8_t m) {
+  if (m == 2 && yOff % 4 == 0)
+    return 29;
+  return daysInMonth[m - 1];
+}
+
+/**************************************************************************/
+/*!
+    @brief  Advance the date by a number of days, carrying into the month
+            and year.  One month length check per month crossed.
+    @param dt DATE_TIME to modify
+    @param days Days to add
+*/
+/**************************************************************************/
+static void addDays(DATE_TIME * dt, uint32_t days) {
+  while (days) {
+    uint8_t left = monthDays(dt->yOff, dt->m) - dt->d; // days left in this month
+    if (days <= left) {
+      dt->d += days;
+      return;
+    }
+    days -= left + 1U;
+    dt->d = 1;
+    if (++dt->m > 12) {
+      dt->m = 1;
+      ++dt->yOff;
+    }
+  }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Add minutes to a DATE_TIME, carrying through the fields
+            without a round-trip through unix time.
+    @param dt DATE_TIME to modify
+    @param minutes Minutes to add
+*/
+/**************************************************************************/
+void rtcAddMinutes(DATE_TIME * dt, uint32_t minutes) {
+  minutes += dt->mm;
+  if (minutes < 60) {
+    dt->mm = minutes; // common case, no carry
+    return;
+  }
+  uint32_t hours = minutes / 60 + dt->hh;
+  dt->mm = minutes % 60;
+  dt->hh = hours % 24;
+  addDays(dt, hours / 24);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Add seconds to a DATE_TIME, carrying through the fields
+            without a round-trip through unix time.  Ticking a clock by
+            one second is a compare in 59 of 60 calls.
+    @param dt DATE_TIME to modify
+    @param seconds Seconds to add
+*/
+/**************************************************************************/
+void rtcAddSeconds(DATE_TIME * dt, uint32_t seconds) {
+  seconds += dt->ss;
+  if (seconds < 60) {
+    dt->ss = seconds; // common case, no carry
+    return;
+  }
+  dt->ss = seconds % 60;
+  rtcAddMinutes(dt, seconds / 60);
+}
+
+/**************************************************************************/
+/*!
+    @brief  Advance a DATE_TIME to the start of the next minute (ss = 0)
+    @param dt DATE_TIME to modify
+*/
+/**************************************************************************/
+void rtcNextMinute(DATE_TIME * dt) {
+  dt->ss = 0;
+  rtcAddMinutes(dt, 1);
+}
+
 /**************************************************************************/
 /*!
     @brief  Convert a string containing two digits to uint8_t, e.g. "09" returns
@@ -23,6 +23,7 @@ extern "C" {
 }
 
 #include <TM1637Display.h>
+#include "trace.h"
 
 #define TM1637_I2C_COMM1    0x40
 #define TM1637_I2C_COMM2    0xC0
@@ -77,6 +78,7 @@ TM1637Display::TM1637Display(STM32Gpio pinClk, STM32Gpio pinDIO, unsigned int bi
 	m_pinClk = pinClk;
 	m_pinDIO = pinDIO;
 	m_bitDelay = bitDelay;
+	m_shownBrightness = 0xFF; // nothing written yet, the first updateSegments() writes everything
 }
 
 //! Sometime later, after GPIO pins become available....
@@ -103,6 +105,7 @@ void TM1637Display::setBrightness(uint8_t brightness, bool on)
 
 void TM1637Display::setSegments(const uint8_t segments[], uint8_t length, uint8_t pos)
 {
+	TRACE_ENTER(SEGMENTS);
     // Write COMM1
 	start();
 	writeByte(TM1637_I2C_COMM1);
@@ -122,6 +125,39 @@ void TM1637Display::setSegments(const uint8_t segments[], uint8_t length, uint8_
 	start();
 	writeByte(TM1637_I2C_COMM3 + (m_brightness & 0x0f));
 	stop();
+
+	for (uint8_t k=0; k < length && pos + k < 4; k++)
+	  m_shown[pos + k] = segments[k];
+	m_shownBrightness = m_brightness;
+	TRACE_EXIT(SEGMENTS);
+}
+
+void TM1637Display::updateSegments(const uint8_t segments[4])
+{
+	if (m_shownBrightness != m_brightness) {
+	  setSegments(segments);
+	  return;
+	}
+	uint8_t first = 0;
+	uint8_t last = 3;
+	while (first < 4 && segments[first] == m_shown[first])
+	  first++;
+	if (first == 4)
+	  return;
+	while (segments[last] == m_shown[last])
+	  last--;
+
+	TRACE_ENTER(SEGMENTS);
+	// The data command (COMM1, auto increment) and the display control (COMM3) written by
+	// setSegments() are still in effect, only the address and the changed digits are sent
+	start();
+	writeByte(TM1637_I2C_COMM2 + first);
+	for (uint8_t k=first; k <= last; k++) {
+	  writeByte(segments[k]);
+	  m_shown[k] = segments[k];
+	}
+	stop();
+	TRACE_EXIT(SEGMENTS);
 }
 
 void TM1637Display::clear()
@@ -222,6 +258,7 @@ void TM1637Display::stop()
 
 bool TM1637Display::writeByte(uint8_t b)
 {
+  TRACE_ENTER(WRITE_BYTE);
   uint8_t data = b;
 
   // 8 Data Bits
@@ -262,6 +299,7 @@ bool TM1637Display::writeByte(uint8_t b)
   pinMode(m_pinClk, OUTPUT);
   bitDelay();
 
+  TRACE_EXIT(WRITE_BYTE);
   return ack;
 }
 
@@ -278,3 +316,9 @@ uint8_t TM1637Display::encodeDigit(uint8_t digit)
 {
 	return digitToSegment[digit & 0x0f];
 }
+
+void TM1637Display::encodeBCD(uint8_t bcd, uint8_t segments[2], bool leading_zero)
+{
+	segments[0] = (leading_zero || (bcd & 0xF0)) ? digitToSegment[bcd >> 4] : 0;
+	segments[1] = digitToSegment[bcd & 0x0f];
+}
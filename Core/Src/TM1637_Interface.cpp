@@ -7,6 +7,12 @@
 #include "RTClib.h"
 #include "stm32f1xx_hal_rtc.h"
 #include "DS3231.h"
+#include "DS3231_sqw.h"
+#include "rtc_backend.h"
+#include "i2c_queue.h"
+#include "timezone.h"
+#include "task.h"
+#include "sched.h"
 
 /* Define GPIO pins : TM1637_CLK_Pin TM1637_DIO_Pin for STM32Gpio class objects */
 STM32Gpio TM1637_CLK(TM1637_DIO_GPIO_Port, TM1637_CLK_Pin);
@@ -164,8 +170,14 @@ STM32Gpio TM1637_DIO(TM1637_DIO_GPIO_Port, TM1637_DIO_Pin);
 	}
 }*/
 
+// Bit delay: 5us keeps the bus well under the TM1637's maximum clock rate, and puts the worst
+// minute roll-over (all 4 digits change, 144 bit delays) at about 0.75ms.  The library's
+// default of 100us takes 20ms to write a frame.
+#define TM1637_BIT_DELAY_US 5
+
 // Constructor for the TM1637 - Doesn't write to the pins
-TM1637Display display(TM1637_CLK, TM1637_DIO,100);
+TM1637Display display(TM1637_CLK, TM1637_DIO, TM1637_BIT_DELAY_US);
+static uint8_t brightness = 0x0f; // TM1637 display control: bits 2:0 level, bit 3 on
 
 // Initialize the TM1637 for clock usage
 // Display 00:00 on the display
@@ -173,46 +185,234 @@ void init_tm1637(void)
 {
 	// Initialize - configure the GPIO pins
 	display.configure_gpio_pins();
-	display.setBrightness(0x0f);
+	display.setBrightness(brightness & 0x07, brightness & 0x08);
 	//display.clear();
 	display.showNumberDecEx(0, colonMask, true, 2, 0);
 	display.showNumberDec(0, true, 2, 2);
+	// Phase-lock the minute roll-over to the DS3231 1Hz SQW output
+	if(HAL_OK != sqw_start()) printf("sqw_start() Error\r\n");
+}
+
+// Minute roll-over instrumentation
+// Latency is measured from the SQW falling edge (seconds roll-over) to the end of the display write
+#define ROLLOVER_LATE_US 1000
+static uint32_t rollover_count;      // frames committed on an SQW edge
+static uint32_t rollover_last_us;    // latency of the most recent commit
+static uint32_t rollover_max_us;     // worst case latency
+static uint32_t rollover_late;       // commits later than ROLLOVER_LATE_US
+static uint32_t rollover_unsynced;   // display updates not staged ahead of an edge (boot, time set, no SQW)
+
+static DS3231_TIME_BCD displayed = {0xFF, 0xFF, 0xFF}; // intentionally an invalid time
+static DS3231_TIME_BCD staged_time;  // time of staged_frame
+static uint8_t staged_frame[4];      // segment data for the next minute
+static bool staged;                  // staged_frame is committed on the next SQW edge
+
+// Time registers (00h - 06h), read from the I2C interrupt after each SQW edge
+static I2C_REQUEST time_req;
+static DS3231_TIME_BCD time_regs;
+static volatile bool time_ready;
+
+// 24 hour BCD hours (index) to 12 hour BCD hours.  Hour 00 displays as 12 so the colon shows.
+static const uint8_t hour12_bcd[0x24] = {
+	0x12, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0, 0, 0, 0, 0, 0, // 00 - 09
+	0x10, 0x11, 0x12, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0, 0, 0, 0, 0, 0, // 10 - 19
+	0x08, 0x09, 0x10, 0x11,                                                       // 20 - 23
+};
+
+// Build the 4 segment bytes for hh:mm in 12 hour format, straight from the BCD registers
+static void clock_frame(const DS3231_TIME_BCD * t, uint8_t segments[4])
+{
+	uint8_t hh = t->hh < sizeof(hour12_bcd) ? hour12_bcd[t->hh] : 0;
+	display.encodeBCD(hh, &segments[0], false); // leading zero is blank
+	display.encodeBCD(t->mm, &segments[2]);
+	segments[1] |= 0x80; // colon
+}
+
+// Show hh:mm now
+static void clock_show(const DS3231_TIME_BCD * t)
+{
+	uint8_t segments[4];
+	clock_frame(t, segments);
+	display.setSegments(segments);
+	displayed = *t;
+}
+
+// Local time image for a UTC time
+static void clock_local(uint32_t utc, DS3231_TIME_BCD * t)
+{
+	DATE_TIME dt;
+	unix2rtc(&dt, tz_local(utc));
+	ds3231_dt_to_bcd(&dt, t);
+}
+
+// The UTC minute last converted to local time
+static DS3231_TIME_BCD minute_regs = {0xFF, 0xFF, 0xFF}; // UTC registers, intentionally invalid
+static DS3231_TIME_BCD minute_local; // local time at second 00
+static uint32_t minute_utc;          // UTC seconds at second 00
+
+// Local time image for the UTC time registers
+// The conversion (rtc2unix(), the DST table, unix2rtc()) runs when the UTC minute changes, the
+// other 59 seconds only copy the seconds.  The time zone rule is fixed at build time and DST
+// starts and ends on a minute roll-over, so the minute is the only key needed.
+static void clock_local_bcd(const DS3231_TIME_BCD * utc, DS3231_TIME_BCD * t)
+{
+	if(ds3231_date_minute_changed(utc, &minute_regs)) {
+		DATE_TIME dt;
+		ds3231_bcd_to_dt(utc, &dt);
+		minute_utc = rtc2unix(&dt) - dt.ss;
+		clock_local(minute_utc, &minute_local);
+		minute_regs = *utc;
+	}
+	*t = minute_local;
+	t->ss = utc->ss; // whole minute offsets
 }
 
 // Check time, update clock if needed, else just return
-// This gets called every second.  Only update display if the minutes value changes.
+// This gets called every second when SQW edges are not available.  Only update display if the minutes value changes.
 void update_clock(void)
 {
-	static uint8_t previous_minutes = 100; // intentionally an invalid value
 	DATE_TIME dt;
-	// Read RTC into DATE_TIME structure
-	read_ds3231(&dt);
+	DS3231_TIME_BCD utc, t;
+	// Read the cheapest healthy RTC into DATE_TIME structure
+	if(HAL_OK != rtc_read(&dt)) return;
+	staged = false;
 	// If the minutes value changes, update the display
-	if(dt.mm != previous_minutes) {
-	    if(dt.hh>12) dt.hh-=12; // convert 24hr display to 12hr
-		// if hours (dt.hh) is zero, the colon doesn't display.  Display 12 instead.
-		display.showNumberDecEx(dt.hh?dt.hh:12, colonMask, false, 2, 0);
-		display.showNumberDec(dt.mm, true, 2, 2);
-		previous_minutes = dt.mm;
+	ds3231_dt_to_bcd(&dt, &utc);
+	clock_local_bcd(&utc, &t);
+	if(ds3231_minute_changed(&t, &displayed)) {
+		clock_show(&t);
+		rollover_unsynced++;
 	}
 }
 
-// Give the display something to do
-int cl_tm1637_count(void)
+static void clock_time_done(I2C_REQUEST * req)
+{
+	time_ready = true; // processed by clock_task()
+	sched_post(SCHED_EV_I2C);
+}
+
+// Called for each DS3231 SQW falling edge (the DS3231 seconds value just incremented)
+// Commit the frame staged during second 59, then queue a read of the time registers.
+void clock_sqw_edge(uint64_t edge)
+{
+	if(staged) {
+		display.updateSegments(staged_frame); // usually just the minutes digit
+		uint32_t latency_us = (uint32_t)((sqw_now() - edge) / SQW_TICKS_PER_US);
+		displayed = staged_time;
+		staged = false;
+		rollover_count++;
+		rollover_last_us = latency_us;
+		if(latency_us > rollover_max_us) rollover_max_us = latency_us;
+		if(latency_us > ROLLOVER_LATE_US) rollover_late++;
+	}
+
+	// The edge came from the DS3231 - read it, not another backend that may be out of phase
+	if(time_req.state == I2C_REQ_QUEUED || time_req.state == I2C_REQ_ACTIVE) return;
+	time_req.dev = DS3231_ADDRESS;
+	time_req.op = I2C_OP_MEM_READ;
+	time_req.reg = 0x00;
+	time_req.len = sizeof(time_regs);
+	time_req.data = (uint8_t *)&time_regs;
+	time_req.priority = I2C_PRIO_TIME;
+	time_req.deadline = HAL_GetTick() + 500; // stale after half a second
+	time_req.done = clock_time_done;
+	i2c_submit(&time_req);
+}
+
+// Superloop task - once the time registers arrive, check the minute and stage the next frame
+// if this is second 59.
+void clock_task(void)
 {
-	printf("Counting 100ms increments on the TM1637 display.\nPress any key to stop\n");
-	uint32_t previous_ticks = 0;
-	uint32_t current_ticks;
-	for(unsigned i=0;;) {
-	    // If delta time is greater or equal to 100ms, update count
-	    current_ticks = HAL_GetTick();
-	    if(current_ticks - previous_ticks >= 100 ) {
-		    display.showNumberDec(i%10000, false, 4, 0); // use modulus operator to force values to 0 - 9999
-		    previous_ticks = current_ticks; // for next 200ms
-		    i++; // for next pass
-	    }
-	    if(__io_getchar() != EOF) break; // Pressing any key will exit for-loop
+	if(!time_ready) return;
+	time_ready = false;
+	if(HAL_OK != time_req.status) return;
+
+	// The DS3231 keeps UTC, convert to local time
+	DS3231_TIME_BCD local;
+	clock_local_bcd(&time_regs, &local);
+	if(ds3231_minute_changed(&local, &displayed)) {
+		// Time was set, or we just started - nothing was staged for this minute
+		clock_show(&local);
+		rollover_unsynced++;
 	}
+	if(ds3231_last_second(&time_regs)) {
+		// Next edge is the minute roll-over - stage hh:mm+1
+		uint32_t utc = minute_utc + 59;
+		if(tz_offset(utc + 1) == tz_offset(utc)) {
+			staged_time = local;
+			ds3231_bcd_next_minute(&staged_time);
+		} else {
+			clock_local(utc + 1, &staged_time); // DST starts or ends at this roll-over
+		}
+		clock_frame(&staged_time, staged_frame);
+		staged = true;
+	}
+}
+
+// Set the display brightness, level 0 (dimmest) - 7, on: 0 blanks the display
+// Takes effect when clock_task() redraws the time, within a second
+void clock_set_brightness(uint8_t level, uint8_t on)
+{
+	brightness = (level & 0x07) | (on ? 0x08 : 0x00);
+	display.setBrightness(level, on);
+	displayed.mm = 0xFF; // force a redraw
+}
+
+// Return the display brightness, bits 2:0 level, bit 3 on
+uint8_t clock_brightness(void)
+{
+	return brightness;
+}
+
+// Display minute roll-over statistics
+int cl_clock(void)
+{
+	printf("SQW:            %s\n", sqw_active() ? "active" : "not detected (polling)");
+	printf("Edge commits:   %lu\n", rollover_count);
+	printf("Latency last:   %lu us\n", rollover_last_us);
+	printf("Latency max:    %lu us\n", rollover_max_us);
+	printf("Late (>%uus): %lu\n", ROLLOVER_LATE_US, rollover_late);
+	printf("Unsynced:       %lu\n", rollover_unsynced);
 	return 0;
 }
 
+// Give the display something to do - count 100ms increments, as a background task so the
+// clock keeps time.  At each minute roll-over the clock shows the new time for
+// COUNT_CLOCK_MS before counting resumes.
+#define COUNT_CLOCK_MS 2000
+
+static TASK_STATUS count_run(TASK * t);
+static void count_stop(TASK * t);
+static TASK count_task = {"count", count_run, count_stop};
+static unsigned count_value;
+static uint8_t count_mm; // displayed.mm when counting (re)started
+
+static TASK_STATUS count_run(TASK * t)
+{
+	TASK_BEGIN(t);
+	count_value = 0;
+	count_mm = displayed.mm;
+	for(;;) {
+		TASK_SLEEP(t, 100);
+		if(displayed.mm != count_mm) {
+			// The clock just wrote a new minute, leave it on the display for a while
+			TASK_SLEEP(t, COUNT_CLOCK_MS);
+			count_mm = displayed.mm;
+		}
+		display.showNumberDec(count_value % 10000, false, 4, 0); // use modulus operator to force values to 0 - 9999
+		count_value++;
+	}
+	TASK_END(t);
+}
+
+static void count_stop(TASK * t)
+{
+	displayed.mm = 0xFF; // restore the clock display
+}
+
+int cl_tm1637_count(void)
+{
+	printf("Counting 100ms increments on the TM1637 display.\n\"kill\" the job to stop\n");
+	task_start(&count_task);
+	return 0;
+}
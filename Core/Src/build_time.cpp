@@ -0,0 +1,15 @@
+// build_time.cpp, firmware build time parsed at compile time
+//
+// rtc_build_time() is constexpr, so fw_build is a constant in flash next to fw_version.
+// No __DATE__ / __TIME__ parsing code runs at boot.
+// Note: __DATE__ / __TIME__ are the time this file was compiled.  A clean build updates them.
+
+#include "version.h"
+#include "RTClib_constexpr.h"
+
+static constexpr DATE_TIME build_dt = rtc_build_time(__DATE__, __TIME__);
+
+extern "C" const BUILD_TIME fw_build = {build_dt, rtc_unix(build_dt)};
+
+static_assert(rtc_unix(rtc_build_time("Jan  1 2000", "00:00:00")) == SECONDS_FROM_1970_TO_2000, "rtc_unix");
+static_assert(rtc_unix(rtc_build_time("Oct 29 2024", "18:11:40")) == 1730225500UL, "rtc_build_time");
@@ -0,0 +1,100 @@
+// cal_estimator.c, frequency error estimator for the DS3231 aging offset calibration
+//
+// Each 1Hz SQW edge is timestamped with a free-running reference counter (TIM2, 72MHz).
+// Over a window of N seconds the reference should advance N * ref_hz ticks.  If fewer ticks
+// elapse, the DS3231's seconds are short, and the DS3231 is running fast.
+//
+//   error (ppb) = (N * ref_hz - elapsed) * 10^9 / elapsed
+//
+// Over a one hour window, a single 72MHz tick is worth 0.004ppb, so the estimate is limited
+// by the accuracy of the reference (HSE) and not by capture resolution.
+//
+// A missing SQW edge is accounted for by rounding the interval to whole seconds.
+// A glitch (edge much closer than a second) is dropped, keeping the previous edge as reference.
+
+#include "cal_estimator.h"
+
+// Initialize the estimator, no estimate available yet
+void cal_est_init(CAL_ESTIMATOR * est, uint32_t ref_hz, uint32_t window_s)
+{
+	est->ref_hz = ref_hz;
+	est->window_s = window_s ? window_s : 1;
+	est->rejected = 0;
+	est->estimates = 0;
+	est->ppb = 0;
+	cal_est_restart(est);
+}
+
+// Discard the current window, the next edge begins a new window
+// The last completed estimate is retained
+void cal_est_restart(CAL_ESTIMATOR * est)
+{
+	est->first_ts = 0;
+	est->last_ts = 0;
+	est->seconds = 0;
+	est->started = 0;
+}
+
+// Feed the timestamp of an SQW edge into the estimator
+// Return 1 if this edge completed a window (est->ppb updated), else 0
+int cal_est_edge(CAL_ESTIMATOR * est, uint64_t ts)
+{
+	if(!est->started) {
+		est->first_ts = ts;
+		est->last_ts = ts;
+		est->seconds = 0;
+		est->started = 1;
+		return 0;
+	}
+
+	uint64_t delta = ts - est->last_ts;
+	// Round the interval to whole seconds (accounts for missed edges)
+	uint64_t secs = (delta + est->ref_hz / 2) / est->ref_hz;
+	if(0 == secs) {
+		est->rejected++; // glitch - ignore this edge
+		return 0;
+	}
+	uint64_t expected = secs * est->ref_hz;
+	uint64_t tolerance = expected / (1000000 / CAL_EST_TOLERANCE_PPM);
+	uint64_t error = delta > expected ? delta - expected : expected - delta;
+	if(error > tolerance) {
+		// Not a believable 1Hz interval - start over from this edge
+		est->rejected++;
+		est->first_ts = ts;
+		est->last_ts = ts;
+		est->seconds = 0;
+		return 0;
+	}
+
+	est->last_ts = ts;
+	est->seconds += (uint32_t)secs;
+	if(est->seconds < est->window_s) return 0;
+
+	// Window complete, compute the frequency error
+	uint64_t elapsed = est->last_ts - est->first_ts;
+	int64_t diff = (int64_t)((uint64_t)est->seconds * est->ref_hz) - (int64_t)elapsed;
+	est->ppb = (int32_t)((diff * 1000000000LL) / (int64_t)elapsed);
+	est->estimates++;
+
+	// Next window begins at this edge
+	est->first_ts = ts;
+	est->seconds = 0;
+	return 1;
+}
+
+// Return the aging offset to use after an estimate of ppb at aging offset aging.
+// Outside of the deadband, move the aging offset toward zero error: a fast DS3231 (ppb > 0)
+// requires a larger aging offset.  At most CAL_MAX_STEP per estimate, within the register range.
+int8_t cal_est_aging(int8_t aging, int32_t ppb)
+{
+	int32_t step = 0;
+	if(ppb > CAL_DEADBAND_PPB || ppb < -CAL_DEADBAND_PPB) {
+		step = (ppb + (ppb > 0 ? CAL_PPB_PER_LSB / 2 : -CAL_PPB_PER_LSB / 2)) / CAL_PPB_PER_LSB;
+		if(step > CAL_MAX_STEP) step = CAL_MAX_STEP;
+		if(step < -CAL_MAX_STEP) step = -CAL_MAX_STEP;
+	}
+	int32_t next = aging + step;
+	if(next > 127) next = 127;
+	if(next < -128) next = -128;
+	return (int8_t)next;
+}
@@ -7,9 +7,13 @@
 #include <stdio.h>
 #include <stdint.h> // uint8_t
 #include <stdlib.h> // strtol()
+#include <string.h> // strcmp()
 #include "main.h"   // HAL functions and defines - HAL_I2C_MODULE_ENABLED in stm32f1xx_hal_conf.h
 #include "cl_i2c.h"
+#include "i2c_queue.h"
+#include "i2c_probe.h"
 #include "DS3231.h"
+#include "trace.h"
 
 // I2C helper function that validates I2C address is within range
 // If I2C address is within range, return 0, else display error and return -1.
@@ -24,55 +28,146 @@ int cl_i2c_validate_address(uint16_t i2c_address)
 
 extern I2C_HandleTypeDef hi2c1; // using I2C1 - global instance
 
+// Bus traffic counters for i2c_write_read(), used to compare I2C optimizations
+I2C_STATS i2c_stats;
+
+// Fault injection: the next fault_count transactions fail with fault_status (no bus activity)
+static uint16_t fault_count;
+static HAL_StatusTypeDef fault_status = HAL_ERROR;
+
 // Implement a "generic I2C API" for writing to and then reading from an I2C device (in that order)
 // Model this to be similar to HAL I2C APIs
 HAL_StatusTypeDef i2c_write_read(uint16_t DevAddress, uint8_t * write_data, uint16_t write_count, uint8_t * read_data, uint16_t read_count)
+{
+	return i2c_write_read_prio(I2C_PRIO_NORMAL, DevAddress, write_data, write_count, read_data, read_count);
+}
+
+// A single write byte followed by a read is a register read (repeated start, one transaction).
+// A write of two or more bytes is a register write: write_data[0] is the register index.
+static HAL_StatusTypeDef i2c_queue_write_read(uint8_t priority, uint16_t DevAddress, uint8_t * write_data, uint16_t write_count, uint8_t * read_data, uint16_t read_count)
 {
 	HAL_StatusTypeDef rc = HAL_OK;
+	if(fault_count) {
+		fault_count--;
+		i2c_stats.injected++;
+		i2c_stats.errors++;
+		return fault_status;
+	}
+	I2C_REQUEST req = {0};
+	req.dev = (uint8_t)DevAddress;
+	req.priority = priority;
+
+	if(write_data && 1 == write_count && read_data && read_count) {
+		req.op = I2C_OP_MEM_READ;
+		req.reg = write_data[0];
+		req.data = read_data;
+		req.len = read_count;
+		rc = i2c_transfer(&req);
+		if(HAL_OK != rc) printf("i2c_write_read() Error: %d\r\n",rc);
+		return rc;
+	}
+
 	// If write_data and wrire_count are non-null, perform write first
 	if(write_data && write_count) {
-		rc = HAL_I2C_Master_Transmit(&hi2c1, DevAddress << 1, write_data, write_count, HAL_I2C_SMALL_TIMEOUT);
-		if(HAL_OK != rc) printf("HAL_I2C_Master_Transmit() Error: %d\r\n",rc);
+		if(write_count > 1) {
+			req.op = I2C_OP_MEM_WRITE;
+			req.reg = write_data[0];
+			req.data = write_data + 1;
+			req.len = write_count - 1;
+		} else {
+			req.op = I2C_OP_WRITE;
+			req.data = write_data;
+			req.len = write_count;
+		}
+		rc = i2c_transfer(&req);
+		if(HAL_OK != rc) printf("I2C write Error: %d\r\n",rc);
 	}
 
 	if(HAL_OK == rc && read_data && read_count) {
-		rc = HAL_I2C_Master_Receive(&hi2c1, DevAddress << 1, read_data, read_count, HAL_I2C_SMALL_TIMEOUT);
-		if(HAL_OK != rc) printf("HAL_I2C_Master_Receive() Error: %d\r\n",rc);
+		req.op = I2C_OP_READ;
+		req.data = read_data;
+		req.len = read_count;
+		rc = i2c_transfer(&req);
+		if(HAL_OK != rc) printf("I2C read Error: %d\r\n",rc);
 	}
 
 	return rc;
 }
 
-// Perform an I2C bus scan similar to Linux's i2cdetect, or Arduino's i2c_scanner sketch
+// As i2c_write_read(), queued at the given priority (I2C_PRIO_xxx)
+HAL_StatusTypeDef i2c_write_read_prio(uint8_t priority, uint16_t DevAddress, uint8_t * write_data, uint16_t write_count, uint8_t * read_data, uint16_t read_count)
+{
+	TRACE_ENTER(I2C);
+	HAL_StatusTypeDef rc = i2c_queue_write_read(priority, DevAddress, write_data, write_count, read_data, read_count);
+	TRACE_EXIT(I2C);
+	return rc;
+}
+
+// Display / reset the i2c_write_read() traffic counters
+// i2cstat        : display counters
+// i2cstat reset  : clear counters
+int cl_i2c_stat(void)
+{
+	if(argc > 1 && strcmp(argv[1], "reset") == 0) {
+		i2c_stats = (I2C_STATS){0};
+		i2c_queue_stats = (I2C_QUEUE_STATS){0};
+	}
+	printf("Transactions: %lu\n", i2c_stats.transactions);
+	printf("Bus bytes:    %lu\n", i2c_stats.bytes);
+	printf("Errors:       %lu (%lu injected)\n", i2c_stats.errors, i2c_stats.injected);
+	printf("Requests:     %lu, %lu merged, %lu expired\n", i2c_queue_stats.requests, i2c_queue_stats.merged, i2c_queue_stats.expired);
+	printf("Queue depth:  %u max, %lu aborts\n", i2c_queue_stats.depth_max, i2c_queue_stats.aborts);
+	return 0;
+}
+
+// Make the next <count> i2c_write_read() calls fail, without touching the bus
+// i2cfault <count> <nack | timeout>
+int cl_i2c_fault(void)
+{
+	fault_count = (uint16_t)strtol(argv[1], NULL, 0);
+	fault_status = HAL_ERROR; // HAL reports a NACK as HAL_ERROR (HAL_I2C_ERROR_AF)
+	if(argc > 2 && strcmp(argv[2], "timeout") == 0) fault_status = HAL_TIMEOUT;
+	printf("Next %u transactions fail with %s\n", fault_count, PrintHalStatus(fault_status));
+	return 0;
+}
+
+// Display the I2C bus inventory similar to Linux's i2cdetect, or Arduino's i2c_scanner sketch
+// i2cscan        : display the inventory cached at boot / by the last scan
+// i2cscan full   : scan all addresses 0x03 - 0x77
+// i2cscan quick  : re-probe the expected addresses only
 int cl_i2c_scan(void)
 {
-    printf("I2C Scan - scanning I2C addresses 0x%02X - 0x%02X\n",I2C_ADDRESS_MIN,I2C_ADDRESS_MAX);
+    if(argc > 1 && strcmp(argv[1], "full") == 0) i2c_probe_scan();
+    else if(argc > 1 && strcmp(argv[1], "quick") == 0) i2c_probe_rescan();
+
+    printf("I2C Scan - addresses 0x%02X - 0x%02X\n",I2C_ADDRESS_MIN,I2C_ADDRESS_MAX);
     // Display Hex Header
     printf("    "); for(int i=0;i<=0x0F;i++) printf(" %0X ",i);
-    // Walk through address range 0x00 - 0x77, but only test 0x03 - 0x77
+    // Walk through address range 0x00 - 0x77, but only display 0x03 - 0x77
     for(uint16_t addr=0;addr<=I2C_ADDRESS_MAX;addr++) {
     	// If address defines the beginning of a row, start a new row and display row text
     	if(!(addr%16)) printf("\n%02X: ",addr);
-		// Check I2C addresses in the range 0x03-0x7F
 		if(addr < I2C_ADDRESS_MIN || addr > I2C_ADDRESS_MAX) {
 			printf("   "); // out of range
 			continue;
 		}
-		// Perform I2C device detection - returns HAL_OK if device found
-		if(HAL_OK == HAL_I2C_IsDeviceReady(&hi2c1, (addr<<1), 1, 2))
+		if(i2c_probe_present(addr))
 			printf("%02X ",addr);
 		else
 			printf("-- ");
     } // for-loop
     printf("\n");
+    printf("%u addresses probed in %lu us, %lu ms ago, %u changed, %u bus errors\n",
+    		i2c_inventory.probed, i2c_inventory.scan_us, HAL_GetTick() - i2c_inventory.ticks,
+			i2c_inventory.changes, i2c_inventory.bus_errors);
     return 0;
-} // cl_i2c_scanner
+} // cl_i2c_scan
 
 // Test routine to generate SCL/SDL waveforms for capture - I2C address followed by byte write
 int cl_i2c_write(void)
 {
 	uint8_t index = 0;
-	HAL_I2C_Master_Transmit(&hi2c1, DS3231_ADDRESS << 1, &index, sizeof(index), HAL_I2C_SMALL_TIMEOUT);
+	i2c_write_read_prio(I2C_PRIO_DIAG, DS3231_ADDRESS, &index, sizeof(index), NULL, 0);
     return 0;
 }
 
@@ -80,7 +175,7 @@ int cl_i2c_write(void)
 int cl_i2c_read(void)
 {
 	uint8_t data = 0xFF;
-	HAL_I2C_Master_Receive(&hi2c1, DS3231_ADDRESS << 1, &data, sizeof(data), HAL_I2C_SMALL_TIMEOUT);
+	i2c_write_read_prio(I2C_PRIO_DIAG, DS3231_ADDRESS, NULL, 0, &data, sizeof(data));
     return 0;
 }
 
@@ -0,0 +1,215 @@
+// File: cl_rtclib.c
+//
+// RTClib self test and benchmark for the command line interface
+//
+// unix2rtc() / rtc2unix() use closed form day <-> civil date conversions.  The loop based
+// Adafruit versions they replaced are kept here as the reference.  "rtctest" is a spot check
+// that runs in a fraction of a second: every RTCTEST_STRIDE th day from 2000 through 2099, and
+// the last day of each February and December, at several times of day.  It checks for
+// identical results and round-trips, that rtcAddSeconds() carries into the next day, month and
+// year, dayOfTheWeek() and rtc2seconds(), then reports the DWT cycle count of each conversion
+// at the start, middle and end of the range.
+//
+// It also checks buildTime() for every month/day string in the __DATE__ format, and reports
+// the average time per call of each RTClib function so optimizations can be measured.
+// Tools/rtclib_test.c checks every second of the range on the host, too long for the target.
+
+#include <stdio.h>
+#include <string.h> // memcmp()
+#include "main.h"
+#include "dwt.h"
+#include "RTClib.h"
+#include "cl_rtclib.h"
+
+#define RTCTEST_DAYS 36525 // 2000-01-01 through 2099-12-31
+#define RTCTEST_STRIDE 97  // days between spot checks, prime: walks through the days of the month and week
+#define RTCTEST_CALLS 1000 // calls per function for the timing average
+
+// Unix time of second s of day (from 2000-01-01).  Unsigned: the end of the range is past 2^31.
+#define RTCTEST_TIME(day, s) (SECONDS_FROM_1970_TO_2000 + (uint32_t)(day) * (uint32_t)SECONDS_PER_DAY + (uint32_t)(s))
+
+static uint32_t errors;
+
+// Report a failed check, only the first few are displayed
+static void rtctest_fail(const char * what, const DATE_TIME * dt, const DATE_TIME * ref)
+{
+	if(errors++ < 5)
+		printf("%s: %02u-%02u-%02u %02u:%02u:%02u expected %02u-%02u-%02u %02u:%02u:%02u\n", what,
+				dt->yOff, dt->m, dt->d, dt->hh, dt->mm, dt->ss, ref->yOff, ref->m, ref->d, ref->hh, ref->mm, ref->ss);
+}
+
+// Reference: original RTClib date2days(), loops over the months
+static uint16_t ref_date2days(uint16_t y, uint8_t m, uint8_t d)
+{
+	static const uint8_t days_in_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	if (y >= 2000U) y -= 2000U;
+	uint16_t days = d;
+	for (uint8_t i = 1; i < m; ++i)
+		days += days_in_month[i - 1];
+	if (m > 2 && y % 4 == 0) ++days;
+	return days + 365 * y + (y + 3) / 4 - 1;
+}
+
+// Reference: original RTClib unix2rtc(), loops once per year and once per month
+static void ref_unix2rtc(DATE_TIME * dt, uint32_t t)
+{
+	static const uint8_t days_in_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	t -= SECONDS_FROM_1970_TO_2000;
+	dt->ss = t % 60;
+	t /= 60;
+	dt->mm = t % 60;
+	t /= 60;
+	dt->hh = t % 24;
+	uint16_t days = t / 24;
+	uint8_t leap;
+	for (dt->yOff = 0;; ++dt->yOff) {
+		leap = dt->yOff % 4 == 0;
+		if (days < 365U + leap) break;
+		days -= 365 + leap;
+	}
+	for (dt->m = 1; dt->m < 12; ++dt->m) {
+		uint8_t daysPerMonth = days_in_month[dt->m - 1];
+		if (leap && dt->m == 2) ++daysPerMonth;
+		if (days < daysPerMonth) break;
+		days -= daysPerMonth;
+	}
+	dt->d = days + 1;
+}
+
+static uint32_t ref_rtc2unix(DATE_TIME * dt)
+{
+	uint16_t days = ref_date2days(dt->yOff, dt->m, dt->d);
+	return ((days * 24UL + dt->hh) * 60 + dt->mm) * 60 + dt->ss + SECONDS_FROM_1970_TO_2000;
+}
+
+// Display cycles for one call of each conversion, at unix time t
+static void rtctest_bench(uint32_t t)
+{
+	DATE_TIME dt;
+	uint32_t start, cyc_new, cyc_ref, cyc_new2, cyc_ref2, cyc_tick;
+	volatile uint32_t sink;
+
+	start = dwt_cycles(); unix2rtc(&dt, t);           cyc_new = dwt_cycles() - start;
+	start = dwt_cycles(); ref_unix2rtc(&dt, t);       cyc_ref = dwt_cycles() - start;
+	start = dwt_cycles(); sink = rtc2unix(&dt);       cyc_new2 = dwt_cycles() - start;
+	start = dwt_cycles(); sink = ref_rtc2unix(&dt);   cyc_ref2 = dwt_cycles() - start;
+	(void)sink;
+	DATE_TIME tick = dt;
+	start = dwt_cycles(); rtcAddSeconds(&tick, 1);    cyc_tick = dwt_cycles() - start;
+	printf("%04u-%02u-%02u  %-8lu %-8lu %-8lu %-8lu %lu\n", 2000 + dt.yOff, dt.m, dt.d,
+			cyc_new, cyc_ref, cyc_new2, cyc_ref2, cyc_tick);
+}
+
+// Reference day of week, 0: Sunday (Sakamoto's method)
+static uint8_t ref_weekday(uint16_t y, uint8_t m, uint8_t d)
+{
+	static const uint8_t t[] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+	if(m < 3) y--;
+	return (y + y / 4 - y / 100 + y / 400 + t[m - 1] + d) % 7;
+}
+
+// Check one day (from 2000-01-01) at several times of day, return the number of checks
+static uint32_t rtctest_day(uint32_t day)
+{
+	static const uint32_t time_of_day[] = {0, 1, 12 * 3600UL + 34 * 60 + 56, SECONDS_PER_DAY - 1};
+	uint32_t checked = 0;
+	DATE_TIME dt, ref;
+	for(unsigned i = 0; i < sizeof(time_of_day) / sizeof(time_of_day[0]); i++) {
+		uint32_t t = RTCTEST_TIME(day, time_of_day[i]);
+		unix2rtc(&dt, t);
+		ref_unix2rtc(&ref, t);
+		checked++;
+		if(memcmp(&dt, &ref, sizeof(dt)) != 0 || rtc2unix(&dt) != t || rtc2unix(&dt) != ref_rtc2unix(&ref))
+			rtctest_fail("unix2rtc", &dt, &ref);
+		// Incremental arithmetic must agree with a conversion of t + delta
+		rtcAddSeconds(&dt, 1);
+		ref_unix2rtc(&ref, t + 1);
+		checked++;
+		if(memcmp(&dt, &ref, sizeof(dt)) != 0)
+			rtctest_fail("rtcAddSeconds", &dt, &ref);
+	}
+	ref_unix2rtc(&dt, RTCTEST_TIME(day, 0));
+	ref = dt;
+	checked += 2;
+	if(dayOfTheWeek(&dt) != ref_weekday(2000 + dt.yOff, dt.m, dt.d))
+		rtctest_fail("dayOfTheWeek", &dt, &ref);
+	if(rtc2seconds(&dt) != RTCTEST_TIME(day, 0) - SECONDS_FROM_1970_TO_2000)
+		rtctest_fail("rtc2seconds", &dt, &ref);
+	return checked;
+}
+
+// Check buildTime() for every month and day, in the __DATE__ "Mmm dd yyyy" format
+static uint32_t rtctest_build_time(void)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	uint32_t checked = 0;
+	for(uint8_t m = 1; m <= 12; m++) {
+		for(uint8_t d = 1; d <= 31; d++) {
+			char date[12], time[9];
+			DATE_TIME dt, ref = {(uint8_t)(d + m), m, d, (uint8_t)(m + 11), (uint8_t)(d + 28), (uint8_t)(d * m % 60)};
+			sprintf(date, "%.3s %2u %04u", &months[(m - 1) * 3], d, 2000 + ref.yOff); // day is space padded
+			sprintf(time, "%02u:%02u:%02u", ref.hh, ref.mm, ref.ss);
+			buildTime(&dt, date, time);
+			checked++;
+			if(memcmp(&dt, &ref, sizeof(dt)) != 0)
+				rtctest_fail("buildTime", &dt, &ref);
+		}
+	}
+	return checked;
+}
+
+// Display the average time per call of each RTClib function over dates across the range
+static void rtctest_timing(void)
+{
+	static DATE_TIME dts[16];
+	uint32_t cycles[6] = {0};
+	static const char * const names[] = {"unix2rtc", "rtc2unix", "rtc2seconds", "dayOfTheWeek", "rtcAddSeconds", "buildTime"};
+	volatile uint32_t sink = 0;
+
+	for(uint32_t i = 0; i < RTCTEST_CALLS; i++) {
+		uint32_t t = RTCTEST_TIME(i * (RTCTEST_DAYS / RTCTEST_CALLS), i * 37);
+		DATE_TIME * dt = &dts[i & 15];
+		uint32_t start;
+		start = dwt_cycles(); unix2rtc(dt, t);                         cycles[0] += dwt_cycles() - start;
+		start = dwt_cycles(); sink += rtc2unix(dt);                    cycles[1] += dwt_cycles() - start;
+		start = dwt_cycles(); sink += rtc2seconds(dt);                 cycles[2] += dwt_cycles() - start;
+		start = dwt_cycles(); sink += dayOfTheWeek(dt);                cycles[3] += dwt_cycles() - start;
+		start = dwt_cycles(); rtcAddSeconds(dt, 1);                    cycles[4] += dwt_cycles() - start;
+		start = dwt_cycles(); buildTime(dt, "Oct 29 2024", "13:51:40"); cycles[5] += dwt_cycles() - start;
+	}
+	(void)sink;
+	uint32_t mhz = SystemCoreClock / 1000000;
+	printf("Function       Cycles   ns (average of %u calls)\n", RTCTEST_CALLS);
+	for(unsigned i = 0; i < sizeof(cycles) / sizeof(cycles[0]); i++) {
+		uint32_t avg = cycles[i] / RTCTEST_CALLS;
+		printf("%-14s %-8lu %lu\n", names[i], avg, avg * 1000 / mhz);
+	}
+}
+
+// Command line method: test and benchmark the RTClib conversions
+int cl_rtctest(void)
+{
+	uint32_t checked = 0;
+	uint32_t days = 0;
+	errors = 0;
+
+	for(uint32_t day = 0; day < RTCTEST_DAYS; day += RTCTEST_STRIDE, days++)
+		checked += rtctest_day(day);
+	// Month and year ends: the last second carries into March / the next year
+	for(uint8_t y = 0; y < 100; y++, days += 2) {
+		checked += rtctest_day(ref_date2days(y, 2, y % 4 ? 28 : 29));
+		checked += rtctest_day(ref_date2days(y, 12, 31));
+	}
+	printf("Checked %lu days, every %u and the ends of February and December\n", days, RTCTEST_STRIDE);
+	checked += rtctest_build_time();
+	printf("%lu checks, %lu errors\n", checked, errors);
+
+	dwt_init();
+	rtctest_timing();
+	printf("Cycles per call, closed form vs loops:\n");
+	printf("Date        unix2rtc ref      rtc2unix ref      +1 second\n");
+	rtctest_bench(RTCTEST_TIME(0, 0));
+	rtctest_bench(RTCTEST_TIME(RTCTEST_DAYS / 2, 43200));
+	rtctest_bench(RTCTEST_TIME(RTCTEST_DAYS, 0) - 1);
+	return 0;
+}
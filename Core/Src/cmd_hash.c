@@ -0,0 +1,48 @@
+// cmd_hash.c, command name lookup - open addressing hash of a command table
+//
+// Shared by the firmware and the host benchmark, see cmd_hash.h.
+
+#include <string.h> // strcmp(), memset()
+#include "cmd_hash.h"
+
+#define CMD_NAME(table, stride, i) (*(const char * const *)((const char *)(table) + (size_t)(i) * (stride)))
+
+// FNV-1a hash of a command name
+uint32_t cmd_hash_name(const char * s)
+{
+	uint32_t h = 2166136261UL;
+	while(*s) {
+		h ^= (uint8_t)*s++;
+		h *= 16777619UL;
+	}
+	return h;
+}
+
+// Fill in slots[size] (size a power of 2) from the table.
+// Return the number of entries, -1 if they would fill more than half the slots.
+int cmd_hash_build(CMD_HASH_SLOT * slots, unsigned size, const void * table, size_t stride)
+{
+	unsigned count = 0;
+	while(CMD_NAME(table, stride, count)) count++;
+	if(count > size / 2) return -1;
+	memset(slots, 0, size * sizeof(slots[0]));
+	for(unsigned i = 0; i < count; i++) {
+		uint32_t slot = cmd_hash_name(CMD_NAME(table, stride, i));
+		while(slots[slot & (size - 1)]) slot++; // linear probing
+		slots[slot & (size - 1)] = (CMD_HASH_SLOT)(i + 1);
+	}
+	return (int)count;
+}
+
+// Return the table index of a name, -1 if not found
+int cmd_hash_find(const CMD_HASH_SLOT * slots, unsigned size, const void * table, size_t stride,
+		const char * name)
+{
+	uint32_t slot = cmd_hash_name(name);
+	CMD_HASH_SLOT index;
+	while((index = slots[slot & (size - 1)]) != 0) {
+		if(strcmp(name, CMD_NAME(table, stride, index - 1)) == 0) return index - 1;
+		slot++;
+	}
+	return -1;
+}
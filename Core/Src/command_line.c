@@ -20,7 +20,24 @@
 #include "main.h"   // HAL functions and defines
 #include "cl_i2c.h"
 #include "DS3231.h"
+#include "DS3231_cal.h"
+#include "rtc_backend.h"
+#include "cl_rtclib.h"
+#include "timezone.h"
 #include "version.h"
+#include "dwt.h"
+#include "uart_tx.h"
+#include "uart_rx.h"
+#include "fmt.h"
+#include "proto.h"
+#include "task.h"
+#include "sched.h"
+#include "power.h"
+#include "trace.h"
+#include "timebase.h"
+#include "delay.h"
+#include "mem.h"
+#include "cmd_hash.h"
 
 
 // Typedefs
@@ -33,6 +50,7 @@ typedef struct {
 
 // function prototype
 int cl_tm1637_count(void);
+int cl_clock(void);
 
 const COMMAND_ITEM cmd_table[] = {
     {"?",         "display help menu",                            1, cl_help},
@@ -42,21 +60,59 @@ const COMMAND_ITEM cmd_table[] = {
     {"info",      "processor info",                               1, cl_info},
     {"reset",     "reset processor",                              1, cl_reset},
 	{"version",   "display version",                              1, cl_version},
-    {"timer",     "timer test - testing 50ms delay",              1, cl_timer},
-	{"delaytest", "test microsecond delays",                      1, cl_timer_delay_test},
-	{"i2cscan",   "scan i2c bus for connected devices",           1, cl_i2c_scan},
+    {"timer",     "timer <ms> - time HAL_Delay(), 50ms default",  1, cl_timer},
+	{"delaytest", "delay accuracy, spin vs WFI vs cycle loop",    1, cl_timer_delay_test},
+	{"i2cscan",   "i2cscan <full | quick> - i2c bus inventory",   1, cl_i2c_scan},
 	{"i2cwrite",  "test - write 0 to DS3231",                     1, cl_i2c_write},
 	{"i2cread",   "test - read byte from DS3231",                 1, cl_i2c_read},
+	{"i2cstat",   "i2cstat <reset> - I2C bus traffic counters",   1, cl_i2c_stat},
+	{"i2cfault",  "i2cfault <count> <nack | timeout>",            2, cl_i2c_fault},
 	{"time",      "time <hh mm ss> to set, no params to read",    1, cl_time},
 	{"date",      "date <day month year>",                        1, cl_date},
     {"dump",      "dump the DS3231 register data",                1, cl_ds3231_dump},
     {"sqw",       "sqw <0: 1Hz, 1: 1024Hz, 2: 4096Hz, 3: 8192Hz>",1, cl_sqw_test},
 	{"count",     "tm1637 test",                                  1, cl_tm1637_count},
+	{"clock",     "minute roll-over latency statistics",          1, cl_clock},
+	{"rtc",       "rtc <sync> - RTC backend status",              1, cl_rtc},
+	{"tz",        "UTC, local time and next DST change",          1, cl_tz},
+	{"rtctest",   "RTClib conversion self test and benchmark",    1, cl_rtctest},
+	{"tx",        "tx <block | drop | count | reset> - UART TX",  1, cl_tx},
+	{"rx",        "rx <reset> - UART RX ring statistics",         1, cl_rx},
+	{"cmdbench",  "command lookup cost, hashed vs linear",        1, cl_cmdbench},
+	{"perf",      "perf <reset> - per-command execution profile", 1, cl_perf},
+	{"fmtbench",  "time output cost, printf() vs fmt",            1, cl_fmtbench},
+	{"proto",     "proto <test> - binary protocol status",        1, cl_proto},
 	{"alarm",     "set alarm for 5 seconds, watch A1F flag",      1, cl_alarm},
+	{"cal",       "cal <on | off | reset | window minutes>",      1, cl_cal},
+	{"jobs",      "list background jobs",                         1, cl_jobs},
+	{"sched",     "sched <reset> - idle time and event latency",  1, cl_sched},
+	{"power",     "power <on | off> - STOP mode between minutes", 1, cl_power},
+	{"trace",     "trace <on | off | clear | dump> - hot paths",  1, cl_trace},
+	{"mem",       "RAM arena, pool high-water marks, heap use",   1, cl_mem},
+	{"kill",      "kill <job | all> - stop a background job",     1, cl_kill},
 
     {NULL,NULL,0,NULL}, /* end of table */
 };
 
+// Command lookup: open addressing hash of the command names (cmd_hash.c), built by cl_setup().
+// cmd_table keeps its order for "help".
+#define CMD_COUNT     (sizeof(cmd_table) / sizeof(cmd_table[0]) - 1) // without the end of table entry
+#define CMD_HASH_SIZE 128 // power of 2, at least twice the number of commands
+_Static_assert(CMD_COUNT <= CMD_HASH_SIZE / 2, "cmd_table too large, increase CMD_HASH_SIZE");
+static CMD_HASH_SLOT cmd_hash[CMD_HASH_SIZE];
+
+// Per-command execution profile, indexed like cmd_table, filled in by cl_process_buffer()
+// Cycles are DWT cycles from the call to the return.  Output of background jobs started by a
+// command is not included.
+typedef struct {
+    uint32_t calls;
+    uint64_t cycles;     // total
+    uint32_t cycles_min;
+    uint32_t cycles_max;
+    uint32_t bytes;      // bytes printed (queued or dropped by uart_tx)
+} CMD_PERF;
+static CMD_PERF cmd_perf[CMD_COUNT];
+
 // Globals:
 char cmd_buffer[MAXSERIALBUF]; // holds command strings from user
 char * argv[MAXWORDS]; // pointers into buffer
@@ -66,7 +122,16 @@ int argc; // number of words (command & arguments)
 const VERSION_MAJOR_MINOR fw_version = {VERSION_MAJOR,VERSION_MINOR,VERSION_BUILD};
 char szversion[16];
 
+// Return the command table entry for a command name, NULL if not found
+static const COMMAND_ITEM * cl_find_command(const char * name)
+{
+    int index = cmd_hash_find(cmd_hash, CMD_HASH_SIZE, cmd_table, sizeof(cmd_table[0]), name);
+    return index < 0 ? NULL : &cmd_table[index];
+}
+
 void cl_setup(void) {
+    cmd_hash_build(cmd_hash, CMD_HASH_SIZE, cmd_table, sizeof(cmd_table[0]));
+    dwt_init(); // command profiling
     // The STM32 development environment's stdio library provides buffering of stdout stream by default.  Turn it off!
     setvbuf(stdout, NULL, _IONBF, 0);
     // Write version string
@@ -86,12 +151,31 @@ int __io_putchar(int ch); // main.c
 void cl_loop(void)
 {
     static int index = 0; // index into global buffer
+    static int syn_count = 0; // consecutive PROTO_SYN characters
     int c;
 
     // Spin, reading characters until EOF character is received (no data), buffer is full, or
     // a <line feed> character is received.  Null terminate the global string, don't return the <LF>
     while(1) {
       c = __io_getchar();
+      if(proto_active()) {
+          // Binary mode, bytes belong to protocol frames
+          if(EOF == c) {
+              proto_poll(); // idle timeout
+              return;
+          }
+          proto_rx((uint8_t)c);
+          continue;
+      }
+      if(PROTO_SYN == c) {
+          if(++syn_count == 2) {
+              syn_count = 0;
+              index = 0; // discard a partial command line
+              proto_enter();
+          }
+          continue;
+      }
+      syn_count = 0;
       switch(c) {
           case EOF:
               return; // non-blocking - return
@@ -123,6 +207,7 @@ void cl_loop(void)
 
 void cl_process_buffer(void)
 {
+    TRACE_ENTER(CMD);
     argc = cl_parseArgcArgv(cmd_buffer, argv, MAXWORDS);
     // Display each of the "words" / command and arguments
     //for(int i=0;i<argc;i++)
@@ -130,27 +215,27 @@ void cl_process_buffer(void)
     if (argc) {
         // At least one "word" / argument found
         // See if command has a match in the command table
-        // If null function pointer found, exit for-loop
-        int cmdIndex;
-        for (cmdIndex = 0; cmd_table[cmdIndex].function; cmdIndex++) {
-            if (strcmp(argv[0], cmd_table[cmdIndex].command) == 0) {
-                // We found a match in the table
-                // Enough arguments?
-                if (argc < cmd_table[cmdIndex].arg_cnt) {
-                    printf("\r\nInvalid Arg cnt: %d Expected: %d\n", argc - 1,
-                            cmd_table[cmdIndex].arg_cnt - 1);
-                    break;
-                }
-                // Call the function associated with the command
-                (*cmd_table[cmdIndex].function)();
-                break; // exit for-loop
-            }
-        } // for-loop
-          // If we compared all the command strings and didn't find the command, or we want to fake that event
-        if (!cmd_table[cmdIndex].command) {
+        const COMMAND_ITEM * cmd = cl_find_command(argv[0]);
+        if (!cmd) {
             printf("Command \"%s\" not found\r\n", argv[0]);
+        } else if (argc < cmd->arg_cnt) {
+            // Not enough arguments
+            printf("\r\nInvalid Arg cnt: %d Expected: %d\n", argc - 1, cmd->arg_cnt - 1);
+        } else {
+            // Call the function associated with the command, profile it
+            CMD_PERF * perf = &cmd_perf[cmd - cmd_table];
+            uint32_t bytes = uart_tx_stats.bytes + uart_tx_stats.dropped;
+            uint32_t start = dwt_cycles();
+            (*cmd->function)();
+            uint32_t cycles = dwt_cycles() - start;
+            perf->bytes += uart_tx_stats.bytes + uart_tx_stats.dropped - bytes;
+            perf->cycles += cycles;
+            if (!perf->calls || cycles < perf->cycles_min) perf->cycles_min = cycles;
+            if (cycles > perf->cycles_max) perf->cycles_max = cycles;
+            perf->calls++;
         }
     } // At least one "word" / argument found
+    TRACE_EXIT(CMD);
 }
 
 // Return true (non-zero) if character is a white space character
@@ -283,8 +368,76 @@ char * PrintHalStatus(int status)
     return s_status;
 } // PrintHalStatus()
 
+// Compare command lookup cost: hashed vs. the linear strcmp() walk it replaced
+// Each command name is looked up both ways, DWT cycles are averaged over all commands.
+// Tools/cmd_hash_bench.c runs the same lookup on the host for 20, 100 and 500 commands.
+int cl_cmdbench(void)
+{
+    uint32_t count = 0, hash_total = 0, hash_max = 0, linear_total = 0, linear_max = 0;
+    volatile const void * sink;
+    dwt_init();
+    for (int i = 0; cmd_table[i].function; i++, count++) {
+        const char * name = cmd_table[i].command;
+        uint32_t start = dwt_cycles();
+        sink = cl_find_command(name);
+        uint32_t cycles = dwt_cycles() - start;
+        hash_total += cycles;
+        if (cycles > hash_max) hash_max = cycles;
+
+        start = dwt_cycles();
+        int j;
+        for (j = 0; cmd_table[j].function; j++)
+            if (strcmp(name, cmd_table[j].command) == 0) break;
+        sink = &cmd_table[j];
+        cycles = dwt_cycles() - start;
+        linear_total += cycles;
+        if (cycles > linear_max) linear_max = cycles;
+    }
+    (void)sink;
+    uint32_t used = 0;
+    for (unsigned i = 0; i < CMD_HASH_SIZE; i++) used += cmd_hash[i] != 0;
+    printf("%lu commands, %lu/%u hash slots used\n", count, used, CMD_HASH_SIZE);
+    printf("Lookup  Avg cycles  Max cycles\n");
+    printf("hash    %-11lu %lu\n", hash_total / count, hash_max);
+    printf("linear  %-11lu %lu\n", linear_total / count, linear_max);
+    return 0;
+}
+
+// Command line method to display the per-command execution profile, most expensive first
+// perf        : display the profile
+// perf reset  : clear it
+int cl_perf(void)
+{
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        memset(cmd_perf, 0, sizeof(cmd_perf));
+        return 0;
+    }
+    // Sort the commands that were called by total cycles, insertion sort
+    uint8_t order[CMD_COUNT];
+    unsigned n = 0;
+    for (unsigned i = 0; cmd_table[i].function; i++) {
+        if (!cmd_perf[i].calls) continue;
+        unsigned j = n++;
+        while (j && cmd_perf[order[j - 1]].cycles < cmd_perf[i].cycles) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    uint32_t per_us = SystemCoreClock / 1000000;
+    printf("Command     Calls  Avg(us)    Min(us)    Max(us)    Total(ms)  Bytes\n");
+    for (unsigned k = 0; k < n; k++) {
+        const CMD_PERF * p = &cmd_perf[order[k]];
+        printf("%-11s %-6lu %-10lu %-10lu %-10lu %-10lu %lu\n", cmd_table[order[k]].command, p->calls,
+                (uint32_t)(p->cycles / p->calls / per_us), p->cycles_min / per_us, p->cycles_max / per_us,
+                (uint32_t)(p->cycles / per_us / 1000), p->bytes);
+    }
+    return 0;
+}
+
 // Reset the processor
 int cl_reset(void) {
+    uart_tx_flush(); // let queued output finish
     NVIC_SystemReset(); // CMSIS Cortex-M3 function - see Drivers/CMSIS/Include/core_cm3.h
     while (1) ; // wait here until reset completes
 
@@ -295,45 +448,45 @@ int cl_reset(void) {
 int cl_version(void)
 {
 	printf("%s\n",szversion);
+	printf("Built %02u/%02u/%04u %02u:%02u:%02u\n",fw_build.dt.d,fw_build.dt.m,fw_build.dt.yOff + 2000,
+			fw_build.dt.hh,fw_build.dt.mm,fw_build.dt.ss);
 	return 0;
 }
 
 
 // Perform a timer4 test.
-// Timer2 is a 16-bit free-running timer with pre-scale counter.
-// Is the us timer tracking System Ticks?
-// Timer2 is configured to increment each micro-second
-// Alternatively, if used a GPIO, we could toggle a pin after X micro-seconds
+// Is the us timebase (TIM4, extended to 64 bits by timebase.c) tracking System Ticks?
+// timer <ms> : time HAL_Delay(ms), 50ms if not given.  Delays over 65ms are measured correctly.
 int cl_timer(void)
 {
-    printf("%s(), Timing HAL_Delay(50)\n",__func__);
-    volatile TIM_TypeDef *TIMx = TIM4; // Use timer 4
+    uint32_t delay_ms = argc > 1 ? strtoul(argv[1], NULL, 0) : 50;
+    printf("%s(), Timing HAL_Delay(%lu)\n",__func__,delay_ms);
     uint32_t start_ticks = HAL_GetTick();
-    uint32_t start_us = TIMx->CNT; // read us hardware timer
-    HAL_Delay(50); // delay 50us
-    uint32_t stop_us = TIMx->CNT; // read us hardware timer
+    uint64_t start_us = timebase_us();
+    HAL_Delay(delay_ms);
+    uint64_t stop_us = timebase_us();
     uint32_t stop_ticks = HAL_GetTick();
     // Report results
     printf("HAL_GetTick() time: %lu ms\n",stop_ticks-start_ticks);
-    if(stop_us < start_us) stop_us += 1<<16; // roll-over, add 16-bit roll-over offset
-    printf("TIMx->CNT time: %lu us\n",stop_us - start_us);
+    printf("timebase_us() time: %lu us\n",(uint32_t)(stop_us - start_us));
+    printf("Timebase: %lu.%06lu s since start, %lu TIM4 overflows\n",(uint32_t)(stop_us / 1000000),
+            (uint32_t)(stop_us % 1000000),timebase_overflows());
     return 0;
 }
 
-// Using a 16 bit timer spin-delay a quantity of micro-seconds
-// Timer is configured to increment each micro-second
+// Using the microsecond timebase spin-delay a quantity of micro-seconds, return the micro-seconds elapsed
+// TIM4 is configured to increment each micro-second, timebase.c extends it past 16 bits
 // This function appears to work perfectly at 64-72MHz system clock, always returning 1000us, when 1000us was requested
 //  - Release build only.  Debug build runs noticeably slower, returning values greater than what was expected.
 // With 16MHz system clock and 8MHz peripheral clock, the delta times are 1000, 1001, and 1019 when systick interrupts fire
 // With 8MHz system clock and 8MHz peripheral clock, the delta times are 1000, 1002, and 1033, 1036, 1038 when systick interrupts fire
-uint16_t timer_delay_us(uint16_t delay_us)
+uint32_t timer_delay_us(uint32_t delay_us)
 {
     //printf("%s(%lu)\n",__func__,delay_us);
-    volatile TIM_TypeDef *TIMx = TIM4; // Establish pointer to timer 4 registers
-    uint16_t start_us = TIMx->CNT; // function entry count
-    uint16_t delta;
+    uint32_t start_us = timebase_us32(); // function entry count
+    uint32_t delta;
     do {
-    	delta = TIMx->CNT - start_us;
+    	delta = timebase_us32() - start_us;
     } while(delta < delay_us);
 
     return delta;
@@ -342,6 +495,93 @@ uint16_t timer_delay_us(uint16_t delay_us)
 // Comment out the following define to use the non-array method
 //#define USEARRAY	1
 
+#ifndef USEARRAY
+// Measure the accuracy of each delay method with the DWT cycle counter: DELAYTEST_SAMPLES
+// delays per method, a few per superloop pass so the clock keeps running.  The error
+// (measured - requested) goes into a histogram of doubling buckets.
+#define DELAYTEST_SAMPLES 1024
+#define DELAYTEST_SLICE   4   // delays per slice
+#define DELAYTEST_BUCKETS 8   // error < 125ns, < 250ns, ... < 8us, >= 8us
+#define DELAYTEST_BUCKET0 125 // ns
+
+typedef struct {
+    const char * name;
+    uint32_t request_ns;
+    uint32_t early;          // shorter than requested
+    uint32_t min_ns, max_ns; // error
+    uint64_t total_ns;
+    uint16_t hist[DELAYTEST_BUCKETS];
+} DELAYTEST_METHOD;
+
+static DELAYTEST_METHOD delaytest_methods[] = {
+    {"timer_delay_us(1000) spin", 1000000},
+    {"delay_us(1000) WFI",        1000000},
+    {"delay_us(100) WFI",         100000},
+    {"delay_us(10) spin",         10000},
+    {"delay_ns(500) cycles",      500},
+};
+#define DELAYTEST_METHODS (sizeof(delaytest_methods) / sizeof(delaytest_methods[0]))
+
+static TASK_STATUS delaytest_run(TASK * t);
+static TASK delaytest_task = {"delaytest", delaytest_run};
+static uint8_t delaytest_method;
+static uint16_t delaytest_count;
+
+static void delaytest_sample(unsigned method)
+{
+    DELAYTEST_METHOD * m = &delaytest_methods[method];
+    uint32_t start = dwt_cycles();
+    switch(method) {
+    case 0: timer_delay_us(1000); break;
+    case 1: delay_us(1000); break;
+    case 2: delay_us(100); break;
+    case 3: delay_us(10); break;
+    default: delay_ns(500); break;
+    }
+    uint32_t ns = (uint32_t)((uint64_t)(dwt_cycles() - start) * 1000 / (SystemCoreClock / 1000000));
+    uint32_t error = 0;
+    if(ns < m->request_ns) m->early++;
+    else error = ns - m->request_ns;
+    if(!m->min_ns && !m->max_ns && !m->total_ns) m->min_ns = error; // first sample
+    if(error < m->min_ns) m->min_ns = error;
+    if(error > m->max_ns) m->max_ns = error;
+    m->total_ns += error;
+    unsigned b = 0;
+    while(b < DELAYTEST_BUCKETS - 1 && error >= (uint32_t)DELAYTEST_BUCKET0 << b) b++;
+    m->hist[b]++;
+}
+
+static void delaytest_report(void)
+{
+    printf("Delay error (measured - requested), %u delays each, DWT timed\n", DELAYTEST_SAMPLES);
+    printf("%-26s %7s %7s %7s %5s", "Method", "min ns", "avg ns", "max ns", "early");
+    for(unsigned b = 0; b < DELAYTEST_BUCKETS - 1; b++) printf(" <%-5lu", (uint32_t)DELAYTEST_BUCKET0 << b);
+    printf(" more\n");
+    for(unsigned i = 0; i < DELAYTEST_METHODS; i++) {
+        const DELAYTEST_METHOD * m = &delaytest_methods[i];
+        printf("%-26s %7lu %7lu %7lu %5lu", m->name, m->min_ns, (uint32_t)(m->total_ns / DELAYTEST_SAMPLES),
+                m->max_ns, m->early);
+        for(unsigned b = 0; b < DELAYTEST_BUCKETS; b++) printf(" %6u", m->hist[b]);
+        printf("\n");
+    }
+    printf("delay_cycles() overhead %lu cycles, %lu WFI wake-ups in %lu sleeping delays\n",
+            delay_stats.overhead, delay_stats.wakes, delay_stats.sleeps);
+}
+
+static TASK_STATUS delaytest_run(TASK * t)
+{
+    TASK_BEGIN(t);
+    for(delaytest_method = 0; delaytest_method < DELAYTEST_METHODS; delaytest_method++) {
+        for(delaytest_count = 0; delaytest_count < DELAYTEST_SAMPLES; delaytest_count += DELAYTEST_SLICE) {
+            for(unsigned i = 0; i < DELAYTEST_SLICE; i++) delaytest_sample(delaytest_method);
+            TASK_YIELD(t);
+        }
+    }
+    delaytest_report();
+    TASK_END(t);
+}
+#endif
+
 // Test timer_delay_us() function
 int cl_timer_delay_test(void)
 {
@@ -360,25 +600,16 @@ int cl_timer_delay_test(void)
 		printf("%u:%u%s\n",i,delay_results[i],delay_results[i]<=1002?"":" <======="); // display marker for larger values
 
 #else
-    	// Analyze the delta time returned
-        uint16_t delta;
-        uint16_t i;
-
-        // For 60 seconds, test the timer_delay_us timer, looking for a delta that isn't 1000us
-        // 60 seconds count down
-        for(int seconds=59; seconds >= 0; seconds--) {
-        	// 1024 1 ms delays (1 second or so)
-        	for(i=0; i<1024; i++) {
-    			delta = timer_delay_us(1000); // 1ms delay
-    			if(delta > 1000) {
-    				printf("Not 1000us: %u\n",delta);
-    				return 1;
-    			}
-        	}
-        	printf("\b\b  \b\b%d",seconds); // seconds count down - erase previous display each time
-        }
-        printf("\b \n"); // erase the remaining '0', then line feed
-        printf("60 seconds worth of 1000us delays - each delay returned 1000us!\n");
+    // Measure each delay method in the background (delaytest_run())
+    if(task_running(&delaytest_task)) return task_start(&delaytest_task); // reports the job
+    for(unsigned i = 0; i < DELAYTEST_METHODS; i++) {
+        DELAYTEST_METHOD * m = &delaytest_methods[i];
+        m->early = m->min_ns = m->max_ns = 0;
+        m->total_ns = 0;
+        memset(m->hist, 0, sizeof(m->hist));
+    }
+    delay_stats.wakes = delay_stats.sleeps = 0;
+    task_start(&delaytest_task);
 #endif
 
     return 0;
@@ -0,0 +1,82 @@
+// delay.c, microsecond and sub-microsecond delays - timer compare with WFI, calibrated cycle loops
+//
+// delay_us() picks the method by length:
+// * DELAY_WFI_MIN_US and longer: TIM4 channel 2 compare is armed DELAY_WAKE_US before the end
+//   and the core sleeps (WFI).  Interrupts that arrive meanwhile are serviced as usual and the
+//   core goes back to sleep, so they no longer stretch a spinning delay loop.  The last few
+//   microseconds are spun on the timebase for accuracy.
+// * Shorter delays, or calls from an interrupt handler or with interrupts disabled (WFI
+//   would not return on time): spin on the timebase, as timer_delay_us().
+// delay_ns() / delay_cycles() spin on the DWT cycle counter, with the call overhead measured
+// by delay_init() subtracted, for the sub-microsecond waits the 1us timebase can't resolve.
+//
+// TIM4 is the free-running timebase (timebase.c), so the compare on one of its channels
+// takes the place of a one-pulse timer.  The compare interrupt only wakes the core,
+// HAL_TIM_IRQHandler() clears the flag.
+
+#include "delay.h"
+#include "timebase.h"
+#include "dwt.h"
+
+#define DELAY_CAL_CYCLES 1000 // delay_cycles() request used to measure the overhead
+
+DELAY_STATS delay_stats;
+
+// Measure the delay_cycles() overhead (call, loop exit, return)
+void delay_init(void)
+{
+	dwt_init();
+	delay_stats.overhead = 0;
+	uint32_t best = UINT32_MAX;
+	for(int i = 0; i < 8; i++) { // best of 8, an interrupt may land in one
+		uint32_t start = dwt_cycles();
+		delay_cycles(DELAY_CAL_CYCLES);
+		uint32_t elapsed = dwt_cycles() - start;
+		if(elapsed < best) best = elapsed;
+	}
+	delay_stats.overhead = best > DELAY_CAL_CYCLES ? best - DELAY_CAL_CYCLES : 0;
+}
+
+// Spin for a number of core clock cycles, less the calibrated overhead
+void delay_cycles(uint32_t cycles)
+{
+	uint32_t start = dwt_cycles();
+	if(cycles <= delay_stats.overhead) return;
+	cycles -= delay_stats.overhead;
+	while(dwt_cycles() - start < cycles);
+}
+
+void delay_ns(uint32_t ns)
+{
+	delay_cycles((uint32_t)(((uint64_t)ns * SystemCoreClock) / 1000000000));
+}
+
+// Delay a number of microseconds, return the microseconds elapsed (timebase)
+uint32_t delay_us(uint32_t us)
+{
+	uint32_t start = timebase_us32();
+	uint32_t elapsed;
+	if(us < DELAY_WFI_MIN_US || __get_IPSR() || __get_PRIMASK()) {
+		delay_stats.spins++;
+		while((elapsed = timebase_us32() - start) < us);
+		return elapsed;
+	}
+	delay_stats.sleeps++;
+	// At least 2us ahead, so the compare can't be missed while it is being armed
+	while((elapsed = timebase_us32() - start) + 2 < us - DELAY_WAKE_US) {
+		// Wake at the end, or at the latest in 60ms (the compare is 16 bits)
+		uint32_t remaining = us - DELAY_WAKE_US - elapsed;
+		if(remaining > 60000) remaining = 60000;
+		// Interrupts masked: one arriving before the WFI still wakes it, then runs on unmasking
+		__disable_irq();
+		TIM4->SR = ~TIM_SR_CC2IF;
+		TIM4->CCR2 = (uint16_t)(TIM4->CNT + remaining);
+		TIM4->DIER |= TIM_DIER_CC2IE;
+		__WFI();
+		__enable_irq();
+		delay_stats.wakes++;
+	}
+	TIM4->DIER &= ~TIM_DIER_CC2IE;
+	while((elapsed = timebase_us32() - start) < us);
+	return elapsed;
+}
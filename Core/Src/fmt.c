@@ -0,0 +1,189 @@
+// fmt.c, small integer / fixed-point formatter writing into the UART TX ring
+//
+// newlib printf() runs its full format parser, with its stack use, for output that is mostly
+// "%02u:%02u:%02u" and register dumps.  "fmtbench" compares the cycles and stack of the two.
+// These functions each do one conversion, so the compiler checks the argument types, and
+// collect a line in a FMT buffer on the caller's stack.  fmt_end() (or a full buffer) hands it
+// to the TX ring in one write.
+//
+// Flash: fmt adds .text and saves none while other commands still use printf(), vfprintf stays
+// linked.  Not measured on the target build (no arm-none-eabi toolchain at hand): the fmt_
+// functions are 1072 bytes of .text built for x86-64 with gcc -Os, Thumb-2 is usually
+// smaller.  To measure: arm-none-eabi-nm -S --size-sort on the .elf, _vfprintf_r vs fmt_*.
+//
+// Usage:
+//   FMT f;
+//   fmt_begin(&f);
+//   fmt_u(&f, hh, 2, '0'); fmt_char(&f, ':'); fmt_u(&f, mm, 2, '0');
+//   fmt_end(&f);
+
+#include <stdio.h>  // printf() for the benchmark
+#include "main.h"
+#include "fmt.h"
+#include "uart_tx.h"
+#include "dwt.h"
+
+static void fmt_flush(FMT * f)
+{
+	if(f->len) uart_tx_write((const uint8_t *)f->buf, f->len);
+	f->len = 0;
+}
+
+void fmt_begin(FMT * f)
+{
+	f->len = 0;
+}
+
+void fmt_end(FMT * f)
+{
+	fmt_flush(f);
+}
+
+void fmt_char(FMT * f, char c)
+{
+	if(f->len >= FMT_BUF_SIZE) fmt_flush(f);
+	f->buf[f->len++] = c;
+}
+
+void fmt_str(FMT * f, const char * s)
+{
+	while(*s) fmt_char(f, *s++);
+}
+
+void fmt_str_w(FMT * f, const char * s, uint8_t width)
+{
+	uint8_t n = 0;
+	while(*s) { fmt_char(f, *s++); n++; }
+	while(n++ < width) fmt_char(f, ' ');
+}
+
+// Digits of v in the given base, least significant first, return the count
+static uint8_t fmt_digits(uint32_t v, uint32_t base, char * digits)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	uint8_t n = 0;
+	do {
+		digits[n++] = hex[v % base];
+		v /= base;
+	} while(v);
+	return n;
+}
+
+static void fmt_number(FMT * f, uint32_t v, uint32_t base, uint8_t width, char pad, char sign)
+{
+	char digits[10];
+	uint8_t n = fmt_digits(v, base, digits);
+	uint8_t total = n + (sign != 0);
+	if(sign && pad == '0') fmt_char(f, sign); // "-007"
+	while(width > total) { fmt_char(f, pad); width--; }
+	if(sign && pad != '0') fmt_char(f, sign); // "  -7"
+	while(n) fmt_char(f, digits[--n]);
+}
+
+void fmt_u(FMT * f, uint32_t v, uint8_t width, char pad)
+{
+	fmt_number(f, v, 10, width, pad ? pad : ' ', 0);
+}
+
+void fmt_d(FMT * f, int32_t v, uint8_t width)
+{
+	if(v < 0) fmt_number(f, 0U - (uint32_t)v, 10, width, ' ', '-');
+	else fmt_number(f, (uint32_t)v, 10, width, ' ', 0);
+}
+
+void fmt_x(FMT * f, uint32_t v, uint8_t width)
+{
+	fmt_number(f, v, 16, width, '0', 0);
+}
+
+// Signed fixed-point value with frac_bits fraction bits, rounded to decimals places
+// IE: DS3231 temperature, 0.25C steps: fmt_fixed(&f, quarters, 2, 2) -> "23.25"
+void fmt_fixed(FMT * f, int32_t v, uint8_t frac_bits, uint8_t decimals)
+{
+	uint32_t scale = 1;
+	for(uint8_t i = 0; i < decimals; i++) scale *= 10;
+	uint32_t mag = v < 0 ? 0U - (uint32_t)v : (uint32_t)v;
+	// Scaled to decimals places, rounded half up
+	uint32_t scaled = (uint32_t)((((uint64_t)mag * scale) + (1U << frac_bits >> 1)) >> frac_bits);
+	if(v < 0 && scaled) fmt_char(f, '-');
+	fmt_u(f, scaled / scale, 0, 0);
+	if(decimals) {
+		fmt_char(f, '.');
+		fmt_u(f, scaled % scale, decimals, '0');
+	}
+}
+
+//=============================================================================
+// Benchmark - printf() vs fmt for the "time" output line
+
+#define FMT_STACK_PAINT 1536 // bytes below the stack pointer painted to measure stack use, at most
+#define FMT_PAINT_WORD  0xA5A5A5A5
+
+extern uint8_t _estack;          // linker script, top of the stack
+extern uint32_t _Min_Stack_Size; // linker script, stack reserved below _estack
+
+static void fmt_time_printf(void)
+{
+	printf("%02u:%02u:%02u\r\n", 12, 34, 56);
+}
+
+static void fmt_time_fmt(void)
+{
+	FMT f;
+	fmt_begin(&f);
+	fmt_u(&f, 12, 2, '0'); fmt_char(&f, ':');
+	fmt_u(&f, 34, 2, '0'); fmt_char(&f, ':');
+	fmt_u(&f, 56, 2, '0'); fmt_str(&f, "\r\n");
+	fmt_end(&f);
+}
+
+// Paint the stack below the current frame, call fn, return the bytes fn overwrote
+// (an interrupt during the call can only make this larger).  Only the stack reserved by the
+// linker script is painted, below it are the arena and .bss.  *painted receives the bytes
+// painted: a result that close to it means fn may have used more.
+static uint32_t __attribute__((noinline)) fmt_stack_used(void (*fn)(void), uint32_t * painted)
+{
+	volatile uint32_t * sp = (volatile uint32_t *)__get_MSP();
+	volatile uint32_t * low = sp - FMT_STACK_PAINT / 4;
+	volatile uint32_t * bottom = (volatile uint32_t *)(&_estack - (uint32_t)&_Min_Stack_Size);
+	if(low < bottom) low = bottom;
+	if(low > sp) low = sp; // already below the reservation, nothing to paint
+	*painted = (uint32_t)(sp - low) * 4;
+	for(volatile uint32_t * p = low; p < sp - 8; p++) *p = FMT_PAINT_WORD; // leave room for this frame
+	fn();
+	volatile uint32_t * p = low;
+	while(p < sp - 8 && *p == FMT_PAINT_WORD) p++;
+	return (uint32_t)(sp - p) * 4;
+}
+
+static uint32_t fmt_cycles(void (*fn)(void))
+{
+	uart_tx_flush(); // measure formatting, not waiting for room in the ring
+	uint32_t start = dwt_cycles();
+	fn();
+	return dwt_cycles() - start;
+}
+
+int cl_fmtbench(void)
+{
+	dwt_init();
+	uint32_t printf_cycles = fmt_cycles(fmt_time_printf);
+	uint32_t fmt_cycles_ = fmt_cycles(fmt_time_fmt);
+	uart_tx_flush();
+	uint32_t printf_painted, fmt_painted;
+	uint32_t printf_stack = fmt_stack_used(fmt_time_printf, &printf_painted);
+	uint32_t fmt_stack = fmt_stack_used(fmt_time_fmt, &fmt_painted);
+	uart_tx_flush();
+
+	FMT f;
+	fmt_begin(&f);
+	fmt_str(&f, "\"%02u:%02u:%02u\"  Cycles  Stack (bytes)\r\n");
+	fmt_str_w(&f, "printf()", 20); fmt_u(&f, printf_cycles, 7, ' '); fmt_char(&f, ' ');
+	if(printf_stack >= printf_painted - 32) fmt_char(&f, '>');
+	fmt_u(&f, printf_stack, 0, 0); fmt_str(&f, "\r\n");
+	fmt_str_w(&f, "fmt", 20); fmt_u(&f, fmt_cycles_, 7, ' '); fmt_char(&f, ' ');
+	if(fmt_stack >= fmt_painted - 32) fmt_char(&f, '>');
+	fmt_u(&f, fmt_stack, 0, 0); fmt_str(&f, "\r\n");
+	fmt_end(&f);
+	return 0;
+}
@@ -0,0 +1,124 @@
+// i2c_probe.c, fast I2C1 bus inventory
+//
+// HAL_I2C_IsDeviceReady() waits on HAL_GetTick() timeouts, so a scan of the full address range
+// takes a noticeable fraction of a second and blocks the clock.  Here each address is probed
+// at register level: START, address + write, then poll SR1 until the ACK (ADDR) or NACK (AF)
+// flag is set, timed with the TIM4 microsecond counter.  A probe takes ~100us at 100kHz.
+//
+// The full range is scanned once at boot and cached.  i2c_probe_rescan() re-probes only the
+// expected addresses (devices found at boot plus the DS3231).  "i2cscan" renders the cache.
+
+#include "main.h"
+#include "i2c_probe.h"
+#include "i2c_queue.h"
+#include "cl_i2c.h"
+#include "DS3231.h" // DS3231_ADDRESS
+
+extern I2C_HandleTypeDef hi2c1; // main.c
+
+I2C_INVENTORY i2c_inventory;
+
+// Wait for (SR1 & mask), return SR1, or 0 on timeout
+static uint16_t i2c_probe_wait_sr1(I2C_TypeDef * i2c, uint16_t mask, uint16_t start_us)
+{
+	for(;;) {
+		uint16_t sr1 = i2c->SR1;
+		if(sr1 & mask) return sr1;
+		if((uint16_t)(TIM4->CNT - start_us) > I2C_PROBE_TIMEOUT_US) return 0;
+	}
+}
+
+// Probe one 7-bit address
+// Return 1 if the device ACKed, 0 for a NACK, -1 if the bus did not respond
+static int i2c_probe_address(uint8_t addr)
+{
+	I2C_TypeDef * i2c = hi2c1.Instance;
+	uint16_t start_us = TIM4->CNT; // TIM4 counts microseconds
+	int result = -1;
+
+	while(i2c->SR2 & I2C_SR2_BUSY) {
+		if((uint16_t)(TIM4->CNT - start_us) > I2C_PROBE_TIMEOUT_US) return -1;
+	}
+	i2c->CR1 |= I2C_CR1_START;
+	if(i2c_probe_wait_sr1(i2c, I2C_SR1_SB, start_us)) {
+		i2c->DR = addr << 1; // SR1 read followed by DR write clears SB
+		uint16_t sr1 = i2c_probe_wait_sr1(i2c, I2C_SR1_ADDR | I2C_SR1_AF, start_us);
+		i2c->CR1 |= I2C_CR1_STOP;
+		if(sr1 & I2C_SR1_ADDR) {
+			(void)i2c->SR2; // SR1 read followed by SR2 read clears ADDR
+			result = 1;
+		} else if(sr1 & I2C_SR1_AF) {
+			i2c->SR1 = (uint16_t)~I2C_SR1_AF; // rc_w0
+			result = 0;
+		}
+	} else {
+		i2c->CR1 |= I2C_CR1_STOP;
+	}
+	while(i2c->CR1 & I2C_CR1_STOP) { // cleared by hardware once STOP is on the bus
+		if((uint16_t)(TIM4->CNT - start_us) > 2 * I2C_PROBE_TIMEOUT_US) return -1;
+	}
+	return result;
+}
+
+// Probe each address in the map (NULL: full range), update the cache
+static void i2c_probe_map(const uint8_t * map)
+{
+	I2C_INVENTORY * inv = &i2c_inventory;
+	uint32_t elapsed_us = 0;
+	inv->probed = inv->bus_errors = inv->changes = 0;
+
+	i2c_queue_acquire(); // wait for the interrupt driven transfer to finish, hold the queue
+	for(uint8_t addr = I2C_ADDRESS_MIN; addr <= I2C_ADDRESS_MAX; addr++) {
+		uint8_t bit = 1 << (addr & 7);
+		if(map && !(map[addr >> 3] & bit)) continue;
+		uint16_t start_us = TIM4->CNT;
+		int result = i2c_probe_address(addr);
+		elapsed_us += (uint16_t)(TIM4->CNT - start_us);
+		inv->probed++;
+		if(result < 0) {
+			// Bus stuck - re-initialize I2C1, consider the address missing
+			inv->bus_errors++;
+			i2c_stats.errors++;
+			HAL_I2C_DeInit(&hi2c1);
+			HAL_I2C_Init(&hi2c1);
+			result = 0;
+		}
+		uint8_t was = (inv->present[addr >> 3] & bit) != 0;
+		if(result) inv->present[addr >> 3] |= bit;
+		else       inv->present[addr >> 3] &= ~bit;
+		if(was != result) inv->changes++;
+	}
+	i2c_queue_release();
+
+	i2c_stats.transactions += inv->probed;
+	i2c_stats.bytes += inv->probed; // address byte
+	inv->scan_us = elapsed_us;
+	inv->ticks = HAL_GetTick();
+}
+
+// Scan the full address range, the devices found become the expected set
+void i2c_probe_scan(void)
+{
+	i2c_probe_map(NULL);
+	for(unsigned i = 0; i < sizeof(i2c_inventory.expected); i++)
+		i2c_inventory.expected[i] |= i2c_inventory.present[i];
+}
+
+// Re-probe only the expected addresses
+void i2c_probe_rescan(void)
+{
+	i2c_probe_map(i2c_inventory.expected);
+}
+
+// Boot time inventory
+void i2c_probe_init(void)
+{
+	i2c_inventory.expected[DS3231_ADDRESS >> 3] |= 1 << (DS3231_ADDRESS & 7);
+	i2c_probe_scan();
+}
+
+// Return non-zero if the address responded to the last scan
+int i2c_probe_present(uint8_t addr)
+{
+	return addr <= I2C_ADDRESS_MAX && (i2c_inventory.present[addr >> 3] & (1 << (addr & 7)));
+}
@@ -0,0 +1,255 @@
+// i2c_queue.c, prioritized I2C1 transaction queue
+//
+// Time reads, status polls, alarm writes, temperature reads and command line diagnostics
+// all share I2C1.  Each client fills in an I2C_REQUEST and submits it:
+// * The queue is kept sorted by priority, then deadline, then submission order.
+// * When a transfer completes, the I2C1 interrupt starts the next one - the bus runs
+//   back-to-back without the CPU polling.
+// * A register read is merged with queued reads of adjacent / overlapping registers on the
+//   same device, becoming one burst (IE: "time" 00h-06h and "alarm 1" 07h-0Ah).  Reads
+//   queued behind a write to the device are not merged.
+// * A request still queued at its deadline is completed with HAL_TIMEOUT, no bus traffic.
+//
+// i2c_transfer() submits a request and waits for it, for code that wants blocking behavior.
+
+#include <string.h> // memcpy()
+#include "main.h"
+#include "i2c_queue.h"
+#include "cl_i2c.h"
+
+extern I2C_HandleTypeDef hi2c1; // main.c
+
+I2C_QUEUE_STATS i2c_queue_stats;
+
+static I2C_REQUEST * queue;    // waiting requests, sorted
+static I2C_REQUEST * active;   // requests being serviced by the current bus transfer
+static uint32_t active_ticks;  // HAL_GetTick() when the current transfer started
+static uint8_t burst_reg;      // first register of a merged read
+static uint8_t burst[I2C_BURST_MAX];
+static uint8_t burst_merged;   // current transfer uses burst[]
+static volatile uint8_t held;  // i2c_queue_acquire() - another driver owns I2C1
+
+// Return 1 if a should be serviced before b
+static int i2c_before(const I2C_REQUEST * a, const I2C_REQUEST * b)
+{
+	if(a->priority != b->priority) return a->priority < b->priority;
+	if(a->deadline && b->deadline) return (int32_t)(a->deadline - b->deadline) < 0;
+	return a->deadline != 0 && b->deadline == 0;
+}
+
+// Complete each request on the active list, call their done() functions
+// Called with interrupts disabled, or from the I2C interrupt
+static void i2c_finish(HAL_StatusTypeDef status)
+{
+	if(HAL_OK != status) i2c_stats.errors++;
+	while(active) {
+		I2C_REQUEST * req = active;
+		active = req->next;
+		if(HAL_OK == status && burst_merged)
+			memcpy(req->data, &burst[req->reg - burst_reg], req->len);
+		req->next = NULL;
+		req->status = status;
+		req->state = I2C_REQ_DONE;
+		if(req->done) req->done(req);
+	}
+}
+
+// Pull queued reads that touch [lo, hi) on the same device into the active list
+// The scan stops at the first other request to the device: a read queued behind a write must
+// see the written data.
+static void i2c_merge(uint8_t dev, uint16_t * lo, uint16_t * hi)
+{
+	int grew;
+	do {
+		grew = 0;
+		I2C_REQUEST ** link = &queue;
+		while(*link) {
+			I2C_REQUEST * q = *link;
+			if(q->dev == dev && q->op != I2C_OP_MEM_READ) break;
+			uint16_t q_lo = q->reg;
+			uint16_t q_hi = q->reg + q->len;
+			uint16_t new_lo = q_lo < *lo ? q_lo : *lo;
+			uint16_t new_hi = q_hi > *hi ? q_hi : *hi;
+			if(q->dev == dev && q->op == I2C_OP_MEM_READ && q_lo <= *hi && q_hi >= *lo
+					&& new_hi - new_lo <= I2C_BURST_MAX) {
+				*link = q->next; // remove from queue
+				q->next = active;
+				q->state = I2C_REQ_ACTIVE;
+				active = q;
+				*lo = new_lo;
+				*hi = new_hi;
+				i2c_queue_stats.merged++;
+				grew = 1;
+			} else {
+				link = &q->next;
+			}
+		}
+	} while(grew);
+}
+
+// Start the next transfer if the bus is idle
+// Called with interrupts disabled, or from the I2C interrupt
+static void i2c_start_next(void)
+{
+	while(!held && !active && queue) {
+		I2C_REQUEST * req = queue;
+		queue = req->next;
+		req->next = NULL;
+		if(req->deadline && (int32_t)(HAL_GetTick() - req->deadline) > 0) {
+			i2c_queue_stats.expired++;
+			burst_merged = 0;
+			active = req;
+			i2c_finish(HAL_TIMEOUT);
+			continue;
+		}
+		req->state = I2C_REQ_ACTIVE;
+		active = req;
+		active_ticks = HAL_GetTick();
+		burst_merged = 0;
+
+		HAL_StatusTypeDef rc;
+		uint16_t address = req->dev << 1;
+		i2c_stats.transactions++;
+		switch(req->op) {
+		case I2C_OP_MEM_READ: {
+			uint16_t lo = req->reg;
+			uint16_t hi = req->reg + req->len;
+			if(req->len <= I2C_BURST_MAX) i2c_merge(req->dev, &lo, &hi);
+			if(active->next) {
+				// More than one request - read the span into burst[], copy out when done
+				burst_merged = 1;
+				burst_reg = (uint8_t)lo;
+				rc = HAL_I2C_Mem_Read_IT(&hi2c1, address, lo, I2C_MEMADD_SIZE_8BIT, burst, hi - lo);
+			} else {
+				rc = HAL_I2C_Mem_Read_IT(&hi2c1, address, req->reg, I2C_MEMADD_SIZE_8BIT, req->data, req->len);
+			}
+			i2c_stats.bytes += 3 + (hi - lo); // address, index, address, data
+			break;
+		}
+		case I2C_OP_MEM_WRITE:
+			rc = HAL_I2C_Mem_Write_IT(&hi2c1, address, req->reg, I2C_MEMADD_SIZE_8BIT, req->data, req->len);
+			i2c_stats.bytes += 2 + req->len;
+			break;
+		case I2C_OP_READ:
+			rc = HAL_I2C_Master_Receive_IT(&hi2c1, address, req->data, req->len);
+			i2c_stats.bytes += 1 + req->len;
+			break;
+		default:
+			rc = HAL_I2C_Master_Transmit_IT(&hi2c1, address, req->data, req->len);
+			i2c_stats.bytes += 1 + req->len;
+			break;
+		}
+		if(HAL_OK != rc) i2c_finish(rc); // couldn't start, try the next request
+	}
+}
+
+// Add a request to the queue.  Safe to call from interrupt context.
+HAL_StatusTypeDef i2c_submit(I2C_REQUEST * req)
+{
+	if(!req->len || !req->data) return HAL_ERROR;
+	req->state = I2C_REQ_QUEUED;
+	req->status = HAL_BUSY;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	// Insert after all requests that should run before this one (FIFO within equals)
+	I2C_REQUEST ** link = &queue;
+	uint8_t depth = 1;
+	while(*link && !i2c_before(req, *link)) {
+		link = &(*link)->next;
+		depth++;
+	}
+	req->next = *link;
+	*link = req;
+	for(I2C_REQUEST * q = req->next; q; q = q->next) depth++;
+	if(depth > i2c_queue_stats.depth_max) i2c_queue_stats.depth_max = depth;
+	i2c_queue_stats.requests++;
+	i2c_start_next();
+	__set_PRIMASK(primask);
+	return HAL_OK;
+}
+
+// Recover a transfer that never completed (device holding SDA, lost interrupt)
+void i2c_queue_poll(void)
+{
+	if(!active || (HAL_GetTick() - active_ticks) <= I2C_XFER_TIMEOUT) return;
+	__disable_irq();
+	if(active && (HAL_GetTick() - active_ticks) > I2C_XFER_TIMEOUT) {
+		i2c_queue_stats.aborts++;
+		HAL_I2C_DeInit(&hi2c1);
+		HAL_I2C_Init(&hi2c1);
+		i2c_finish(HAL_TIMEOUT);
+		i2c_start_next();
+	}
+	__enable_irq();
+}
+
+// Stop starting queued transfers and wait for the bus to go idle, so the caller can drive
+// I2C1 directly (IE: i2c_probe.c).  Requests submitted meanwhile wait in the queue.
+HAL_StatusTypeDef i2c_queue_acquire(void)
+{
+	held = 1;
+	while(active) {
+		i2c_queue_poll();
+	}
+	return HAL_OK;
+}
+
+// Resume servicing the queue
+void i2c_queue_release(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	held = 0;
+	i2c_start_next();
+	__set_PRIMASK(primask);
+}
+
+// Return 1 while a transfer is in progress or requests are waiting
+int i2c_queue_busy(void)
+{
+	return active != NULL || queue != NULL;
+}
+
+// Submit a request and wait for it to complete
+HAL_StatusTypeDef i2c_transfer(I2C_REQUEST * req)
+{
+	HAL_StatusTypeDef rc = i2c_submit(req);
+	if(HAL_OK != rc) return rc;
+	while(req->state != I2C_REQ_DONE)
+		i2c_queue_poll();
+	return req->status;
+}
+
+//=============================================================================
+// I2C1 interrupt callbacks (see HAL_I2C_EV_IRQHandler(), HAL_I2C_ER_IRQHandler())
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	i2c_finish(HAL_OK);
+	i2c_start_next();
+}
+
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	i2c_finish(HAL_OK);
+	i2c_start_next();
+}
+
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	i2c_finish(HAL_OK);
+	i2c_start_next();
+}
+
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	i2c_finish(HAL_OK);
+	i2c_start_next();
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+	i2c_finish(HAL_ERROR); // NACK (HAL_I2C_ERROR_AF), bus error, arbitration lost
+	i2c_start_next();
+}
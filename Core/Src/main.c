@@ -24,6 +24,19 @@
 #include <stdio.h> // printf()
 #include "command_line.h"
 #include "DS3231.h"
+#include "DS3231_cal.h"
+#include "DS3231_sqw.h"
+#include "rtc_backend.h"
+#include "i2c_queue.h"
+#include "i2c_probe.h"
+#include "uart_tx.h"
+#include "uart_rx.h"
+#include "sched.h"
+#include "power.h"
+#include "timebase.h"
+#include "delay.h"
+#include "proto.h"
+#include "mem.h"
 //#include <TM1637Display.h> // Including this causes the "C" compiler to stumble on the "C++" definitions
 
 /* USER CODE END Includes */
@@ -37,6 +50,10 @@
 /* USER CODE BEGIN PD */
 void init_tm1637(void); // TM1637_Interface.cpp
 void update_clock(void);
+void clock_sqw_edge(uint64_t edge);
+void clock_task(void);
+void clock_set_brightness(uint8_t level, uint8_t on);
+uint8_t clock_brightness(void);
 
 /* USER CODE END PD */
 
@@ -50,10 +67,12 @@ I2C_HandleTypeDef hi2c1;
 
 RTC_HandleTypeDef hrtc;
 
+TIM_HandleTypeDef htim2;
 TIM_HandleTypeDef htim4;
 
 UART_HandleTypeDef huart2;
 DMA_HandleTypeDef hdma_usart2_rx;
+DMA_HandleTypeDef hdma_usart2_tx;
 
 /* USER CODE BEGIN PV */
 
@@ -67,55 +86,57 @@ static void MX_USART2_UART_Init(void);
 static void MX_TIM4_Init(void);
 static void MX_RTC_Init(void);
 static void MX_I2C1_Init(void);
+static void MX_TIM2_Init(void);
 /* USER CODE BEGIN PFP */
 
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
-#define HAL_SMALL_WAIT  40
-
 
 // Define serial input and output functions using UART2
-// DMA Buffer for usart2 RX
-//#define USART2_RX_DMA_BUFFER_SIZE 1030 // any size will do, but we may want to choose X-Modem 1K receive size
-#define USART2_RX_DMA_BUFFER_SIZE 80
-uint8_t usart2_rx_dma_buffer[USART2_RX_DMA_BUFFER_SIZE];
-
-// Implement a get_byte(void) function that utilizes a circular DMA RX buffer that:
-// 1) Tests if data is available in the DMA RX buffer
-// 2) Pulls and returns the data
-// 3) Manages an index_out value for next removal of data
-// 4) As a non-blocking function, return EOF when no bytes are available, else returns data byte
+// Receive: circular DMA ring with IDLE line events, see uart_rx.c
+// Non-blocking, return EOF when no bytes are available, else returns data byte
 int __io_getchar(void)
 {
-#if 1
-	// The following supports STM32-F103RB for UART DMA Receive
-	static uint16_t index_out = 0;
-	uint16_t index_in = USART2_RX_DMA_BUFFER_SIZE - huart2.hdmarx->Instance->CNDTR;
-	if(index_in == index_out) return EOF;
-	// Else, we have a byte in buffer to return
-	uint8_t data = usart2_rx_dma_buffer[index_out];
-	// advance index
-	index_out++;
-	// wrap index when necessary
-	if(index_out >= USART2_RX_DMA_BUFFER_SIZE) index_out = 0;
-	return data;
-
-#else
-	// Brain dead polling
-	char ch;
-	if(HAL_OK == HAL_UART_Receive(&huart2, (uint8_t *)&ch, 1, 50))
-	    return ch;
-	else
-		return EOF;
-#endif
+	return uart_rx_getchar();
+}
+
+// cl_loop() returns after each command line - come back for the rest of a pasted script
+static void uart_rx_event(void)
+{
+  cl_loop();
+  if(uart_rx_available()) sched_post(SCHED_EV_UART_RX);
+}
+
+// Each DS3231 SQW edge (seconds roll-over) feeds the calibration and commits the staged
+// display frame
+static void sqw_event(void)
+{
+  ds3231_cal_task(); // process SQW edges captured by TIM2
+  uint64_t edge;
+  if(sqw_edge_pending(&edge)) {
+    clock_sqw_edge(edge);
+  }
+}
 
+// Without SQW edges, check RTC once a second.  Update display if minute value changes.
+static void clock_poll(void)
+{
+  if(!sqw_active()) update_clock();
+}
+
+// B1 steps through the display brightness levels
+static void button_event(void)
+{
+  uint8_t brightness = clock_brightness();
+  clock_set_brightness((brightness + 1) & 0x07, 1);
 }
 
 int __io_putchar(int ch)
 {
-    HAL_UART_Transmit(&huart2, (uint8_t *)&ch, 1, HAL_SMALL_WAIT);
+    uint8_t c = (uint8_t)ch;
+    uart_tx_write(&c, sizeof(c)); // queued, sent by DMA
     return 1;
 }
 
@@ -155,30 +176,38 @@ int main(void)
   MX_TIM4_Init();
   MX_RTC_Init();
   MX_I2C1_Init();
+  MX_TIM2_Init();
   /* USER CODE BEGIN 2 */
   //setvbuf(stdout, NULL, _IONBF, 0);	// Disable stdio output buffering
-  // Define DMA buffer for UART peripheral
-  HAL_UART_Receive_DMA(&huart2, usart2_rx_dma_buffer, USART2_RX_DMA_BUFFER_SIZE);
+  // Start circular DMA reception into the UART RX ring
+  uart_rx_start();
   cl_setup(); // calls setvbuf()
+  delay_init(); // calibrate the cycle loop delays
+  proto_init(); // binary protocol frame pool
 
   /* USER CODE END 2 */
 
   /* Infinite loop */
   /* USER CODE BEGIN WHILE */
   //init_ds3231(); // Start DS3231 clock running - reset time if clock was stopped
+  i2c_probe_init(); // inventory the I2C bus
   init_tm1637(); // init display for clock usage.  Display will show 00:00
+  rtc_init(); // check DS3231 and internal RTC, sync the internal RTC if needed
+  ds3231_cal_init(); // resume DS3231 aging offset calibration if it was running
+  sched_init();
+  sched_on(SCHED_EV_UART_RX, uart_rx_event); // serial character input for command line
+  sched_on(SCHED_EV_SQW, sqw_event);   // calibration and display roll-over
+  sched_on(SCHED_EV_I2C, clock_task);  // stage the next minute once the time registers arrive
+  sched_on(SCHED_EV_BUTTON, button_event);
+  sched_on(SCHED_EV_ALARM, power_alarm); // minute alarm after a STOP mode wake-up
+  sched_every("cl_loop", cl_loop, 100);      // binary protocol idle timeout
+  sched_every("i2c", i2c_queue_poll, 10);    // recover a stuck I2C transfer
+  sched_every("rtc", rtc_task, 1000);        // RTC backend health checks and cross-check
+  sched_every("clock", clock_poll, 1000);    // display updates without SQW edges
+  mem_seal(); // initialization done, no heap allocations from here on
   while (1)
   {
-    cl_loop();	// check for serial character input for command line
-
-    // Check RTC once a second.  Update display if minute value changes.
-    static uint32_t previous_ticks = 0;
-    // If delta time is greater or equal to 1000ms, update clock
-    if( (HAL_GetTick() - previous_ticks) >= 1000 ) {
-		previous_ticks = HAL_GetTick(); // reload for next second
-		update_clock(); // every second, check time, update clock if needed
-    }
-
+    sched_run(); // run handlers for events and due timers, else sleep until an interrupt
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
@@ -298,6 +327,64 @@ static void MX_RTC_Init(void)
 
 }
 
+/**
+  * @brief TIM2 Initialization Function
+  * @param None
+  * @retval None
+  */
+static void MX_TIM2_Init(void)
+{
+
+  /* USER CODE BEGIN TIM2_Init 0 */
+
+  /* USER CODE END TIM2_Init 0 */
+
+  TIM_ClockConfigTypeDef sClockSourceConfig = {0};
+  TIM_MasterConfigTypeDef sMasterConfig = {0};
+  TIM_IC_InitTypeDef sConfigIC = {0};
+
+  /* USER CODE BEGIN TIM2_Init 1 */
+
+  /* USER CODE END TIM2_Init 1 */
+  htim2.Instance = TIM2;
+  htim2.Init.Prescaler = 0;
+  htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
+  htim2.Init.Period = 65535;
+  htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
+  htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+  if (HAL_TIM_Base_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sClockSourceConfig.ClockSource = TIM_CLOCKSOURCE_INTERNAL;
+  if (HAL_TIM_ConfigClockSource(&htim2, &sClockSourceConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  if (HAL_TIM_IC_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
+  sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+  if (HAL_TIMEx_MasterConfigSynchronization(&htim2, &sMasterConfig) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  sConfigIC.ICPolarity = TIM_INPUTCHANNELPOLARITY_FALLING;
+  sConfigIC.ICSelection = TIM_ICSELECTION_DIRECTTI;
+  sConfigIC.ICPrescaler = TIM_ICPSC_DIV1;
+  sConfigIC.ICFilter = 4;
+  if (HAL_TIM_IC_ConfigChannel(&htim2, &sConfigIC, TIM_CHANNEL_1) != HAL_OK)
+  {
+    Error_Handler();
+  }
+  /* USER CODE BEGIN TIM2_Init 2 */
+
+  /* USER CODE END TIM2_Init 2 */
+
+}
+
 /**
   * @brief TIM4 Initialization Function
   * @param None
@@ -351,7 +438,7 @@ static void MX_TIM4_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN TIM4_Init 2 */
-  HAL_TIM_Base_Start(&htim4);
+  HAL_TIM_Base_Start_IT(&htim4); // update interrupt extends the count, see timebase.c
 
   /* USER CODE END TIM4_Init 2 */
 
@@ -403,6 +490,9 @@ static void MX_DMA_Init(void)
   /* DMA1_Channel6_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA1_Channel6_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA1_Channel6_IRQn);
+  /* DMA1_Channel7_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel7_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
 
 }
 
@@ -458,6 +548,35 @@ static void MX_GPIO_Init(void)
 }
 
 /* USER CODE BEGIN 4 */
+// Timer update (overflow) interrupts: TIM2 extends the SQW edge timestamps, TIM4 the
+// microsecond timebase
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
+{
+  if(htim->Instance == TIM2) sqw_overflow();
+  else if(htim->Instance == TIM4) timebase_overflow();
+}
+
+// B1 (user button) EXTI, rising edge - the button is released
+#define BUTTON_DEBOUNCE_MS 200
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  static uint32_t last_ticks;
+  if(GPIO_Pin != B1_Pin || HAL_GetTick() - last_ticks < BUTTON_DEBOUNCE_MS) return;
+  last_ticks = HAL_GetTick();
+  sched_post(SCHED_EV_BUTTON);
+}
+
+// The USART2 interrupt (TX DMA completion, RX IDLE line) also reports receive errors.
+// HAL stops the RX DMA on an overrun, framing or noise error - restart it so the command
+// line keeps working.
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+  if(huart != &huart2) return;
+  uart_rx_stats.errors++;
+  if(huart->RxState == HAL_UART_STATE_READY) {
+    uart_rx_start();
+  }
+}
 
 /* USER CODE END 4 */
 
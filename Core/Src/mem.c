@@ -0,0 +1,120 @@
+// mem.c, static RAM arena - fixed-size block pools and the boot-time newlib heap
+//
+// There is no general purpose heap.  The linker script reserves _Arena_Size bytes after .bss:
+// * Pools (POOL_DEFINE()) are placed at the start of the arena by the linker.  If they grow
+//   past _Arena_Size the link fails, not the device.  A pool hands out fixed-size blocks of
+//   one type in constant time, from interrupt handlers too, and can't fragment.
+// * The rest of the arena backs _sbrk() (sysmem.c) for newlib, which may allocate during
+//   initialization.  mem_seal() at the end of boot closes it: any later malloc() fails
+//   immediately and is counted, instead of eating into the stack at an unpredictable time.
+//
+// "mem" shows the arena layout, the newlib heap use and each pool's high-water mark.
+
+#include <stdio.h> // printf()
+#include <string.h> // strcmp()
+#include "mem.h"
+#include "command_line.h"
+
+// Linker script symbols
+extern uint8_t _sarena; // arena start
+extern uint8_t _epools; // end of the pools, start of the newlib heap
+extern uint8_t _earena; // arena end
+extern uint8_t _estack;
+extern uint32_t _Min_Stack_Size;
+
+static POOL * pools;           // pool_init() list
+static uint8_t * heap_end;     // newlib heap break
+static uint8_t sealed;         // boot complete, _sbrk() refuses to grow the heap
+static uint32_t heap_refused;  // _sbrk() calls refused
+static uint32_t heap_refused_bytes;
+
+// Build the free list, add the pool to the "mem" list
+void pool_init(POOL * pool)
+{
+	if(pool->next || pools == pool) return; // already initialized
+	pool->free = NULL;
+	for(int i = pool->count - 1; i >= 0; i--) {
+		void ** block = (void **)(pool->blocks + (uint32_t)i * pool->size);
+		*block = pool->free;
+		pool->free = block;
+	}
+	pool->used = 0;
+	pool->next = pools;
+	pools = pool;
+}
+
+// Take a block, NULL if the pool is exhausted
+void * pool_alloc(POOL * pool)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	void ** block = pool->free;
+	if(block) {
+		pool->free = *block;
+		pool->allocs++;
+		if(++pool->used > pool->high_water) pool->high_water = pool->used;
+	} else {
+		pool->failures++;
+	}
+	__set_PRIMASK(primask);
+	return block;
+}
+
+// Return a block to its pool
+void pool_free(POOL * pool, void * block)
+{
+	if(!block) return;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	*(void **)block = pool->free;
+	pool->free = block;
+	pool->used--;
+	__set_PRIMASK(primask);
+}
+
+// End of initialization, newlib heap allocations from now on fail
+void mem_seal(void)
+{
+	sealed = 1;
+}
+
+// _sbrk() for newlib: grow the heap within the arena, until mem_seal()
+// Return the previous break, or NULL if the request can't be met
+void * mem_sbrk(ptrdiff_t incr)
+{
+	if(!heap_end) heap_end = &_epools;
+	if(incr > 0 && (sealed || heap_end + incr > &_earena)) {
+		heap_refused++;
+		heap_refused_bytes += incr;
+		return NULL;
+	}
+	if(heap_end + incr < &_epools) return NULL;
+	uint8_t * prev = heap_end;
+	heap_end += incr;
+	return prev;
+}
+
+// Command line method to display the arena and pools
+int cl_mem(void)
+{
+	uint32_t arena = &_earena - &_sarena;
+	uint32_t pool_bytes = &_epools - &_sarena;
+	uint32_t heap = heap_end ? heap_end - &_epools : 0;
+	printf("Arena: %lu bytes at 0x%08lx, %lu pools, %lu newlib heap, %lu free\n", arena, (uint32_t)&_sarena,
+			pool_bytes, heap, arena - pool_bytes - heap);
+	printf("Stack: %lu bytes reserved below 0x%08lx\n", (uint32_t)&_Min_Stack_Size, (uint32_t)&_estack);
+	printf("Heap:  %s, %lu requests (%lu bytes) refused\n", sealed ? "sealed" : "open (boot)",
+			heap_refused, heap_refused_bytes);
+
+	printf("Pool             Block Count  Used  High  Allocs     Failures\n");
+	uint32_t listed = 0;
+	for(POOL * p = pools; p; p = p->next) {
+		printf("%-16s %5u %5u %5u %5u  %-10lu %lu\n", p->name, p->size, p->count, p->used, p->high_water,
+				p->allocs, p->failures);
+		listed += (uint32_t)p->size * p->count;
+	}
+	// Alignment padding between pools, and pools defined but never initialized
+	if(pool_bytes > listed) printf("%lu pool bytes padding or not initialized\n", pool_bytes - listed);
+	printf("Fixed-size blocks, no fragmentation - the heap only grows during boot\n");
+	return 0;
+}
@@ -0,0 +1,228 @@
+// power.c, STOP mode between minute updates
+//
+// The display changes once a minute, so with "power on" the core spends the time in between
+// in STOP mode (clocks off, RAM and registers kept, TM1637 keeps showing its last frame):
+// * The DS3231 INT/SQW pin is switched from the 1Hz square wave to a once a minute alarm 2
+//   (seconds = 00).  Its falling edge on PA0 wakes the core through EXTI0 in event mode.
+// * A start bit on USART2 RX (PA3) wakes through EXTI3.  Its line is unmasked in EXTI_IMR, so
+//   PR3 records the wake, but the interrupt stays disabled in the NVIC: SEVONPEND turns the
+//   pending interrupt into the wake event.  The character that wakes the core is lost (the UART
+//   has no clock while stopped), then the core stays awake for POWER_AWAKE_MS after the last
+//   received byte so commands can be typed.
+// * B1 wakes through its EXTI13 interrupt (SEVONPEND turns the pending interrupt into an event).
+//
+// After a wake-up SystemClock_Config() restarts HSE and the PLL, and HAL_GetTick() is advanced
+// by the seconds the STM32 RTC (LSE, runs in STOP) counted.  Background jobs, binary protocol
+// sessions, UART output and I2C transfers in progress keep the core out of STOP.
+//
+// The power mode owns the DS3231 Control register (0Eh) while it is on.  The 1Hz SQW edges are
+// gone, so aging offset calibration pauses and the clock reads the time on each alarm instead
+// of staging frames on SQW edges.  Code that borrows INT/SQW ("alarm") hands it back with
+// power_int_restore().
+
+#include <string.h> // strcmp()
+#include "power.h"
+#include "sched.h"
+#include "task.h"
+#include "proto.h"
+#include "uart_rx.h"
+#include "uart_tx.h"
+#include "i2c_queue.h"
+#include "cl_i2c.h"
+#include "DS3231.h"
+#include "DS3231_sqw.h"
+#include "stm32_rtc.h"
+#include "dwt.h"
+#include "command_line.h"
+
+#define POWER_HSI_MHZ 8 // core clock while SystemClock_Config() restores the PLL
+
+extern RTC_HandleTypeDef hrtc; // main.c
+void SystemClock_Config(void); // main.c
+void update_clock(void);       // TM1637_Interface.cpp
+
+POWER_STATS power_stats;
+
+static uint8_t enabled;
+static uint32_t awake_until;   // HAL_GetTick() value before which STOP is not used
+static uint32_t rx_bytes;      // uart_rx_stats.bytes when last checked
+static uint32_t wake_cycles;   // DWT cycles when the PLL was running again
+static uint32_t wake_restore_us;
+static uint32_t awake_us;      // awake time in the current minute
+static uint8_t ran_minute;     // awake_us covers a full minute
+
+// Read-modify-write a DS3231 register
+static HAL_StatusTypeDef power_ds3231_update(uint8_t index, uint8_t clear, uint8_t set)
+{
+	uint8_t value;
+	HAL_StatusTypeDef rc = i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), &value, sizeof(value));
+	if(HAL_OK != rc) return rc;
+	uint8_t index_data[2] = {index, (uint8_t)((value & ~clear) | set)};
+	return i2c_write_read(DS3231_ADDRESS, index_data, sizeof(index_data), NULL, 0);
+}
+
+// INT/SQW as the once a minute alarm 2
+static HAL_StatusTypeDef power_ds3231_alarm(void)
+{
+	// A2M2, A2M3, A2M4 set (registers 0Bh - 0Dh)
+	uint8_t alarm2[4] = {0x0B, 0x80, 0x80, 0x80};
+	HAL_StatusTypeDef rc = i2c_write_read(DS3231_ADDRESS, alarm2, sizeof(alarm2), NULL, 0);
+	if(HAL_OK == rc) rc = power_ds3231_update(0x0F, 0x02, 0x00); // clear A2F
+	if(HAL_OK == rc) rc = power_ds3231_update(0x0E, 0x01, 0x06); // INTCN, A2IE on, A1IE off
+	return rc;
+}
+
+// Turn the power mode on or off
+HAL_StatusTypeDef power_enable(int on)
+{
+	if(on) {
+		HAL_StatusTypeDef rc = power_ds3231_alarm();
+		if(HAL_OK != rc) return rc;
+		// PA0 falling edge as an EXTI event, PA3 falling edge as a pending (NVIC disabled) EXTI
+		// interrupt (AFIO_EXTICR0 port A is the reset value)
+		AFIO->EXTICR[0] &= ~(AFIO_EXTICR1_EXTI0 | AFIO_EXTICR1_EXTI3);
+		EXTI->FTSR |= EXTI_FTSR_FT0 | EXTI_FTSR_FT3;
+		EXTI->EMR |= EXTI_EMR_MR0;
+		EXTI->IMR |= EXTI_IMR_MR3;
+		awake_us = 0;
+		ran_minute = 0;
+		wake_cycles = dwt_cycles();
+		enabled = 1;
+		return HAL_OK;
+	}
+	enabled = 0;
+	EXTI->EMR &= ~EXTI_EMR_MR0;
+	EXTI->IMR &= ~EXTI_IMR_MR3;
+	EXTI->FTSR &= ~(EXTI_FTSR_FT0 | EXTI_FTSR_FT3);
+	EXTI->PR = EXTI_PR_PR3;
+	NVIC_ClearPendingIRQ(EXTI3_IRQn);
+	return sqw_start(); // alarm interrupts off, 1Hz SQW back on
+}
+
+// Return 1 if the power mode is on
+int power_enabled(void)
+{
+	return enabled;
+}
+
+// Hand INT/SQW back after borrowing it: the minute alarm while the power mode is on, else the
+// 1Hz SQW
+HAL_StatusTypeDef power_int_restore(void)
+{
+	return enabled ? power_ds3231_alarm() : sqw_start();
+}
+
+// Return 1 if something still needs the core running
+static int power_busy(void)
+{
+	uint32_t now = HAL_GetTick();
+	if(uart_rx_stats.bytes != rx_bytes || uart_rx_available()) {
+		rx_bytes = uart_rx_stats.bytes;
+		awake_until = now + POWER_AWAKE_MS;
+	}
+	if((int32_t)(now - awake_until) < 0) return 1;
+	return task_count() || proto_active() || uart_tx_busy() || i2c_queue_busy();
+}
+
+// Called by sched_run() with interrupts disabled when there is nothing to do, returns with them disabled.
+// Enter STOP mode if enabled and idle, return 1 if the core was stopped.
+int power_stop(void)
+{
+	if(!enabled || power_busy()) return 0;
+	// INT still asserted - the alarm has not been handled, its edge won't come again
+	if(GPIO_PIN_RESET == HAL_GPIO_ReadPin(DS3231_SQW_GPIO_Port, DS3231_SQW_Pin)) return 0;
+
+	dwt_init();
+	awake_us += (dwt_cycles() - wake_cycles) / (SystemCoreClock / 1000000);
+	uint32_t rtc_before = stm32_rtc_counter();
+	power_stats.stops++;
+
+	HAL_SuspendTick();
+	SCB->SCR |= SCB_SCR_SEVONPEND_Msk;
+	// Console bytes received while awake left PR3 and the EXTI3 NVIC pending bit set.  Clear
+	// both: SEVONPEND only signals the transition to pending.  B1 (PR13) is cleared by its
+	// interrupt handler.
+	EXTI->PR = EXTI_PR_PR0 | EXTI_PR_PR3;
+	NVIC_ClearPendingIRQ(EXTI3_IRQn);
+	HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFE);
+	SCB->SCR &= ~SCB_SCR_SEVONPEND_Msk;
+
+	// Wake source, before the B1 interrupt handler clears PR13
+	uint32_t pr = EXTI->PR;
+	int alarm = GPIO_PIN_RESET == HAL_GPIO_ReadPin(DS3231_SQW_GPIO_Port, DS3231_SQW_Pin);
+
+	// The clock restore and the RTC synchronisation wait on HAL_GetTick() timeouts.  Run them
+	// with SysTick going and interrupts enabled, so an HSE, PLL or RSF failure times out into
+	// Error_Handler() instead of hanging.  Until SystemClock_Config() retunes SysTick a tick is
+	// 9ms (HSI), which only lengthens those timeouts.
+	HAL_ResumeTick();
+	__enable_irq();
+
+	// Running on HSI - restore HSE and the PLL
+	uint32_t start = dwt_cycles();
+	SystemClock_Config();
+	wake_cycles = dwt_cycles();
+	wake_restore_us = (wake_cycles - start) / POWER_HSI_MHZ; // mostly at the HSI rate
+	power_stats.restore_us = wake_restore_us;
+	awake_us += wake_restore_us;
+
+	// Account for the time stopped, whole seconds from the STM32 RTC
+	HAL_RTC_WaitForSynchro(&hrtc);
+	__disable_irq(); // back to the sched_run() contract, uwTick is also written by SysTick
+	uwTick += (stm32_rtc_counter() - rtc_before) * 1000;
+
+	if(alarm) {
+		power_stats.wakes[POWER_WAKE_ALARM]++;
+		sched_post(SCHED_EV_ALARM);
+	} else if(pr & EXTI_PR_PR3) {
+		power_stats.wakes[POWER_WAKE_UART]++;
+		awake_until = HAL_GetTick() + POWER_AWAKE_MS;
+	} else if(pr & EXTI_PR_PR13) {
+		power_stats.wakes[POWER_WAKE_BUTTON]++;
+	} else {
+		power_stats.wakes[POWER_WAKE_OTHER]++;
+	}
+	EXTI->PR = EXTI_PR_PR0 | EXTI_PR_PR3;
+	NVIC_ClearPendingIRQ(EXTI3_IRQn);
+	return 1;
+}
+
+// SCHED_EV_ALARM - the minute changed: acknowledge the alarm, update the display
+void power_alarm(void)
+{
+	power_ds3231_update(0x0F, 0x02, 0x00); // clear A2F, releases INT
+	update_clock();
+	uint32_t display_us = wake_restore_us + (dwt_cycles() - wake_cycles) / (SystemCoreClock / 1000000);
+	power_stats.display_us_last = display_us;
+	if(display_us > power_stats.display_us_max) power_stats.display_us_max = display_us;
+
+	// Close the minute's awake time
+	if(ran_minute) {
+		power_stats.awake_us_last = awake_us;
+		if(awake_us > power_stats.awake_us_max) power_stats.awake_us_max = awake_us;
+	}
+	ran_minute = 1;
+	awake_us = 0;
+}
+
+// Command line method for the power mode
+// power           : display statistics
+// power <on | off> : STOP mode between minute updates
+int cl_power(void)
+{
+	static const char * const names[POWER_WAKE_COUNT] = {"alarm", "uart", "button", "other"};
+	if(argc > 1) {
+		HAL_StatusTypeDef rc = power_enable(strcmp(argv[1], "on") == 0);
+		if(HAL_OK != rc) printf("DS3231 configuration failed: %s\n", PrintHalStatus(rc));
+	}
+	printf("Power mode: %s\n", enabled ? "STOP between minutes" : "off");
+	printf("Stops:      %lu\n", power_stats.stops);
+	printf("Wakes:     ");
+	for(unsigned i = 0; i < POWER_WAKE_COUNT; i++) printf(" %s %lu", names[i], power_stats.wakes[i]);
+	printf("\n");
+	printf("Restore:    %lu us (HSE, PLL)\n", power_stats.restore_us);
+	printf("Awake:      %lu us last minute, %lu us max\n", power_stats.awake_us_last, power_stats.awake_us_max);
+	printf("Wake to display: %lu us last, %lu us max\n", power_stats.display_us_last, power_stats.display_us_max);
+	if(enabled) printf("Console input keeps the core awake for %u s\n", POWER_AWAKE_MS / 1000);
+	return 0;
+}
@@ -0,0 +1,328 @@
+// proto.c, framed binary control protocol alongside the text command line
+//
+// Fleet tooling used to type "time hh mm ss" and scrape the printf() output.  In binary mode
+// each frame carries any number of typed get / set operations and is answered by one response
+// frame with the same sequence number, so a batch of operations costs one round trip.
+// See proto_frame.h for the frame and operation layout.
+//
+// cl_loop() switches to binary mode when it receives two PROTO_SYN characters, then passes
+// every received byte to proto_rx().  PROTO_OP_EXIT, or no frame for PROTO_IDLE_MS, returns
+// to the text command line.  Frames with a bad CRC are dropped without a response - the host
+// retries on a timeout.  Text printed by other code while in binary mode (errors) is skipped
+// by the host decoder while it hunts for SOF.
+
+#include <string.h> // strcmp()
+#include "main.h"
+#include "proto.h"
+#include "proto_frame.h"
+#include "command_line.h"
+#include "cl_i2c.h"
+#include "i2c_queue.h"
+#include "DS3231.h"
+#include "rtc_backend.h"
+#include "timezone.h"
+#include "uart_tx.h"
+#include "fmt.h"
+#include "mem.h"
+
+// TM1637_Interface.cpp
+void clock_set_brightness(uint8_t level, uint8_t on);
+uint8_t clock_brightness(void);
+
+PROTO_STATS proto_stats;
+
+static uint8_t active;          // binary mode
+static uint32_t last_ticks;     // HAL_GetTick() of the last frame, or entering binary mode
+static PROTO_DECODER * rx;      // from frame_pool while in binary mode
+static PROTO_ENCODER * tx;      // response frame
+
+// Frame buffers, only needed in binary mode or during "proto test"
+typedef union {
+	PROTO_DECODER decoder;
+	PROTO_ENCODER encoder;
+} PROTO_FRAME_BUF;
+POOL_DEFINE(frame_pool, PROTO_FRAME_BUF, 3); // decoder and response, + request for "proto test"
+
+static void put_u32(uint8_t * p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t * p)
+{
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Read the time, local time if local is set
+static uint8_t proto_read_time(DATE_TIME * dt, int local)
+{
+	if(HAL_OK != rtc_read(dt)) return PROTO_ERR_DEVICE;
+	if(local) tz_to_local(dt);
+	return PROTO_OK;
+}
+
+// Write a UTC time to the RTCs, the time is valid from now on
+static uint8_t proto_write_time(const DATE_TIME * dt)
+{
+	if(HAL_OK != rtc_write(dt)) return PROTO_ERR_DEVICE;
+	ds3231_clearOSF();
+	return PROTO_OK;
+}
+
+// PROTO_HANDLER: execute one operation, fill in data[] and *len, return the status
+// Argument lengths and ranges are checked by proto_check_request().  ctx: exit flag.
+static uint8_t proto_op(const PROTO_ITEM * req, uint8_t * data, uint8_t * len, void * ctx)
+{
+	const uint8_t * a = req->data;
+	DATE_TIME dt;
+	uint8_t status;
+
+	*len = 0;
+	switch(req->op) {
+	case PROTO_OP_GET_TIME:
+		if(PROTO_OK != (status = proto_read_time(&dt, 1))) return status;
+		data[0] = dt.hh; data[1] = dt.mm; data[2] = dt.ss;
+		*len = 3;
+		return PROTO_OK;
+	case PROTO_OP_SET_TIME:
+		if(PROTO_OK != (status = proto_read_time(&dt, 1))) return status;
+		dt.hh = a[0]; dt.mm = a[1]; dt.ss = a[2];
+		tz_to_utc(&dt);
+		return proto_write_time(&dt);
+	case PROTO_OP_GET_DATE:
+		if(PROTO_OK != (status = proto_read_time(&dt, 1))) return status;
+		data[0] = dt.d; data[1] = dt.m; data[2] = dt.yOff;
+		*len = 3;
+		return PROTO_OK;
+	case PROTO_OP_SET_DATE:
+		if(PROTO_OK != (status = proto_read_time(&dt, 1))) return status;
+		dt.d = a[0]; dt.m = a[1]; dt.yOff = a[2];
+		tz_to_utc(&dt);
+		return proto_write_time(&dt);
+	case PROTO_OP_GET_UNIX:
+		if(PROTO_OK != (status = proto_read_time(&dt, 0))) return status;
+		put_u32(data, rtc2unix(&dt));
+		*len = 4;
+		return PROTO_OK;
+	case PROTO_OP_SET_UNIX:
+		unix2rtc(&dt, get_u32(a));
+		return proto_write_time(&dt);
+	case PROTO_OP_GET_BRIGHT: {
+		uint8_t brightness = clock_brightness(); // one read, level and on/off agree
+		data[0] = brightness & 0x07;
+		data[1] = (brightness & 0x08) != 0;
+		*len = 2;
+		return PROTO_OK;
+	}
+	case PROTO_OP_SET_BRIGHT:
+		clock_set_brightness(a[0], a[1]);
+		return PROTO_OK;
+	case PROTO_OP_READ_REG: {
+		uint8_t reg = a[1];
+		if(a[0] < I2C_ADDRESS_MIN || a[0] > I2C_ADDRESS_MAX) return PROTO_ERR_ARG;
+		if(HAL_OK != i2c_write_read_prio(I2C_PRIO_NORMAL, a[0], &reg, 1, data, a[2]))
+			return PROTO_ERR_DEVICE;
+		*len = a[2];
+		return PROTO_OK;
+	}
+	case PROTO_OP_GET_STATS: {
+		const uint32_t stats[PROTO_STATS_COUNT] = {
+			i2c_stats.transactions, i2c_stats.errors, i2c_stats.bytes,
+			uart_tx_stats.bytes, uart_tx_stats.dropped,
+			proto_stats.frames, proto_stats.bad_crc + proto_stats.bad_len,
+		};
+		for(unsigned i = 0; i < PROTO_STATS_COUNT; i++) put_u32(&data[i * 4], stats[i]);
+		*len = sizeof(stats);
+		return PROTO_OK;
+	}
+	case PROTO_OP_EXIT:
+		*(uint8_t *)ctx = 1;
+		return PROTO_OK;
+	default:
+		return PROTO_ERR_OP;
+	}
+}
+
+// Execute the operations of a request payload, build the response frame in out
+// Return 1 if the request asked to leave binary mode.
+static uint8_t proto_execute(const uint8_t * payload, uint8_t len, uint8_t seq, PROTO_ENCODER * out)
+{
+	uint8_t exit = 0;
+	proto_stats.ops += proto_serve(payload, len, seq, out, proto_op, &exit);
+	return exit;
+}
+
+// Leave binary mode, show the text prompt again
+static void proto_leave(void)
+{
+	active = 0;
+	pool_free(&frame_pool, rx);
+	pool_free(&frame_pool, tx);
+	printf("\n>");
+}
+
+void proto_init(void)
+{
+	pool_init(&frame_pool);
+}
+
+// Switch to binary mode (cl_loop() received the PROTO_SYN sequence)
+void proto_enter(void)
+{
+	PROTO_FRAME_BUF * r = POOL_ALLOC(frame_pool, PROTO_FRAME_BUF);
+	PROTO_FRAME_BUF * t = POOL_ALLOC(frame_pool, PROTO_FRAME_BUF);
+	if(!r || !t) {
+		pool_free(&frame_pool, r);
+		pool_free(&frame_pool, t);
+		printf("No frame buffers, binary mode not available\n");
+		return;
+	}
+	rx = &r->decoder;
+	tx = &t->encoder;
+	active = 1;
+	last_ticks = HAL_GetTick();
+	proto_decoder_reset(rx);
+	proto_stats.sessions++;
+}
+
+int proto_active(void)
+{
+	return active;
+}
+
+// Process a byte received in binary mode
+void proto_rx(uint8_t c)
+{
+	if(!active) return;
+	switch(proto_decode(rx, c)) {
+	case PROTO_FRAME: {
+		last_ticks = HAL_GetTick();
+		proto_stats.frames++;
+		uint8_t exit = proto_execute(rx->payload, rx->len, rx->seq, tx);
+		uart_tx_write(tx->buf, tx->len);
+		if(exit) proto_leave();
+		break;
+	}
+	case PROTO_BAD_CRC:
+		proto_stats.bad_crc++;
+		break;
+	case PROTO_BAD_LEN:
+		proto_stats.bad_len++;
+		break;
+	default:
+		break;
+	}
+}
+
+// Called while no bytes are arriving - return to the text command line after PROTO_IDLE_MS
+void proto_poll(void)
+{
+	if(active && HAL_GetTick() - last_ticks >= PROTO_IDLE_MS) {
+		proto_stats.timeouts++;
+		proto_leave();
+	}
+}
+
+// Loopback test: encode a pipelined request the way host tooling does, pass it through the
+// frame decoder and the operation handlers, then decode and check the response frame.
+// Read-only operations, the time and display are not changed.
+static int proto_loopback_run(PROTO_ENCODER * req, PROTO_DECODER * dec, PROTO_ENCODER * rsp)
+{
+	static const uint8_t ds3231_status[3] = {DS3231_ADDRESS, 0x0E, 2};
+	static const uint8_t bad_bright[2] = {9, 1};
+	static const uint8_t bad_date[3] = {31, 4, 26}; // April 31st
+	static const uint8_t expect[][2] = { // op, status
+		{PROTO_OP_GET_TIME, PROTO_OK}, {PROTO_OP_GET_DATE, PROTO_OK}, {PROTO_OP_GET_UNIX, PROTO_OK},
+		{PROTO_OP_GET_BRIGHT, PROTO_OK}, {PROTO_OP_READ_REG, PROTO_OK}, {PROTO_OP_GET_STATS, PROTO_OK},
+		{PROTO_OP_SET_BRIGHT, PROTO_ERR_ARG}, {PROTO_OP_SET_DATE, PROTO_ERR_ARG}, {0x55, PROTO_ERR_OP},
+	};
+	const uint8_t seq = 0x3C;
+	int fail = 0;
+
+	proto_encode_begin(req, seq);
+	proto_encode_request(req, PROTO_OP_GET_TIME, NULL, 0);
+	proto_encode_request(req, PROTO_OP_GET_DATE, NULL, 0);
+	proto_encode_request(req, PROTO_OP_GET_UNIX, NULL, 0);
+	proto_encode_request(req, PROTO_OP_GET_BRIGHT, NULL, 0);
+	proto_encode_request(req, PROTO_OP_READ_REG, ds3231_status, sizeof(ds3231_status));
+	proto_encode_request(req, PROTO_OP_GET_STATS, NULL, 0);
+	proto_encode_request(req, PROTO_OP_SET_BRIGHT, bad_bright, sizeof(bad_bright)); // out of range
+	proto_encode_request(req, PROTO_OP_SET_DATE, bad_date, sizeof(bad_date)); // not a date
+	proto_encode_request(req, 0x55, NULL, 0); // unknown operation, skipped
+	uint16_t req_len = proto_encode_end(req);
+
+	// A corrupted copy must be rejected
+	PROTO_RESULT result = PROTO_MORE;
+	proto_decoder_reset(dec);
+	for(uint16_t i = 0; i < req_len; i++)
+		result = proto_decode(dec, req->buf[i] ^ (i == 5 ? 0x01 : 0x00));
+	if(PROTO_BAD_CRC != result) { printf("Corrupted frame not rejected\n"); fail++; }
+
+	// Leading noise (text output) is skipped, then the request decodes
+	proto_decode(dec, '>');
+	for(uint16_t i = 0; i < req_len; i++)
+		result = proto_decode(dec, req->buf[i]);
+	if(PROTO_FRAME != result || dec->seq != seq) { printf("Request frame not decoded\n"); return 1; }
+	uint32_t start_us = TIM4->CNT;
+	proto_execute(dec->payload, dec->len, dec->seq, rsp);
+	uint16_t exec_us = (uint16_t)(TIM4->CNT - start_us);
+
+	// Decode the response frame
+	for(uint16_t i = 0; i < rsp->len; i++)
+		result = proto_decode(dec, rsp->buf[i]);
+	if(PROTO_FRAME != result || dec->seq != seq) { printf("Response frame not decoded\n"); return 1; }
+
+	PROTO_ITEM item;
+	uint8_t pos = 0;
+	unsigned n = 0;
+	while(proto_next_response(dec->payload, dec->len, &pos, &item)) {
+		FMT f;
+		fmt_begin(&f);
+		fmt_x(&f, item.op, 2); fmt_str(&f, " status ");
+		fmt_u(&f, item.status, 0, 0); fmt_str(&f, " data");
+		for(uint8_t i = 0; i < item.len; i++) { fmt_char(&f, ' '); fmt_x(&f, item.data[i], 2); }
+		if(n >= sizeof(expect) / sizeof(expect[0]) || item.op != expect[n][0] || item.status != expect[n][1]) {
+			fmt_str(&f, "  <- unexpected");
+			fail++;
+		}
+		fmt_char(&f, '\n');
+		fmt_end(&f);
+		n++;
+	}
+	if(n != sizeof(expect) / sizeof(expect[0])) { printf("%u operations in response\n", n); fail++; }
+	printf("Request %u bytes, response %u bytes, executed in %u us\n", req_len, rsp->len, exec_us);
+	printf("Loopback %s\n", fail ? "FAILED" : "passed");
+	return fail != 0;
+}
+
+// Run the loopback test with frame buffers from the pool
+static int proto_loopback(void)
+{
+	PROTO_FRAME_BUF * bufs[3];
+	for(unsigned i = 0; i < 3; i++) bufs[i] = POOL_ALLOC(frame_pool, PROTO_FRAME_BUF);
+	int rc = 1;
+	if(bufs[0] && bufs[1] && bufs[2]) rc = proto_loopback_run(&bufs[0]->encoder, &bufs[1]->decoder, &bufs[2]->encoder);
+	else printf("No frame buffers\n");
+	for(unsigned i = 0; i < 3; i++) pool_free(&frame_pool, bufs[i]);
+	return rc;
+}
+
+// Command line method for the binary protocol
+// proto       : display statistics
+// proto test  : loopback test of the frame encoder, decoder and operation handlers
+int cl_proto(void)
+{
+	if(argc > 1 && strcmp(argv[1], "test") == 0) return proto_loopback();
+	printf("Enter binary mode with 0x%02X 0x%02X, leave with op 0x%02X or %u ms idle\n",
+			PROTO_SYN, PROTO_SYN, PROTO_OP_EXIT, PROTO_IDLE_MS);
+	printf("Sessions:  %lu\n", proto_stats.sessions);
+	printf("Frames:    %lu\n", proto_stats.frames);
+	printf("Ops:       %lu\n", proto_stats.ops);
+	printf("Bad CRC:   %lu\n", proto_stats.bad_crc);
+	printf("Bad len:   %lu\n", proto_stats.bad_len);
+	printf("Timeouts:  %lu\n", proto_stats.timeouts);
+	return 0;
+}
@@ -0,0 +1,225 @@
+// proto_frame.c, framed binary control protocol - frame and operation encoding
+//
+// Shared by the firmware and host tooling, see proto_frame.h for the frame layout.
+// Host example, read the time and the DS3231 control/status registers in one round trip:
+//   PROTO_ENCODER e;
+//   uint8_t reg[3] = {0x68, 0x0E, 2};
+//   proto_encode_begin(&e, seq);
+//   proto_encode_request(&e, PROTO_OP_GET_TIME, NULL, 0);
+//   proto_encode_request(&e, PROTO_OP_READ_REG, reg, sizeof(reg));
+//   write(fd, e.buf, proto_encode_end(&e));
+//   ... feed received bytes to proto_decode() until PROTO_FRAME, then proto_next_response()
+
+#include <string.h> // memcpy()
+#include "proto_frame.h"
+
+enum {
+	PROTO_HUNT, // waiting for SOF
+	PROTO_LEN,
+	PROTO_SEQ,
+	PROTO_PAYLOAD,
+	PROTO_CRC_LO,
+	PROTO_CRC_HI,
+};
+
+#define PROTO_HEADER 3 // SOF, LEN, SEQ
+
+// CRC-16/CCITT-FALSE: polynomial 0x1021, initial value 0xFFFF, no reflection
+// Bitwise - frames are short, a 512 byte table isn't worth the flash
+uint16_t proto_crc16(uint16_t crc, const uint8_t * data, uint16_t len)
+{
+	while(len--) {
+		crc ^= (uint16_t)*data++ << 8;
+		for(int i = 0; i < 8; i++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+void proto_decoder_reset(PROTO_DECODER * d)
+{
+	d->state = PROTO_HUNT;
+}
+
+// Feed one received byte to the decoder.  After PROTO_FRAME, d->len, d->seq and d->payload
+// hold the frame until the next call.  Errors return to hunting for SOF.
+PROTO_RESULT proto_decode(PROTO_DECODER * d, uint8_t c)
+{
+	switch(d->state) {
+	case PROTO_HUNT:
+		if(PROTO_SOF == c) d->state = PROTO_LEN;
+		break;
+	case PROTO_LEN:
+		if(!c || c > PROTO_PAYLOAD_MAX) {
+			d->state = PROTO_HUNT;
+			return PROTO_BAD_LEN;
+		}
+		d->len = c;
+		d->crc = proto_crc16(0xFFFF, &c, 1);
+		d->state = PROTO_SEQ;
+		break;
+	case PROTO_SEQ:
+		d->seq = c;
+		d->crc = proto_crc16(d->crc, &c, 1);
+		d->pos = 0;
+		d->state = PROTO_PAYLOAD;
+		break;
+	case PROTO_PAYLOAD:
+		d->payload[d->pos++] = c;
+		if(d->pos == d->len) {
+			d->crc = proto_crc16(d->crc, d->payload, d->len);
+			d->state = PROTO_CRC_LO;
+		}
+		break;
+	case PROTO_CRC_LO:
+		d->crc ^= c;
+		d->state = PROTO_CRC_HI;
+		break;
+	default: // PROTO_CRC_HI
+		d->state = PROTO_HUNT;
+		d->crc ^= (uint16_t)c << 8;
+		return d->crc ? PROTO_BAD_CRC : PROTO_FRAME;
+	}
+	return PROTO_MORE;
+}
+
+// Start a frame - operations are added with proto_encode_request() / proto_encode_response()
+void proto_encode_begin(PROTO_ENCODER * e, uint8_t seq)
+{
+	e->buf[0] = PROTO_SOF;
+	e->buf[1] = 0;
+	e->buf[2] = seq;
+	e->len = PROTO_HEADER;
+}
+
+// Payload bytes still available
+uint16_t proto_encode_room(const PROTO_ENCODER * e)
+{
+	return PROTO_HEADER + PROTO_PAYLOAD_MAX - e->len;
+}
+
+// Append a request operation, return 0 if it doesn't fit
+int proto_encode_request(PROTO_ENCODER * e, uint8_t op, const uint8_t * args, uint8_t len)
+{
+	if(proto_encode_room(e) < 2U + len) return 0;
+	e->buf[e->len++] = op;
+	e->buf[e->len++] = len;
+	if(len) memcpy(&e->buf[e->len], args, len);
+	e->len += len;
+	return 1;
+}
+
+// Append a response operation, return 0 if it doesn't fit
+int proto_encode_response(PROTO_ENCODER * e, uint8_t op, uint8_t status, const uint8_t * data, uint8_t len)
+{
+	if(proto_encode_room(e) < 3U + len) return 0;
+	e->buf[e->len++] = op;
+	e->buf[e->len++] = status;
+	e->buf[e->len++] = len;
+	if(len) memcpy(&e->buf[e->len], data, len);
+	e->len += len;
+	return 1;
+}
+
+// Fill in LEN and the CRC, return the frame size in bytes (e->buf)
+uint16_t proto_encode_end(PROTO_ENCODER * e)
+{
+	e->buf[1] = (uint8_t)(e->len - PROTO_HEADER);
+	uint16_t crc = proto_crc16(0xFFFF, &e->buf[1], e->len - 1);
+	e->buf[e->len++] = (uint8_t)crc;
+	e->buf[e->len++] = (uint8_t)(crc >> 8);
+	return e->len;
+}
+
+// Take the next request operation from a payload, starting at *pos
+// Return 0 at the end of the payload or if the operation is truncated
+int proto_next_request(const uint8_t * payload, uint8_t len, uint8_t * pos, PROTO_ITEM * item)
+{
+	if(*pos + 2U > len) return 0;
+	item->op = payload[*pos];
+	item->status = PROTO_OK;
+	item->len = payload[*pos + 1];
+	item->data = &payload[*pos + 2];
+	if(*pos + 2U + item->len > len) return 0;
+	*pos += 2 + item->len;
+	return 1;
+}
+
+// Take the next response operation from a payload, starting at *pos
+// Return 0 at the end of the payload or if the operation is truncated
+int proto_next_response(const uint8_t * payload, uint8_t len, uint8_t * pos, PROTO_ITEM * item)
+{
+	if(*pos + 3U > len) return 0;
+	item->op = payload[*pos];
+	item->status = payload[*pos + 1];
+	item->len = payload[*pos + 2];
+	item->data = &payload[*pos + 3];
+	if(*pos + 3U + item->len > len) return 0;
+	*pos += 3 + item->len;
+	return 1;
+}
+
+// Check the argument length and ranges of a request operation, return PROTO_OK or PROTO_ERR_ARG.
+// Unknown operations pass, the handler answers them.
+uint8_t proto_check_request(const PROTO_ITEM * req)
+{
+	static const uint8_t arg_len[] = {
+		[PROTO_OP_SET_TIME] = 3, [PROTO_OP_SET_DATE] = 3, [PROTO_OP_SET_UNIX] = 4,
+		[PROTO_OP_SET_BRIGHT] = 2, [PROTO_OP_READ_REG] = 3,
+	};
+	static const uint8_t days_in_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	const uint8_t * a = req->data;
+
+	if(req->op && req->op < sizeof(arg_len) && req->len != arg_len[req->op]) return PROTO_ERR_ARG;
+	switch(req->op) {
+	case PROTO_OP_SET_TIME:
+		if(a[0] > 23 || a[1] > 59 || a[2] > 59) return PROTO_ERR_ARG;
+		break;
+	case PROTO_OP_SET_DATE: // d m y, y: 2000 - 2099, every 4th year is a leap year
+		if(a[1] < 1 || a[1] > 12 || a[2] > 99) return PROTO_ERR_ARG;
+		if(a[0] < 1 || a[0] > days_in_month[a[1] - 1] + (a[1] == 2 && a[2] % 4 == 0)) return PROTO_ERR_ARG;
+		break;
+	case PROTO_OP_SET_BRIGHT:
+		if(a[0] > 7 || a[1] > 1) return PROTO_ERR_ARG;
+		break;
+	case PROTO_OP_READ_REG:
+		if(!a[2] || a[2] > PROTO_DATA_MAX) return PROTO_ERR_ARG;
+		break;
+	default:
+		break;
+	}
+	return PROTO_OK;
+}
+
+// Execute the operations of a request payload with handler, build the response frame in out.
+// A truncated operation is answered with PROTO_ERR_ARG.  An operation that might not fit in the
+// response is answered with PROTO_ERR_ROOM, and it and the rest of the request are not executed.
+// Either way the response holds at least one operation - a LEN of 0 would not decode.
+// Return the number of operations executed.
+uint8_t proto_serve(const uint8_t * payload, uint8_t len, uint8_t seq, PROTO_ENCODER * out,
+		PROTO_HANDLER handler, void * ctx)
+{
+	uint8_t data[PROTO_DATA_MAX];
+	uint8_t pos = 0;
+	uint8_t ops = 0;
+	PROTO_ITEM req;
+
+	proto_encode_begin(out, seq);
+	while(pos < len) {
+		if(!proto_next_request(payload, len, &pos, &req)) {
+			proto_encode_response(out, payload[pos], PROTO_ERR_ARG, NULL, 0);
+			break;
+		}
+		if(proto_encode_room(out) < 3 + PROTO_DATA_MAX) { // at least one operation is in out
+			proto_encode_response(out, req.op, PROTO_ERR_ROOM, NULL, 0);
+			break;
+		}
+		uint8_t data_len = 0;
+		uint8_t status = proto_check_request(&req);
+		if(PROTO_OK == status) status = handler(&req, data, &data_len, ctx);
+		proto_encode_response(out, req.op, status, data, data_len);
+		ops++;
+	}
+	proto_encode_end(out);
+	return ops;
+}
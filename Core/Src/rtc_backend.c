@@ -0,0 +1,172 @@
+// rtc_backend.c, RTC backend interface - DS3231 and STM32 internal RTC
+//
+// Two sources of time are available:
+// * DS3231 - temperature compensated, battery backed, but each read is an I2C transaction
+// * STM32 internal RTC - LSE clocked 32-bit counter, read in a few microseconds
+//
+// rtc_read() uses the cheapest healthy backend, failing over to the next one if a read fails.
+// rtc_write() sets all backends.  rtc_task() periodically re-probes unhealthy backends and
+// cross-checks healthy ones, re-syncing the internal RTC from the DS3231 when they disagree.
+//
+// Note: The minute roll-over (clock_sqw_edge) queues a DS3231 read directly.  The SQW edge that
+// triggers it comes from the DS3231, so it is the only backend guaranteed to be in phase.
+
+#include "main.h" // HAL error definitions
+#include <stdio.h> // printf()
+#include <string.h> // strcmp()
+#include "rtc_backend.h"
+#include "DS3231.h"
+#include "stm32_rtc.h"
+#include "command_line.h"
+#include "timezone.h"
+#include "version.h"
+
+// Most accurate first - the cross-check copies the first healthy backend to the others
+static RTC_BACKEND backends[] = {
+	{"DS3231", read_ds3231,    write_ds3231,    ds3231_check,    1000},
+	{"STM32",  stm32_rtc_read, stm32_rtc_write, stm32_rtc_check, 20},
+};
+#define RTC_BACKEND_CNT (sizeof(backends) / sizeof(backends[0]))
+
+static uint32_t crosscheck_ticks;
+static uint32_t probe_ticks;
+static uint32_t resyncs; // internal RTC corrections made by the cross-check
+static uint8_t build_time_loaded; // boot sanity check set the RTCs to the build time
+
+// Read a backend, updating its cost estimate and health
+static HAL_StatusTypeDef rtc_backend_read(RTC_BACKEND * be, DATE_TIME * dt)
+{
+	uint16_t start_us = TIM4->CNT; // TIM4 counts microseconds
+	HAL_StatusTypeDef rc = be->read(dt);
+	uint16_t elapsed_us = TIM4->CNT - start_us;
+	be->reads++;
+	if(HAL_OK != rc) {
+		be->failures++;
+		be->healthy = 0;
+		return rc;
+	}
+	be->cost_us += ((int32_t)elapsed_us - (int32_t)be->cost_us) / 8; // smooth, 1/8 weight
+	return rc;
+}
+
+// Sanity check the time against the firmware build time (fw_build, a constant in flash).
+// No valid time (DS3231 OSF set, internal RTC never set) or a time earlier than the build
+// means the RTCs lost their time - load the build time, the best estimate available.
+static void rtc_check_build_time(void)
+{
+	DATE_TIME dt;
+	uint32_t build_utc = tz_utc(fw_build.unix_local);
+	if(HAL_OK == rtc_read(&dt) && rtc2unix(&dt) >= build_utc) return;
+	printf("RTC time invalid or earlier than the firmware build, loading build time\n");
+	unix2rtc(&dt, build_utc);
+	rtc_write(&dt);
+	if(backends[0].healthy) ds3231_clearOSF(); // DS3231 time is valid again
+	build_time_loaded = 1;
+}
+
+// Check each backend, copy reference time to any healthy backend that has no valid time
+void rtc_init(void)
+{
+	for(unsigned i = 0; i < RTC_BACKEND_CNT; i++)
+		backends[i].healthy = (HAL_OK == backends[i].check());
+	rtc_task(); // initial cross-check
+	rtc_check_build_time();
+}
+
+// Read the time from the cheapest healthy backend
+HAL_StatusTypeDef rtc_read(DATE_TIME * dt)
+{
+	HAL_StatusTypeDef rc = HAL_ERROR;
+	uint8_t tried = 0; // bit mask of backends tried
+	for(;;) {
+		RTC_BACKEND * best = NULL;
+		for(unsigned i = 0; i < RTC_BACKEND_CNT; i++) {
+			if(!backends[i].healthy || (tried & (1 << i))) continue;
+			if(!best || backends[i].cost_us < best->cost_us) best = &backends[i];
+		}
+		if(!best) return rc; // no healthy backend left
+		tried |= 1 << (best - backends);
+		rc = rtc_backend_read(best, dt);
+		if(HAL_OK == rc) return rc;
+	}
+}
+
+// Set the time of all backends
+// Return the status of the first backend that failed, else HAL_OK
+HAL_StatusTypeDef rtc_write(const DATE_TIME * dt)
+{
+	HAL_StatusTypeDef status = HAL_OK;
+	for(unsigned i = 0; i < RTC_BACKEND_CNT; i++) {
+		HAL_StatusTypeDef rc = backends[i].write(dt);
+		backends[i].healthy = (HAL_OK == rc);
+		if(HAL_OK != rc) {
+			backends[i].failures++;
+			if(HAL_OK == status) status = rc;
+		}
+	}
+	return status;
+}
+
+// Periodic maintenance, called from the superloop
+void rtc_task(void)
+{
+	uint32_t now = HAL_GetTick();
+
+	// Re-probe unhealthy backends (device reconnected, or time set)
+	if(now - probe_ticks >= RTC_PROBE_MS) {
+		probe_ticks = now;
+		for(unsigned i = 0; i < RTC_BACKEND_CNT; i++)
+			if(!backends[i].healthy) backends[i].healthy = (HAL_OK == backends[i].check());
+	}
+
+	if(crosscheck_ticks && now - crosscheck_ticks < RTC_CROSSCHECK_MS) return;
+	crosscheck_ticks = now ? now : 1;
+
+	// Compare each backend with the reference (first healthy backend)
+	RTC_BACKEND * ref = NULL;
+	DATE_TIME ref_dt;
+	for(unsigned i = 0; i < RTC_BACKEND_CNT; i++) {
+		if(!backends[i].healthy) continue;
+		if(!ref) {
+			if(HAL_OK == rtc_backend_read(&backends[i], &ref_dt)) ref = &backends[i];
+			continue;
+		}
+		DATE_TIME dt;
+		if(HAL_OK == rtc_backend_read(&backends[i], &dt)) {
+			int32_t skew = (int32_t)(rtc2seconds(&dt) - rtc2seconds(&ref_dt));
+			if(skew <= RTC_MAX_SKEW_S && skew >= -RTC_MAX_SKEW_S) continue;
+		}
+		// Read failed or out of tolerance
+		if(HAL_OK == backends[i].write(&ref_dt)) resyncs++;
+	}
+	// A backend without valid time (never set, oscillator stopped) is loaded from the reference
+	if(ref) {
+		for(unsigned i = 0; i < RTC_BACKEND_CNT; i++) {
+			if(backends[i].healthy || HAL_OK == backends[i].check()) continue;
+			if(HAL_OK == backends[i].write(&ref_dt)) {
+				backends[i].healthy = 1;
+				resyncs++;
+			}
+		}
+	}
+}
+
+// Command line method to display RTC backend status
+// rtc       : display backends
+// rtc sync  : force a cross-check now
+int cl_rtc(void)
+{
+	if(argc > 1 && strcmp(argv[1], "sync") == 0) {
+		crosscheck_ticks = 0;
+		rtc_task();
+	}
+	printf("Backend  Health   Cost(us) Reads      Failures\n");
+	for(unsigned i = 0; i < RTC_BACKEND_CNT; i++) {
+		RTC_BACKEND * be = &backends[i];
+		printf("%-8s %-8s %-8lu %-10lu %lu\n", be->name, be->healthy ? "ok" : "FAILED",
+				be->cost_us, be->reads, be->failures);
+	}
+	printf("Resyncs: %lu\n", resyncs);
+	if(build_time_loaded) printf("Time was loaded from the firmware build time at boot\n");
+	return 0;
+}
@@ -0,0 +1,163 @@
+// sched.c, event driven superloop - handlers run on interrupt events and timer deadlines,
+// the core sleeps (WFI) in between
+//
+// The superloop used to call every task on every pass, checking HAL_GetTick() deltas, so the
+// core was never idle.  Now:
+// * Interrupt handlers post events (sched_post()), which run the handler registered with
+//   sched_on() on the next pass.  The post time is recorded to measure wake-up latency.
+// * Periodic work registers with sched_every() and runs when its deadline passes.  There are
+//   only a handful of timers, the earliest deadline is found with a linear scan.
+// * Background jobs (task.c) get a slice each pass.
+// * With no event pending, no timer due and no job asking to continue, the core waits in WFI
+//   for the next interrupt.  Interrupts are masked from the check to the WFI, so an event
+//   posted in between still wakes the core (a pending interrupt ends WFI even when masked).
+//
+// SysTick (HAL_GetTick()) and the TIM2 overflow count for the SQW timestamps keep interrupting
+// at ~1kHz, so the loop is not truly tickless - those wake-ups find nothing to do and go back
+// to sleep within a few microseconds.  See "sched" for the measured idle time.
+// With "power on", idle periods use STOP mode instead of WFI (power.c).
+
+#include <string.h> // strcmp(), memset()
+#include "sched.h"
+#include "task.h"
+#include "dwt.h"
+#include "power.h"
+#include "command_line.h"
+
+typedef struct {
+	const char * name;
+	void (*handler)(void);
+	uint32_t period_ms;
+	uint32_t due;       // HAL_GetTick() value of the next run
+	uint32_t runs;
+} SCHED_TIMER;
+
+typedef struct {
+	uint32_t count;      // events handled
+	uint64_t latency;    // total post to handler latency, cycles
+	uint32_t latency_max;
+} SCHED_EVENT_STATS;
+
+static volatile uint32_t pending;                 // bit per SCHED_EVENT
+static volatile uint32_t posted[SCHED_EV_COUNT];  // DWT cycles at the first post
+static void (*handlers[SCHED_EV_COUNT])(void);
+static SCHED_EVENT_STATS ev_stats[SCHED_EV_COUNT];
+static SCHED_TIMER timers[SCHED_TIMER_MAX];
+static uint8_t timer_count;
+
+static uint32_t stats_ticks;  // HAL_GetTick() when statistics were cleared
+static uint64_t idle_us;      // time spent in WFI
+static uint32_t sleeps;       // WFI count
+
+static const char * const ev_names[SCHED_EV_COUNT] = {"uart rx", "sqw", "i2c", "button", "alarm"};
+
+void sched_init(void)
+{
+	dwt_init();
+	stats_ticks = HAL_GetTick();
+}
+
+// Post an event, normally from an interrupt handler
+void sched_post(SCHED_EVENT ev)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(!(pending & (1UL << ev))) {
+		posted[ev] = dwt_cycles();
+		pending |= 1UL << ev;
+	}
+	__set_PRIMASK(primask);
+}
+
+// Run handler on the next pass after ev is posted
+void sched_on(SCHED_EVENT ev, void (*handler)(void))
+{
+	handlers[ev] = handler;
+}
+
+// Run handler every period_ms, first run on the next pass
+void sched_every(const char * name, void (*handler)(void), uint32_t period_ms)
+{
+	if(timer_count >= SCHED_TIMER_MAX) return;
+	timers[timer_count++] = (SCHED_TIMER){name, handler, period_ms, HAL_GetTick(), 0};
+}
+
+// Run the handlers of pending events
+static void sched_events(void)
+{
+	while(pending) {
+		unsigned ev = __builtin_ctz(pending);
+		__disable_irq();
+		pending &= ~(1UL << ev);
+		uint32_t latency = dwt_cycles() - posted[ev];
+		__enable_irq();
+		ev_stats[ev].count++;
+		ev_stats[ev].latency += latency;
+		if(latency > ev_stats[ev].latency_max) ev_stats[ev].latency_max = latency;
+		if(handlers[ev]) handlers[ev]();
+	}
+}
+
+// Run the timers that are due, return 1 if one is still due (handler took a while)
+static int sched_timers(void)
+{
+	int due = 0;
+	for(unsigned i = 0; i < timer_count; i++) {
+		SCHED_TIMER * t = &timers[i];
+		if((int32_t)(HAL_GetTick() - t->due) < 0) continue;
+		t->due += t->period_ms;
+		if((int32_t)(HAL_GetTick() - t->due) >= 0) t->due = HAL_GetTick() + t->period_ms; // fell behind, don't catch up
+		t->runs++;
+		t->handler();
+	}
+	for(unsigned i = 0; i < timer_count; i++)
+		if((int32_t)(HAL_GetTick() - timers[i].due) >= 0) due = 1;
+	return due;
+}
+
+// One superloop pass - dispatch, then sleep if there is nothing left to do
+void sched_run(void)
+{
+	sched_events();
+	int busy = sched_timers();
+	busy |= task_run(); // a job yielded, wants the next pass right away
+
+	__disable_irq();
+	if(!busy && !pending && !power_stop()) {
+		uint16_t start_us = TIM4->CNT; // TIM4 counts microseconds, and runs in sleep mode
+		__WFI();
+		idle_us += (uint16_t)(TIM4->CNT - start_us);
+		sleeps++;
+	}
+	__enable_irq(); // service the interrupt that ended WFI
+}
+
+// Command line method to display idle time, event latency and timers
+// sched        : display statistics
+// sched reset  : clear statistics
+int cl_sched(void)
+{
+	if(argc > 1 && strcmp(argv[1], "reset") == 0) {
+		__disable_irq();
+		memset(ev_stats, 0, sizeof(ev_stats));
+		idle_us = 0;
+		sleeps = 0;
+		stats_ticks = HAL_GetTick();
+		__enable_irq();
+		return 0;
+	}
+	uint32_t elapsed_ms = HAL_GetTick() - stats_ticks;
+	uint32_t per_us = SystemCoreClock / 1000000;
+	uint32_t idle_permille = elapsed_ms ? (uint32_t)(idle_us / elapsed_ms) : 0; // us per ms = 1/1000
+	printf("Idle: %lu.%lu%% of %lu ms, %lu sleeps\n", idle_permille / 10, idle_permille % 10, elapsed_ms, sleeps);
+	printf("Event    Count      Avg latency(us) Max latency(us)\n");
+	for(unsigned i = 0; i < SCHED_EV_COUNT; i++) {
+		SCHED_EVENT_STATS * s = &ev_stats[i];
+		printf("%-8s %-10lu %-15lu %lu\n", ev_names[i], s->count,
+				s->count ? (uint32_t)(s->latency / s->count / per_us) : 0, s->latency_max / per_us);
+	}
+	printf("Timer    Period(ms) Runs\n");
+	for(unsigned i = 0; i < timer_count; i++)
+		printf("%-8s %-10lu %lu\n", timers[i].name, timers[i].period_ms, timers[i].runs);
+	return 0;
+}
@@ -0,0 +1,64 @@
+// stm32_rtc.c, STM32F103 internal RTC (LSE clocked) used as a DATE_TIME clock
+//
+// The F1 RTC is a 32-bit seconds counter.  The HAL's HAL_RTC_GetTime()/HAL_RTC_SetDate() layer
+// keeps the date in RAM, losing it on reset.  Instead, the counter holds seconds since
+// 2000-01-01 00:00:00, converted with the RTClib functions.  The counter (and backup registers)
+// keep running through a reset.
+//
+// Writing RTC_CNT also reloads the RTC prescaler (RTC_DIV), so a write made right after a
+// DS3231 SQW edge puts the internal RTC's seconds roll-over in phase with the DS3231.
+
+#include "main.h" // HAL error definitions
+#include "stm32_rtc.h"
+
+extern RTC_HandleTypeDef hrtc; // main.c
+
+// Read the 32-bit counter.  CNTH/CNTL are two registers; re-read if the low half rolled over.
+uint32_t stm32_rtc_counter(void)
+{
+	uint16_t high = RTC->CNTH;
+	uint16_t low = RTC->CNTL;
+	uint16_t high2 = RTC->CNTH;
+	if(high != high2) {
+		high = high2;
+		low = RTC->CNTL;
+	}
+	return ((uint32_t)high << 16) | low;
+}
+
+// Wait for the last write to the RTC registers to complete
+static HAL_StatusTypeDef stm32_rtc_wait_rtoff(void)
+{
+	uint32_t tickstart = HAL_GetTick();
+	while(!(RTC->CRL & RTC_CRL_RTOFF)) {
+		if((HAL_GetTick() - tickstart) > RTC_TIMEOUT_VALUE) return HAL_TIMEOUT;
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef stm32_rtc_read(DATE_TIME * dt)
+{
+	unix2rtc(dt, stm32_rtc_counter() + SECONDS_FROM_1970_TO_2000);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef stm32_rtc_write(const DATE_TIME * dt)
+{
+	uint32_t counter = rtc2seconds((DATE_TIME *)dt);
+	if(HAL_OK != stm32_rtc_wait_rtoff()) return HAL_TIMEOUT;
+	__HAL_RTC_WRITEPROTECTION_DISABLE(&hrtc); // enter configuration mode
+	RTC->CNTH = counter >> 16;
+	RTC->CNTL = counter & 0xFFFF;
+	__HAL_RTC_WRITEPROTECTION_ENABLE(&hrtc);  // exit configuration mode, starts the write
+	if(HAL_OK != stm32_rtc_wait_rtoff()) return HAL_TIMEOUT;
+	HAL_RTCEx_BKUPWrite(&hrtc, STM32_RTC_BKP_VALID, STM32_RTC_BKP_VALID_VALUE);
+	return HAL_OK;
+}
+
+// HAL_OK if the LSE is running and the counter has been set
+HAL_StatusTypeDef stm32_rtc_check(void)
+{
+	if(!__HAL_RCC_GET_FLAG(RCC_FLAG_LSERDY)) return HAL_ERROR;
+	if(HAL_RTCEx_BKUPRead(&hrtc, STM32_RTC_BKP_VALID) != STM32_RTC_BKP_VALID_VALUE) return HAL_ERROR;
+	return HAL_OK;
+}
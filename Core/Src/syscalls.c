@@ -29,6 +29,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/times.h>
+#include "uart_tx.h"
 
 
 /* Variables */
@@ -80,13 +81,8 @@ __attribute__((weak)) int _read(int file, char *ptr, int len)
 __attribute__((weak)) int _write(int file, char *ptr, int len)
 {
   (void)file;
-  int DataIdx;
-
-  for (DataIdx = 0; DataIdx < len; DataIdx++)
-  {
-    __io_putchar(*ptr++);
-  }
-  return len;
+  /* Queue the whole buffer, USART2 TX DMA sends it */
+  return uart_tx_write((const uint8_t *)ptr, len);
 }
 
 int _close(int file)
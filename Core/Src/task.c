@@ -0,0 +1,128 @@
+// task.c, cooperative background tasks for long running commands
+//
+// "alarm", "count" and "delaytest" used to spin in their own loops until a key was pressed,
+// and the clock stopped updating meanwhile.  They now start a task and return to the command
+// line.  task_run() is called from the superloop next to the clock, and runs one slice of
+// each task.  "jobs" lists the tasks, "kill <job>" stops one.
+//
+// Tasks are statically allocated by the command that owns them (no heap), and a command's
+// task can only run once at a time.
+
+#include <string.h> // strcmp()
+#include "task.h"
+#include "command_line.h"
+
+static TASK * tasks[TASK_MAX];
+static uint8_t next_id = 1;
+
+// Add a task to the run list, return its job number, or 0 if it is already running or
+// the list is full
+int task_start(TASK * t)
+{
+	if(t->id) {
+		printf("%s is already running as job %u\n", t->name, t->id);
+		return 0;
+	}
+	for(unsigned i = 0; i < TASK_MAX; i++) {
+		if(tasks[i]) continue;
+		t->resume = 0;
+		t->started = HAL_GetTick();
+		t->slices = 0;
+		t->slice_max_us = 0;
+		t->id = next_id++;
+		if(!next_id) next_id = 1;
+		tasks[i] = t;
+		printf("[%u] %s\n", t->id, t->name);
+		return t->id;
+	}
+	printf("No room for %s, %u jobs running\n", t->name, TASK_MAX);
+	return 0;
+}
+
+static void task_remove(unsigned i)
+{
+	tasks[i]->id = 0;
+	tasks[i] = NULL;
+}
+
+// Stop a task before it finishes
+void task_kill(TASK * t)
+{
+	for(unsigned i = 0; i < TASK_MAX; i++) {
+		if(tasks[i] != t) continue;
+		if(t->stop) t->stop(t);
+		printf("[%u] %s killed\n", t->id, t->name);
+		task_remove(i);
+	}
+}
+
+// Return the number of tasks running
+int task_count(void)
+{
+	int count = 0;
+	for(unsigned i = 0; i < TASK_MAX; i++) count += tasks[i] != NULL;
+	return count;
+}
+
+int task_running(const TASK * t)
+{
+	return t->id != 0;
+}
+
+// Superloop - run one slice of each task
+// Return 1 if a task yielded (has more work now), 0 if all are waiting or there are none
+int task_run(void)
+{
+	int yielded = 0;
+	for(unsigned i = 0; i < TASK_MAX; i++) {
+		TASK * t = tasks[i];
+		if(!t) continue;
+		t->yielded = 0;
+		uint16_t start_us = TIM4->CNT; // TIM4 counts microseconds
+		TASK_STATUS status = t->run(t);
+		uint16_t elapsed_us = TIM4->CNT - start_us;
+		t->slices++;
+		if(elapsed_us > t->slice_max_us) t->slice_max_us = elapsed_us;
+		if(TASK_DONE == status) {
+			printf("[%u] %s done\n", t->id, t->name);
+			task_remove(i);
+		} else {
+			yielded |= t->yielded;
+		}
+	}
+	return yielded;
+}
+
+// Command line method to list the running tasks
+int cl_jobs(void)
+{
+	printf("Job Name       Seconds  Slices     Max slice (us)\n");
+	for(unsigned i = 0; i < TASK_MAX; i++) {
+		TASK * t = tasks[i];
+		if(!t) continue;
+		printf("%-3u %-10s %-8lu %-10lu %u\n", t->id, t->name, (HAL_GetTick() - t->started) / 1000,
+				t->slices, t->slice_max_us);
+	}
+	return 0;
+}
+
+// Command line method to stop a task
+// kill <job>  : by job number
+// kill all    : all tasks
+int cl_kill(void)
+{
+	if(argc < 2) {
+		printf("kill <job | all>\n");
+		return 1;
+	}
+	int all = strcmp(argv[1], "all") == 0;
+	unsigned id = strtoul(argv[1], NULL, 10);
+	for(unsigned i = 0; i < TASK_MAX; i++) {
+		if(tasks[i] && (all || tasks[i]->id == id)) {
+			task_kill(tasks[i]);
+			if(!all) return 0;
+		}
+	}
+	if(!all) printf("No job %s\n", argv[1]);
+	return 0;
+}
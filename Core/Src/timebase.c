@@ -0,0 +1,50 @@
+// timebase.c, 64-bit microsecond timebase - TIM4 extended by its update (overflow) count
+//
+// TIM4 counts microseconds (72MHz / 72), 16 bits, free running.  Its update interrupt, every
+// 65.536ms, counts the upper bits - the same extension as the TIM2 SQW timestamps
+// (DS3231_sqw.c).  timebase_us() is monotonic and safe from interrupt handlers and with
+// interrupts disabled: a roll-over not yet serviced is detected from the update flag.
+// All interrupts share priority 0, so the TIM4 handler is never preempted between clearing
+// the flag and counting the overflow.
+//
+// TIM4 stops in STOP mode ("power on"), so the timebase excludes time spent stopped.
+// Short intervals can still be measured with a 16-bit difference of TIM4->CNT, the cheapest
+// read, as long as they are well under 65ms.
+
+#include "timebase.h"
+
+static volatile uint32_t overflows; // TIM4 update count, bits 16 - 47 of the time
+
+// HAL_TIM_PeriodElapsedCallback() for TIM4 (main.c)
+void timebase_overflow(void)
+{
+	overflows++;
+}
+
+// Microseconds since TIM4 was started
+uint64_t timebase_us(void)
+{
+	uint32_t upper, count, sr;
+	// CNT and SR are read between two reads of overflows, so the update interrupt cannot
+	// clear UIF (and increment overflows) between the count and the flag
+	do {
+		upper = overflows;
+		count = TIM4->CNT;
+		sr = TIM4->SR;
+	} while(upper != overflows);
+	// Roll-over not yet serviced (called with interrupts masked, or from an interrupt handler)
+	if((sr & TIM_SR_UIF) && count < 0x8000) upper++;
+	return ((uint64_t)upper << 16) | count;
+}
+
+// Lower 32 bits of timebase_us(), wraps every 71 minutes.  Differences of two readings are
+// valid for intervals up to that.
+uint32_t timebase_us32(void)
+{
+	return (uint32_t)timebase_us();
+}
+
+uint32_t timebase_overflows(void)
+{
+	return overflows;
+}
@@ -0,0 +1,128 @@
+// timezone.cpp, local time from the UTC time kept by the DS3231
+//
+// The DS3231 (and internal RTC) keep UTC, so a DST change needs no "time" command.
+// The UTC instants of every DST transition from TZ_FIRST_YEAR through TZ_LAST_YEAR are
+// computed by the compiler (constexpr) into a table in flash.  tz_offset() caches the interval
+// between the transitions around the last lookup, so the common case is a single compare.
+// A miss is a binary search of the table.
+
+#include "main.h"
+#include <stdio.h> // printf()
+#include "timezone.h"
+#include "rtc_backend.h"
+#include "RTClib_constexpr.h"
+
+#define TZ_TRANSITIONS ((TZ_LAST_YEAR - TZ_FIRST_YEAR + 1) * 2)
+
+//=============================================================================
+// Compile time table generation
+
+// Day of week, 0: Sunday (1970-01-01 was a Thursday)
+static constexpr uint32_t tz_weekday(uint32_t days)
+{
+	return (days + 4) % 7;
+}
+
+// Day number of the n'th Sunday of a month
+static constexpr uint32_t tz_nth_sunday(uint32_t y, uint32_t m, uint32_t n)
+{
+	return rtc_days_from_civil(y, m, 1) + (7 - tz_weekday(rtc_days_from_civil(y, m, 1))) % 7 + 7 * (n - 1);
+}
+
+// Day number of the last Sunday of a month
+static constexpr uint32_t tz_last_sunday(uint32_t y, uint32_t m)
+{
+	return rtc_days_from_civil(y, m + 1, 1) - 1 - tz_weekday(rtc_days_from_civil(y, m + 1, 1) - 1);
+}
+
+struct TzTable {
+	uint32_t t[TZ_TRANSITIONS]; // UTC seconds since 1970, DST starts at even indexes, ends at odd
+};
+
+static constexpr TzTable tz_make_table()
+{
+	TzTable table{};
+	for(uint32_t y = TZ_FIRST_YEAR; y <= TZ_LAST_YEAR; y++) {
+		uint32_t start = y >= 2007 ? tz_nth_sunday(y, 3, 2) : tz_nth_sunday(y, 4, 1);
+		uint32_t end   = y >= 2007 ? tz_nth_sunday(y, 11, 1) : tz_last_sunday(y, 10);
+		// 02:00 local standard time, 02:00 local daylight time
+		table.t[(y - TZ_FIRST_YEAR) * 2]     = start * SECONDS_PER_DAY + 2 * 3600 - TZ_STD_OFFSET_S;
+		table.t[(y - TZ_FIRST_YEAR) * 2 + 1] = end * SECONDS_PER_DAY + 2 * 3600 - (TZ_STD_OFFSET_S + TZ_DST_SAVE_S);
+	}
+	return table;
+}
+
+static constexpr TzTable tz_table = tz_make_table();
+
+// Spot checks for US Central: 2024-03-10 08:00 UTC and 2024-11-03 07:00 UTC
+static_assert(TZ_STD_OFFSET_S != -6 * 3600L || tz_table.t[(2024 - TZ_FIRST_YEAR) * 2] == 1710057600UL, "DST start");
+static_assert(TZ_STD_OFFSET_S != -6 * 3600L || tz_table.t[(2024 - TZ_FIRST_YEAR) * 2 + 1] == 1730617200UL, "DST end");
+
+//=============================================================================
+// Run time lookup
+
+static uint32_t cache_start;  // transition at or before the last lookup
+static uint32_t cache_len;    // seconds until the next transition, 0: cache empty
+static int32_t cache_offset;  // offset in effect between them
+static uint32_t cache_misses;
+
+// Return the local time offset from UTC (seconds) in effect at utc
+int32_t tz_offset(uint32_t utc)
+{
+	if(utc - cache_start < cache_len) return cache_offset; // common case
+
+	// Count the transitions at or before utc
+	uint32_t lo = 0, hi = TZ_TRANSITIONS;
+	while(lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if(tz_table.t[mid] <= utc) lo = mid + 1;
+		else hi = mid;
+	}
+	cache_start = lo ? tz_table.t[lo - 1] : 0;
+	cache_len = (lo < TZ_TRANSITIONS ? tz_table.t[lo] : UINT32_MAX) - cache_start;
+	cache_offset = (lo & 1) ? TZ_STD_OFFSET_S + TZ_DST_SAVE_S : TZ_STD_OFFSET_S;
+	cache_misses++;
+	return cache_offset;
+}
+
+uint32_t tz_local(uint32_t utc)
+{
+	return utc + tz_offset(utc);
+}
+
+// Local time to UTC.  In the repeated hour when DST ends, the standard time reading is used.
+uint32_t tz_utc(uint32_t local)
+{
+	return local - tz_offset(local - TZ_STD_OFFSET_S);
+}
+
+void tz_to_local(DATE_TIME * dt)
+{
+	unix2rtc(dt, tz_local(rtc2unix(dt)));
+}
+
+void tz_to_utc(DATE_TIME * dt)
+{
+	unix2rtc(dt, tz_utc(rtc2unix(dt)));
+}
+
+// Command line method to display UTC, local time and the next DST transition
+int cl_tz(void)
+{
+	DATE_TIME dt;
+	if(HAL_OK != rtc_read(&dt)) return 0;
+	uint32_t utc = rtc2unix(&dt);
+	printf("UTC:        %02u/%02u/%04u %02u:%02u:%02u\n", dt.d, dt.m, dt.yOff + 2000, dt.hh, dt.mm, dt.ss);
+	int32_t offset = tz_offset(utc);
+	unix2rtc(&dt, utc + offset);
+	printf("Local:      %02u/%02u/%04u %02u:%02u:%02u (UTC%+ld:%02ld %s)\n", dt.d, dt.m, dt.yOff + 2000, dt.hh, dt.mm, dt.ss,
+			offset / 3600, (offset < 0 ? -offset : offset) % 3600 / 60, offset == TZ_STD_OFFSET_S ? "standard" : "daylight");
+	if(cache_len != UINT32_MAX - cache_start) {
+		uint32_t next = cache_start + cache_len;
+		unix2rtc(&dt, next + offset);
+		printf("Next:       %02u/%02u/%04u %02u:%02u:%02u local\n", dt.d, dt.m, dt.yOff + 2000, dt.hh, dt.mm, dt.ss);
+	}
+	printf("Table:      %u transitions, %u bytes flash\n", TZ_TRANSITIONS, (unsigned)sizeof(tz_table));
+	printf("Lookups:    %lu searches\n", cache_misses);
+	return 0;
+}
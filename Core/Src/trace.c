@@ -0,0 +1,131 @@
+// trace.c, hot path trace - enter/exit events with DWT cycle counts in a RAM ring
+//
+// TRACE_ENTER() / TRACE_EXIT() around a function or interrupt handler record the trace ID and
+// DWT->CYCCNT.  The ring always holds the last TRACE_RING_SIZE events.  "trace dump" sends it
+// in binary (format in trace_format.h), and Tools/trace_analyze.c turns a capture into
+// per-function latency histograms and a Chrome trace (chrome://tracing, Perfetto) timeline:
+//   stty -F /dev/ttyACM0 115200 raw; cat /dev/ttyACM0 > capture.bin &
+//   echo "trace dump" > /dev/ttyACM0
+//   trace_analyze capture.bin trace.json
+//
+// DWT->CYCCNT wraps every 59.6 seconds at 72MHz.  The analyzer works from the difference
+// between consecutive events, so only gaps of a minute or more between events are ambiguous.
+
+#include <stdio.h> // printf()
+#include <string.h> // strcmp()
+#include "trace.h"
+#include "proto_frame.h" // proto_crc16()
+#include "uart_tx.h"
+#include "dwt.h"
+#include "command_line.h"
+
+#if TRACE_RING_SIZE
+
+#if TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)
+#error TRACE_RING_SIZE must be a power of 2
+#endif
+
+volatile uint32_t trace_head;
+volatile uint8_t trace_enabled = 1;
+uint32_t trace_cycles[TRACE_RING_SIZE];
+uint8_t trace_ids[TRACE_RING_SIZE];
+
+#define TRACE_NAME(id, name) name,
+static const char * const trace_names[TRACE_ID_COUNT] = {"-", TRACE_IDS(TRACE_NAME)};
+#undef TRACE_NAME
+
+// Dump output, staged in small blocks.  Each block waits for the TX ring to drain, so nothing is
+// dropped whatever the uart_tx policy, and the trace stays small compared with the TX ring.
+typedef struct {
+	uint16_t crc;
+	uint8_t len;
+	uint8_t buf[64];
+} TRACE_OUT;
+
+static void trace_out_flush(TRACE_OUT * out)
+{
+	uart_tx_flush();
+	uart_tx_write(out->buf, out->len);
+	out->len = 0;
+}
+
+static void trace_out(TRACE_OUT * out, const void * data, uint8_t len)
+{
+	const uint8_t * p = data;
+	out->crc = proto_crc16(out->crc, p, len);
+	while(len--) {
+		if(out->len == sizeof(out->buf)) trace_out_flush(out);
+		out->buf[out->len++] = *p++;
+	}
+}
+
+// Send the ring in binary, oldest event first.  Recording pauses so the dump's own UART
+// interrupts don't overwrite the events being sent.
+static void trace_dump(void)
+{
+	uint8_t enabled = trace_enabled;
+	trace_enabled = 0;
+	uint32_t total = trace_head;
+	uint16_t count = total < TRACE_RING_SIZE ? total : TRACE_RING_SIZE;
+	uint32_t hz = SystemCoreClock;
+
+	TRACE_OUT out = {0xFFFF, 0};
+	uart_tx_flush(); // separate from the command echo
+	trace_out(&out, TRACE_MAGIC, 4);
+	out.crc = 0xFFFF; // the CRC starts after the magic
+	trace_out(&out, &hz, sizeof(hz)); // Cortex-M3 is little endian
+	trace_out(&out, &total, sizeof(total));
+	trace_out(&out, &count, sizeof(count));
+	for(uint32_t i = total - count; i != total; i++) {
+		uint32_t slot = i & (TRACE_RING_SIZE - 1);
+		trace_out(&out, &trace_cycles[slot], sizeof(trace_cycles[slot]));
+		trace_out(&out, &trace_ids[slot], sizeof(trace_ids[slot]));
+	}
+	uint8_t crc[2] = {(uint8_t)out.crc, (uint8_t)(out.crc >> 8)};
+	trace_out(&out, crc, sizeof(crc));
+	trace_out_flush(&out);
+	uart_tx_flush();
+	trace_enabled = enabled;
+}
+
+// Command line method for the hot path trace
+// trace                     : status and events per trace point in the ring
+// trace <on | off | clear>  : start, stop or empty the ring
+// trace dump                : binary dump for Tools/trace_analyze.c
+int cl_trace(void)
+{
+	if(argc > 1) {
+		if(strcmp(argv[1], "dump") == 0) {
+			trace_dump();
+			return 0;
+		} else if(strcmp(argv[1], "on") == 0) {
+			dwt_init();
+			trace_enabled = 1;
+		} else if(strcmp(argv[1], "off") == 0) {
+			trace_enabled = 0;
+		} else if(strcmp(argv[1], "clear") == 0) {
+			trace_head = 0;
+		}
+	}
+	uint32_t total = trace_head;
+	uint32_t count = total < TRACE_RING_SIZE ? total : TRACE_RING_SIZE;
+	printf("Trace %s, %lu events recorded, %lu in the ring (%u max)\n", trace_enabled ? "on" : "off",
+			total, count, TRACE_RING_SIZE);
+
+	uint16_t per_id[TRACE_ID_COUNT] = {0};
+	for(uint32_t i = total - count; i != total; i++)
+		per_id[trace_ids[i & (TRACE_RING_SIZE - 1)] & ~TRACE_EXIT_FLAG]++;
+	for(unsigned id = 1; id < TRACE_ID_COUNT; id++)
+		if(per_id[id]) printf("  %-26s %u\n", trace_names[id], per_id[id]);
+	return 0;
+}
+
+#else
+
+int cl_trace(void)
+{
+	printf("Trace compiled out (TRACE_RING_SIZE 0)\n");
+	return 0;
+}
+
+#endif // TRACE_RING_SIZE
@@ -0,0 +1,106 @@
+// uart_rx.c, USART2 receive ring filled by circular DMA (DMA1 channel 6)
+//
+// The old receive path was an 80 byte DMA buffer, and __io_getchar() compared CNDTR against
+// its read index.  If the superloop was busy for more than 80 characters (cl_alarm, the
+// "count" test, an I2C timeout), the DMA lapped the reader and the input was silently corrupted.
+//
+// Now the DMA runs in circular mode over a UART_RX_RING_SIZE ring, started with
+// HAL_UARTEx_ReceiveToIdle_DMA().  The half transfer, transfer complete and USART IDLE line
+// interrupts each call HAL_UARTEx_RxEventCallback() with the DMA position.  received counts
+// every byte the DMA has written (it can't miss a lap - there is an event every half ring),
+// and the reader's consumed count is compared against it.  A reader more than a ring behind
+// has lost data: this is counted and the reader skips ahead to the newest data.
+//
+// The interrupts own received and dma_pos, the reader (main loop) owns consumed.
+
+#include <stdio.h>  // printf(), EOF
+#include <string.h> // strcmp()
+#include "uart_rx.h"
+#include "command_line.h"
+#include "sched.h"
+
+#define UART_RX_MASK (UART_RX_RING_SIZE - 1)
+
+extern UART_HandleTypeDef huart2; // main.c
+
+UART_RX_STATS uart_rx_stats;
+
+static uint8_t ring[UART_RX_RING_SIZE];
+static volatile uint32_t received; // bytes written by the DMA, as of the last event
+static volatile uint16_t dma_pos;  // ring position at the last event
+static uint32_t consumed;          // bytes taken by the reader
+
+// Start (or restart after an error) reception into the ring
+void uart_rx_start(void)
+{
+	received = 0;
+	dma_pos = 0;
+	consumed = 0;
+	HAL_UARTEx_ReceiveToIdle_DMA(&huart2, ring, UART_RX_RING_SIZE);
+}
+
+// Bytes written by the DMA so far, including those since the last event
+static uint32_t uart_rx_head(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint16_t pos = (UART_RX_RING_SIZE - huart2.hdmarx->Instance->CNDTR) & UART_RX_MASK;
+	uint32_t head = received + ((pos - dma_pos) & UART_RX_MASK);
+	__set_PRIMASK(primask);
+	return head;
+}
+
+// Unread bytes, at most one ring
+uint16_t uart_rx_available(void)
+{
+	uint32_t unread = uart_rx_head() - consumed;
+	return unread > UART_RX_RING_SIZE ? UART_RX_RING_SIZE : (uint16_t)unread;
+}
+
+// Non-blocking, return the next received byte or EOF if none
+int uart_rx_getchar(void)
+{
+	uint32_t unread = uart_rx_head() - consumed;
+	if(!unread) return EOF;
+	if(unread > UART_RX_RING_SIZE) {
+		// The DMA lapped the reader - keep the newest half ring, the rest is gone
+		uart_rx_stats.overruns++;
+		uart_rx_stats.lost += unread - UART_RX_RING_SIZE / 2;
+		consumed += unread - UART_RX_RING_SIZE / 2;
+		unread = UART_RX_RING_SIZE / 2;
+	}
+	if(unread > uart_rx_stats.high_water) uart_rx_stats.high_water = unread;
+	uint8_t c = ring[consumed & UART_RX_MASK];
+	consumed++;
+	uart_rx_stats.bytes++;
+	return c;
+}
+
+// DMA half transfer, transfer complete, or IDLE line - pos is the DMA position in the ring
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t pos)
+{
+	if(huart != &huart2) return;
+	switch(HAL_UARTEx_GetRxEventType(huart)) {
+	case HAL_UART_RXEVENT_HT:   uart_rx_stats.half++; break;
+	case HAL_UART_RXEVENT_TC:   uart_rx_stats.full++; break;
+	default:                    uart_rx_stats.idle++; break;
+	}
+	pos &= UART_RX_MASK; // transfer complete reports UART_RX_RING_SIZE
+	received += (pos - dma_pos) & UART_RX_MASK;
+	dma_pos = pos;
+	sched_post(SCHED_EV_UART_RX);
+}
+
+// Command line method to display receive statistics
+// rx        : display statistics
+// rx reset  : clear statistics
+int cl_rx(void)
+{
+	if(argc > 1 && strcmp(argv[1], "reset") == 0) uart_rx_stats = (UART_RX_STATS){0};
+	printf("Bytes:      %lu\n", uart_rx_stats.bytes);
+	printf("Events:     %lu idle, %lu half, %lu full\n", uart_rx_stats.idle, uart_rx_stats.half, uart_rx_stats.full);
+	printf("Overruns:   %lu (%lu bytes lost)\n", uart_rx_stats.overruns, uart_rx_stats.lost);
+	printf("Errors:     %lu\n", uart_rx_stats.errors);
+	printf("High water: %u of %u bytes\n", uart_rx_stats.high_water, UART_RX_RING_SIZE);
+	return 0;
+}
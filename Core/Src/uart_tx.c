@@ -0,0 +1,170 @@
+// uart_tx.c, USART2 transmit ring buffer drained by DMA (DMA1 channel 7)
+//
+// __io_putchar() used to call HAL_UART_Transmit() for each byte - about 87us of CPU time per
+// character at 115200 baud, so a "dump" or "help" stalled the clock for tens of milliseconds.
+// Now _write() and __io_putchar() copy into a ring buffer and return.  The largest contiguous
+// block in the ring is sent with HAL_UART_Transmit_DMA(), and the transmit complete interrupt
+// starts the next block.
+//
+// The writer (main loop) owns head, the transmit complete interrupt owns tail.
+
+#include <string.h> // memcpy(), strcmp()
+#include <stdio.h>  // printf()
+#include "uart_tx.h"
+#include "command_line.h"
+
+#define UART_TX_MASK (UART_TX_RING_SIZE - 1)
+#define UART_TX_FLUSH_MS 200 // longer than it takes to send a full ring
+
+extern UART_HandleTypeDef huart2; // main.c
+
+UART_TX_STATS uart_tx_stats;
+
+static uint8_t ring[UART_TX_RING_SIZE];
+static volatile uint16_t head;    // next byte to be written
+static volatile uint16_t tail;    // next byte to be sent
+static volatile uint16_t dma_len; // bytes in the DMA transfer in progress, 0: idle
+static uint8_t policy = UART_TX_BLOCK;
+static uint32_t unreported;       // UART_TX_COUNT: drops not yet reported in the output
+
+static uint16_t uart_tx_used(void)
+{
+	return (head - tail) & UART_TX_MASK;
+}
+
+static uint16_t uart_tx_free(void)
+{
+	return UART_TX_MASK - uart_tx_used(); // one byte is always left empty
+}
+
+// Start a DMA transfer of the oldest contiguous block, if the DMA is idle
+// Called with interrupts disabled, or from the transmit complete interrupt
+static void uart_tx_start(void)
+{
+	if(dma_len || head == tail) return;
+	uint16_t len = (head > tail ? head : UART_TX_RING_SIZE) - tail;
+	if(HAL_OK == HAL_UART_Transmit_DMA(&huart2, &ring[tail], len)) {
+		dma_len = len;
+		uart_tx_stats.transfers++;
+	}
+}
+
+static void uart_tx_kick(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uart_tx_start();
+	__set_PRIMASK(primask);
+}
+
+// Copy bytes into the ring, no room check
+static void uart_tx_copy(const uint8_t * data, uint16_t len)
+{
+	while(len) {
+		uint16_t n = UART_TX_RING_SIZE - head; // contiguous room before the end of the ring
+		if(n > len) n = len;
+		memcpy(&ring[head], data, n);
+		head = (head + n) & UART_TX_MASK;
+		data += n;
+		len -= n;
+	}
+}
+
+// UART_TX_COUNT: report dropped bytes in the output stream once there is room
+static void uart_tx_report_drops(void)
+{
+	static const char tail[] = " bytes dropped]\n";
+	char text[2 + 10 + sizeof(tail)] = "\n["; // up to 10 digits
+	char digits[10];
+	int n = 0, i = 2;
+	uint32_t v = unreported;
+	do { digits[n++] = '0' + v % 10; v /= 10; } while(v);
+	while(n) text[i++] = digits[--n];
+	memcpy(&text[i], tail, sizeof(tail) - 1);
+	i += sizeof(tail) - 1;
+	if(uart_tx_free() < i) return; // try again later
+	uart_tx_copy((const uint8_t *)text, i);
+	unreported = 0;
+}
+
+// Queue bytes for transmission.  Returns len - bytes that don't fit are handled per the policy.
+int uart_tx_write(const uint8_t * data, int len)
+{
+	int written = 0;
+	int waited = 0;
+	// Blocking is not possible in an interrupt handler, or with interrupts disabled
+	int can_block = (policy == UART_TX_BLOCK) && !__get_IPSR() && !__get_PRIMASK();
+	uint32_t tickstart = HAL_GetTick();
+
+	if(unreported) uart_tx_report_drops();
+	while(written < len) {
+		uint16_t room = uart_tx_free();
+		if(!room) {
+			if(can_block && (HAL_GetTick() - tickstart) < UART_TX_FLUSH_MS) {
+				if(!waited++) uart_tx_stats.blocked++;
+				uart_tx_kick(); // in case the DMA is idle (UART was busy at the last kick)
+				continue;
+			}
+			uart_tx_stats.dropped += len - written;
+			if(policy == UART_TX_COUNT) unreported += len - written;
+			break;
+		}
+		if(room > len - written) room = len - written;
+		uart_tx_copy(data + written, room);
+		written += room;
+		uart_tx_stats.bytes += room;
+		if(uart_tx_used() > uart_tx_stats.high_water) uart_tx_stats.high_water = uart_tx_used();
+		uart_tx_kick(); // start sending while the rest is copied
+	}
+	return len;
+}
+
+// Wait for the ring to drain and the last byte to leave the UART (IE: before a reset)
+void uart_tx_flush(void)
+{
+	uint32_t tickstart = HAL_GetTick();
+	while((head != tail || huart2.gState != HAL_UART_STATE_READY) && (HAL_GetTick() - tickstart) < UART_TX_FLUSH_MS) {
+		if(!__get_PRIMASK()) uart_tx_kick();
+	}
+}
+
+// Return 1 while bytes are queued or being sent
+int uart_tx_busy(void)
+{
+	return head != tail || huart2.gState != HAL_UART_STATE_READY;
+}
+
+void uart_tx_set_policy(UART_TX_POLICY new_policy)
+{
+	policy = new_policy;
+}
+
+// Transmit complete interrupt - release the block just sent, start the next one
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if(huart != &huart2) return;
+	tail = (tail + dma_len) & UART_TX_MASK;
+	dma_len = 0;
+	uart_tx_start();
+}
+
+// Command line method to display transmit statistics, set the overflow policy
+// tx                        : display statistics
+// tx <block | drop | count> : set the overflow policy
+// tx reset                  : clear statistics
+int cl_tx(void)
+{
+	static const char * const names[] = {"block", "drop", "count"};
+	if(argc > 1) {
+		for(unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+			if(strcmp(argv[1], names[i]) == 0) policy = i;
+		if(strcmp(argv[1], "reset") == 0) uart_tx_stats = (UART_TX_STATS){0};
+	}
+	printf("Policy:     %s\n", names[policy]);
+	printf("Bytes:      %lu\n", uart_tx_stats.bytes);
+	printf("Transfers:  %lu\n", uart_tx_stats.transfers);
+	printf("Dropped:    %lu\n", uart_tx_stats.dropped);
+	printf("Blocked:    %lu\n", uart_tx_stats.blocked);
+	printf("High water: %u of %u bytes\n", uart_tx_stats.high_water, UART_TX_RING_SIZE - 1);
+	return 0;
+}
@@ -0,0 +1,143 @@
+// cal_test.c, host test of the DS3231 aging offset calibration (Core/Src/cal_estimator.c)
+//
+// Build (Linux, from the repository root):
+//   gcc -O2 -ICore/Inc -o cal_test Tools/cal_test.c Core/Src/cal_estimator.c
+// Use:
+//   cal_test
+//
+// Feeds synthetic SQW edge timestamps - 72MHz TIM2 ticks, as DS3231_sqw.c captures them - to
+// the estimator and checks the ppm estimate for DS3231s running fast and slow, with capture
+// jitter, missed edges, glitches and an out-of-tolerance interval.  Checks the aging offset
+// step (deadband, rounding, step and register limits), then closes the loop: a simulated
+// DS3231 whose frequency follows the aging offset must be trimmed into the deadband.
+// Returns 1 if a check fails.
+
+#include <stdio.h>
+#include <stdint.h>
+#include "cal_estimator.h"
+
+#define REF_HZ   72000000 // SQW_TICKS_PER_SECOND
+#define WINDOW_S 3600     // CAL_WINDOW_DEFAULT
+#define JITTER   2        // +/- ticks of capture latency
+
+static int errors;
+
+#define CHECK(cond, ...) do { if(!(cond)) { errors++; printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } while(0)
+
+// Simulated SQW: edges of a DS3231 that is ppb fast, timestamped by the reference counter
+typedef struct {
+	double ts;       // exact reference time of the last edge, ticks
+	int32_t ppb;     // DS3231 frequency error
+	uint32_t rand;
+} SQW;
+
+static int jitter(SQW * s)
+{
+	s->rand = s->rand * 1664525u + 1013904223u;
+	return (int)(s->rand >> 16) % (2 * JITTER + 1) - JITTER;
+}
+
+static uint64_t sqw_next(SQW * s)
+{
+	s->ts += REF_HZ / (1.0 + s->ppb * 1e-9); // fast: shorter seconds
+	return (uint64_t)(s->ts + 0.5) + jitter(s);
+}
+
+// Run whole windows, return the number of estimates; est->ppb holds the last
+static uint32_t run(CAL_ESTIMATOR * est, SQW * s, uint32_t windows, unsigned drop_every, unsigned glitch_every)
+{
+	uint32_t done = 0;
+	for(uint32_t n = 0; done < windows && n < (windows + 1) * (WINDOW_S + 1) * 2; n++) {
+		uint64_t ts = sqw_next(s);
+		if(drop_every && n % drop_every == drop_every - 1) continue;      // missed edge
+		done += cal_est_edge(est, ts);
+		if(glitch_every && n % glitch_every == 0) cal_est_edge(est, ts + REF_HZ / 1000); // spike 1ms after
+	}
+	return done;
+}
+
+static void test_estimates(void)
+{
+	static const int32_t ppbs[] = {0, 2500, -2500, 17300, -9999, 100000, -100000};
+	for(unsigned i = 0; i < sizeof(ppbs) / sizeof(ppbs[0]); i++) {
+		CAL_ESTIMATOR est;
+		SQW s = {1000.0, ppbs[i], i};
+		cal_est_init(&est, REF_HZ, WINDOW_S);
+		uint32_t n = run(&est, &s, 2, 0, 0);
+		CHECK(n == 2, "%d ppb: %u estimates", ppbs[i], n);
+		CHECK(est.ppb >= ppbs[i] - 2 && est.ppb <= ppbs[i] + 2, "%d ppb: estimated %d", ppbs[i], est.ppb);
+		printf("%+8.3f ppm: estimate %+8.3f ppm\n", ppbs[i] / 1000.0, est.ppb / 1000.0);
+
+		// Missed edges are rounded to whole seconds, glitches are dropped
+		cal_est_init(&est, REF_HZ, WINDOW_S);
+		n = run(&est, &s, 2, 97, 0);
+		CHECK(n == 2 && est.ppb >= ppbs[i] - 2 && est.ppb <= ppbs[i] + 2, "%d ppb, missed edges: %d", ppbs[i], est.ppb);
+		cal_est_init(&est, REF_HZ, WINDOW_S);
+		n = run(&est, &s, 2, 0, 500);
+		CHECK(n == 2 && est.ppb >= ppbs[i] - 2 && est.ppb <= ppbs[i] + 2, "%d ppb, glitches: %d", ppbs[i], est.ppb);
+		CHECK(est.rejected >= 2 * WINDOW_S / 500, "%d ppb: %u glitches rejected", ppbs[i], est.rejected);
+	}
+}
+
+// An interval outside CAL_EST_TOLERANCE_PPM starts the window over
+static void test_tolerance(void)
+{
+	CAL_ESTIMATOR est;
+	SQW s = {0.0, 1000, 7};
+	cal_est_init(&est, REF_HZ, 10);
+	for(int i = 0; i < 5; i++) cal_est_edge(&est, sqw_next(&s));
+	s.ts += REF_HZ * (CAL_EST_TOLERANCE_PPM * 2e-6); // one long second
+	CHECK(!cal_est_edge(&est, sqw_next(&s)) && est.rejected == 1 && est.seconds == 0, "out of tolerance accepted");
+	int n = 0;
+	for(int i = 0; i < 10; i++) n += cal_est_edge(&est, sqw_next(&s));
+	CHECK(n == 1 && est.ppb >= 1000 - 60 && est.ppb <= 1000 + 60, "after restart: %d estimates, %d ppb", n, est.ppb);
+}
+
+static void test_aging_step(void)
+{
+	static const struct { int8_t aging; int32_t ppb; int8_t next; } steps[] = {
+		{0, 0, 0}, {0, 50, 0}, {0, -50, 0}, {0, 51, 1}, {0, -51, -1}, {0, 149, 1}, {0, 150, 2},
+		{0, -150, -2}, {5, 2500, 15}, {5, -2500, -5}, {0, 1000000, CAL_MAX_STEP},
+		{0, -1000000, -CAL_MAX_STEP}, {125, 1000, 127}, {-125, -1000, -128}, {127, 60, 127},
+	};
+	for(unsigned i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		int8_t next = cal_est_aging(steps[i].aging, steps[i].ppb);
+		CHECK(next == steps[i].next, "aging %d, %d ppb: %d, expected %d", steps[i].aging, steps[i].ppb, next, steps[i].next);
+	}
+}
+
+// Closed loop: each aging offset LSB slows the DS3231 by CAL_PPB_PER_LSB
+static void test_closed_loop(void)
+{
+	static const int32_t initial[] = {3270, -1840, 12000, 40, -7777};
+	for(unsigned i = 0; i < sizeof(initial) / sizeof(initial[0]); i++) {
+		CAL_ESTIMATOR est;
+		SQW s = {0.0, initial[i], 100 + i};
+		int8_t aging = 0;
+		unsigned windows = 0;
+		cal_est_init(&est, REF_HZ, WINDOW_S);
+		for(; windows < 20; windows++) {
+			if(!run(&est, &s, 1, 0, 0)) break;
+			int8_t next = cal_est_aging(aging, est.ppb);
+			if(next == aging) break;
+			aging = next;
+			s.ppb = initial[i] - aging * CAL_PPB_PER_LSB;
+			cal_est_restart(&est); // as ds3231_cal_task()
+		}
+		printf("%+7.3f ppm: aging offset %+4d after %u windows, %+7.3f ppm left\n", initial[i] / 1000.0,
+				aging, windows, s.ppb / 1000.0);
+		CHECK(s.ppb >= -CAL_DEADBAND_PPB - 2 && s.ppb <= CAL_DEADBAND_PPB + 2, "%d ppb: %d ppb left", initial[i], s.ppb);
+		CHECK(windows <= (unsigned)(initial[i] < 0 ? -initial[i] : initial[i]) / (CAL_MAX_STEP * CAL_PPB_PER_LSB) + 2,
+				"%d ppb: %u windows", initial[i], windows);
+	}
+}
+
+int main(void)
+{
+	test_estimates();
+	test_tolerance();
+	test_aging_step();
+	test_closed_loop();
+	printf("%d errors\n", errors);
+	return errors != 0;
+}
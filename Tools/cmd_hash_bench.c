@@ -0,0 +1,121 @@
+// cmd_hash_bench.c, host benchmark of the CLI command lookup (Core/Src/cmd_hash.c)
+//
+// Build (Linux, from the repository root):
+//   gcc -O2 -ICore/Inc -o cmd_hash_bench Tools/cmd_hash_bench.c Core/Src/cmd_hash.c
+// Use:
+//   cmd_hash_bench
+//
+// Builds command tables of 20, 100 and 500 generated names, laid out like cmd_table
+// (name first), and reports the time per dispatch - hashed and the linear strcmp() walk -
+// for names found and not found.  The hash is sized like the firmware's, at least twice
+// the number of commands.  Returns 1 if a lookup gives the wrong entry.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "cmd_hash.h"
+
+#define LOOKUPS 2000000 // per measurement
+
+typedef struct { // same layout as COMMAND_ITEM (command_line.c)
+	char * command;
+	char * comment;
+	int arg_cnt;
+	int (*function)(void);
+} COMMAND_ITEM;
+
+static volatile int sink;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int linear_find(const COMMAND_ITEM * table, const char * name)
+{
+	for(int i = 0; table[i].command; i++)
+		if(strcmp(name, table[i].command) == 0) return i;
+	return -1;
+}
+
+// Names like the firmware's: 2 - 9 lower case letters, unique
+static void make_names(char (*names)[12], unsigned count, unsigned seed)
+{
+	srand(seed);
+	for(unsigned i = 0; i < count; i++) {
+		unsigned j;
+		do {
+			unsigned len = 2 + rand() % 8;
+			for(unsigned k = 0; k < len; k++) names[i][k] = 'a' + rand() % 26;
+			names[i][len] = 0;
+			for(j = 0; j < i && strcmp(names[i], names[j]); j++) ;
+		} while(j < i);
+	}
+}
+
+static int bench(unsigned count)
+{
+	char (*names)[12] = calloc(count, sizeof(*names));
+	char (*missing)[12] = calloc(count, sizeof(*missing));
+	COMMAND_ITEM * table = calloc(count + 1, sizeof(*table));
+	unsigned size = 1;
+	while(size < 2 * count) size <<= 1;
+	CMD_HASH_SLOT * slots = calloc(size, sizeof(*slots));
+
+	make_names(names, count, count);
+	for(unsigned i = 0; i < count; i++) {
+		table[i].command = names[i];
+		table[i].arg_cnt = 1;
+		snprintf(missing[i], sizeof(missing[i]), "%.9s%c", names[i], '0' + i % 10); // never a command
+	}
+	if(cmd_hash_build(slots, size, table, sizeof(table[0])) != (int)count) {
+		printf("%u commands: build failed\n", count);
+		return 1;
+	}
+	int errors = 0;
+	for(unsigned i = 0; i < count; i++) {
+		if(cmd_hash_find(slots, size, table, sizeof(table[0]), names[i]) != (int)i) errors++;
+		if(cmd_hash_find(slots, size, table, sizeof(table[0]), missing[i]) != -1) errors++;
+	}
+	unsigned used = 0, probes = 0;
+	for(unsigned i = 0; i < count; i++) {
+		uint32_t slot = cmd_hash_name(names[i]);
+		while(slots[slot & (size - 1)] != i + 1) slot++, probes++;
+		probes++;
+	}
+	for(unsigned i = 0; i < size; i++) used += slots[i] != 0;
+
+	double ns[4];
+	for(int m = 0; m < 4; m++) {
+		char (*keys)[12] = m & 1 ? missing : names;
+		double start = now_ns();
+		for(unsigned n = 0; n < LOOKUPS; n++) {
+			const char * name = keys[n % count];
+			sink = m < 2 ? cmd_hash_find(slots, size, table, sizeof(table[0]), name) : linear_find(table, name);
+		}
+		ns[m] = (now_ns() - start) / LOOKUPS;
+	}
+	printf("%-8u %4u/%-5u %-6.2f %-10.1f %-10.1f %-10.1f %.1f\n", count, used, size,
+			(double)probes / count, ns[0], ns[1], ns[2], ns[3]);
+
+	free(slots);
+	free(table);
+	free(missing);
+	free(names);
+	return errors != 0;
+}
+
+int main(void)
+{
+	static const unsigned counts[] = {20, 100, 500};
+	int rc = 0;
+	printf("                        ---- ns per dispatch --------------------\n");
+	printf("Commands Slots      Probes Hash found Hash miss  Lin found  Lin miss\n");
+	for(unsigned i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) rc |= bench(counts[i]);
+	if(rc) printf("FAIL: lookup returned the wrong entry\n");
+	return rc;
+}
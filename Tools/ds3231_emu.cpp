@@ -0,0 +1,377 @@
+// ds3231_emu.cpp, host (Linux) DS3231 emulator and I2C1 HAL stand-in, see ds3231_emu.h
+
+#include <string.h>
+#include "stm32f1xx_hal.h" // Tools/host stand-in
+#include "ds3231_emu.h"
+
+#define EMU_BUS_HZ  100000 // I2C1 clock, see MX_I2C1_Init()
+#define EMU_POLL_US 1      // virtual time per HAL_GetTick() call
+
+static uint8_t bcd2bin(uint8_t val) { return val - 6 * (val >> 4); }
+static uint8_t bin2bcd(uint8_t val) { return val + 6 * (val / 10); }
+
+// Hours register (either mode) to 0 - 23
+static uint8_t hour24(uint8_t reg)
+{
+	if(!(reg & 0x40)) return bcd2bin(reg & 0x3F);
+	uint8_t h = bcd2bin(reg & 0x1F) % 12; // 12 AM is 0
+	return (reg & 0x20) ? h + 12 : h;
+}
+
+// 0 - 23 to a hours register in 12 hour mode (bit 6) or 24 hour mode
+static uint8_t hour_reg(uint8_t h, bool mode12)
+{
+	if(!mode12) return bin2bcd(h);
+	uint8_t h12 = h % 12 ? h % 12 : 12;
+	return 0x40 | (h >= 12 ? 0x20 : 0) | bin2bcd(h12);
+}
+
+// The DS3231 leap year rule: every 4th year, valid through 2099
+static uint8_t days_in_month(uint8_t month, uint8_t year)
+{
+	static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	if(month < 1 || month > 12) return 31;
+	return days[month - 1] + (month == 2 && year % 4 == 0);
+}
+
+Ds3231::Ds3231()
+{
+	power_on();
+}
+
+void Ds3231::power_on()
+{
+	memset(regs_, 0, sizeof(regs_));
+	regs_[DAY] = 0x01;   // 01/01/00 day 1 00:00:00
+	regs_[DATE] = 0x01;
+	regs_[MONTH] = 0x01;
+	regs_[CONTROL] = CTL_RS | CTL_INTCN;
+	regs_[STATUS] = STS_OSF | STS_EN32KHZ;
+	set_temperature(25 * 4);
+	ptr_ = 0;
+	now_ = 0;
+	chain_ = 0;
+	running_ = true;
+	fault_ = FAULT_NONE;
+	fault_count_ = 0;
+	memset(&counters, 0, sizeof(counters));
+}
+
+void Ds3231::advance(uint64_t us)
+{
+	now_ += us;
+	if(!running_) {
+		chain_ = now_;
+		return;
+	}
+	while(now_ - chain_ >= 1000000) {
+		chain_ += 1000000;
+		tick();
+	}
+}
+
+void Ds3231::stop_oscillator()
+{
+	running_ = false;
+	chain_ = now_;
+	regs_[STATUS] |= STS_OSF;
+}
+
+void Ds3231::start_oscillator()
+{
+	running_ = true;
+	chain_ = now_;
+}
+
+void Ds3231::set_temperature(int16_t quarters)
+{
+	uint16_t raw = (uint16_t)quarters << 6; // 10-bit two's complement, left aligned
+	regs_[TEMP_MSB] = (uint8_t)(raw >> 8);
+	regs_[TEMP_LSB] = (uint8_t)raw;
+}
+
+void Ds3231::inject(Fault fault, unsigned count)
+{
+	fault_ = fault;
+	fault_count_ = count;
+}
+
+// Store a register written over the bus, applying its read-only and write-0-to-clear bits
+void Ds3231::write_reg(uint8_t index, uint8_t value)
+{
+	switch(index) {
+	case SECONDS:
+		regs_[index] = value & 0x7F;
+		chain_ = now_; // countdown chain reset, the next update is 1s from now
+		break;
+	case MINUTES:
+	case HOURS:
+		regs_[index] = value & 0x7F;
+		break;
+	case DAY:
+		regs_[index] = value & 0x07;
+		break;
+	case DATE:
+		regs_[index] = value & 0x3F;
+		break;
+	case MONTH:
+		regs_[index] = value & 0x9F;
+		break;
+	case CONTROL:
+		regs_[index] = value & ~CTL_CONV; // a forced conversion completes at once
+		break;
+	case STATUS:
+		// OSF, A2F, A1F can only be cleared, BSY is read-only, bits 6:4 read 0
+		regs_[index] = (regs_[index] & value & (STS_OSF | STS_A2F | STS_A1F))
+				| (value & STS_EN32KHZ) | (regs_[index] & STS_BSY);
+		break;
+	case TEMP_MSB:
+	case TEMP_LSB:
+		break; // read-only
+	default:
+		regs_[index] = value;
+		break;
+	}
+}
+
+Ds3231::Fault Ds3231::transfer(uint8_t address, const uint8_t * wr, size_t wr_len, uint8_t * rd, size_t rd_len)
+{
+	counters.transactions++;
+	counters.bytes++; // address
+	if(address != ADDRESS) {
+		counters.nacks++;
+		return FAULT_NACK;
+	}
+	if(fault_count_) {
+		fault_count_--;
+		if(FAULT_TIMEOUT == fault_) {
+			counters.timeouts++;
+			return FAULT_TIMEOUT;
+		}
+		counters.nacks++;
+		return FAULT_NACK;
+	}
+	if(wr_len) {
+		ptr_ = wr[0] < REGS ? wr[0] : 0;
+		for(size_t i = 1; i < wr_len; i++) {
+			write_reg(ptr_, wr[i]);
+			ptr_ = (ptr_ + 1) % REGS;
+		}
+		counters.bytes += wr_len;
+		if(rd_len) counters.bytes++; // repeated START, address
+	}
+	for(size_t i = 0; i < rd_len; i++) {
+		rd[i] = regs_[ptr_];
+		ptr_ = (ptr_ + 1) % REGS;
+	}
+	counters.bytes += rd_len;
+	return FAULT_NONE;
+}
+
+void Ds3231::bus_reset()
+{
+	counters.resets++;
+}
+
+// Advance the time registers one second, with BCD carries
+void Ds3231::tick()
+{
+	uint8_t s = bcd2bin(regs_[SECONDS]) + 1;
+	if(s < 60) {
+		regs_[SECONDS] = bin2bcd(s);
+	} else {
+		regs_[SECONDS] = 0;
+		uint8_t m = bcd2bin(regs_[MINUTES]) + 1;
+		if(m < 60) {
+			regs_[MINUTES] = bin2bcd(m);
+		} else {
+			regs_[MINUTES] = 0;
+			uint8_t h = hour24(regs_[HOURS]) + 1;
+			bool mode12 = regs_[HOURS] & 0x40;
+			if(h < 24) {
+				regs_[HOURS] = hour_reg(h, mode12);
+			} else {
+				regs_[HOURS] = hour_reg(0, mode12);
+				regs_[DAY] = regs_[DAY] >= 7 ? 1 : regs_[DAY] + 1;
+				uint8_t century = regs_[MONTH] & 0x80;
+				uint8_t month = bcd2bin(regs_[MONTH] & 0x1F);
+				uint8_t year = bcd2bin(regs_[YEAR]);
+				uint8_t d = bcd2bin(regs_[DATE]) + 1;
+				if(d > days_in_month(month, year)) {
+					d = 1;
+					if(++month > 12) {
+						month = 1;
+						if(++year > 99) {
+							year = 0;
+							century ^= 0x80;
+						}
+					}
+				}
+				regs_[DATE] = bin2bcd(d);
+				regs_[MONTH] = century | bin2bcd(month);
+				regs_[YEAR] = bin2bcd(year);
+			}
+		}
+	}
+	check_alarms();
+}
+
+// Compare the alarm registers with the new time (datasheet Table 2, Alarm Mask Bits).
+// A field takes part unless its mask bit (bit 7) is set; DY/DT (bit 6) selects day of week.
+void Ds3231::check_alarms()
+{
+	const uint8_t * a1 = &regs_[A1_SECONDS];
+	const uint8_t * a2 = &regs_[A2_MINUTES];
+	bool day1 = (a1[3] & 0x40) ? (a1[3] & 0x0F) == regs_[DAY] : (a1[3] & 0x3F) == regs_[DATE];
+	bool day2 = (a2[2] & 0x40) ? (a2[2] & 0x0F) == regs_[DAY] : (a2[2] & 0x3F) == regs_[DATE];
+
+	if(((a1[0] & 0x80) || (a1[0] & 0x7F) == regs_[SECONDS])
+			&& ((a1[1] & 0x80) || (a1[1] & 0x7F) == regs_[MINUTES])
+			&& ((a1[2] & 0x80) || hour24(a1[2] & 0x7F) == hour24(regs_[HOURS]))
+			&& ((a1[3] & 0x80) || day1))
+		regs_[STATUS] |= STS_A1F;
+
+	// Alarm 2 has no seconds register, it matches at 00 seconds
+	if(0 == regs_[SECONDS]
+			&& ((a2[0] & 0x80) || (a2[0] & 0x7F) == regs_[MINUTES])
+			&& ((a2[1] & 0x80) || hour24(a2[1] & 0x7F) == hour24(regs_[HOURS]))
+			&& ((a2[2] & 0x80) || day2))
+		regs_[STATUS] |= STS_A2F;
+}
+
+unsigned Ds3231::sqw_hz() const
+{
+	static const unsigned rates[4] = {1, 1024, 4096, 8192};
+	if(regs_[CONTROL] & CTL_INTCN) return 0;
+	return rates[(regs_[CONTROL] & CTL_RS) >> 3];
+}
+
+// The square wave falls at each seconds update (and countdown chain reset)
+int Ds3231::sqw_level() const
+{
+	unsigned hz = sqw_hz();
+	if(!hz) {
+		uint8_t c = regs_[CONTROL];
+		uint8_t s = regs_[STATUS];
+		bool irq = ((c & CTL_A1IE) && (s & STS_A1F)) || ((c & CTL_A2IE) && (s & STS_A2F));
+		return !irq;
+	}
+	if(!running_) return 1;
+	uint64_t half_periods = (now_ - chain_) * 2 * hz / 1000000;
+	return half_periods & 1;
+}
+
+//=============================================================================
+// I2C1 HAL stand-in.  One transfer is in flight at a time, as on I2C1.
+
+Ds3231 ds3231_emu;
+I2C_HandleTypeDef hi2c1; // main.c
+volatile uint32_t host_primask;
+GPIO_TypeDef host_gpioa, host_gpiob, host_gpioc;
+
+static uint64_t clock_us;
+static bool in_irq;
+
+static struct {
+	bool pending;
+	bool hung;                // FAULT_TIMEOUT, only HAL_I2C_DeInit() ends it
+	uint64_t done_us;         // virtual time of the completion interrupt
+	void (*callback)(I2C_HandleTypeDef * hi2c);
+} xfer;
+
+// Run the completion "interrupt" once it is due and interrupts are enabled
+static void emu_deliver(void)
+{
+	if(!xfer.pending || xfer.hung || in_irq || host_primask || clock_us < xfer.done_us) return;
+	xfer.pending = false;
+	in_irq = true;
+	xfer.callback(&hi2c1);
+	in_irq = false;
+}
+
+void emu_advance(uint64_t us)
+{
+	clock_us += us;
+	ds3231_emu.advance(us);
+	emu_deliver();
+}
+
+uint64_t emu_now_us(void)
+{
+	return clock_us;
+}
+
+int emu_i2c_busy(void)
+{
+	return xfer.pending;
+}
+
+// Run the transaction on the device now, complete it after its bus time:
+// 9 bit times per byte, plus START and STOP
+static HAL_StatusTypeDef emu_start(uint16_t DevAddress, const uint8_t * wr, size_t wr_len, uint8_t * rd, size_t rd_len,
+		void (*done)(I2C_HandleTypeDef * hi2c))
+{
+	if(xfer.pending) return HAL_BUSY;
+	uint32_t bytes = ds3231_emu.counters.bytes;
+	Ds3231::Fault fault = ds3231_emu.transfer((uint8_t)(DevAddress >> 1), wr, wr_len, rd, rd_len);
+	bytes = ds3231_emu.counters.bytes - bytes;
+	xfer.pending = true;
+	xfer.hung = Ds3231::FAULT_TIMEOUT == fault;
+	xfer.done_us = clock_us + ((uint64_t)bytes * 9 + 2) * 1000000 / EMU_BUS_HZ;
+	xfer.callback = done;
+	hi2c1.ErrorCode = HAL_I2C_ERROR_NONE;
+	if(Ds3231::FAULT_NACK == fault) {
+		hi2c1.ErrorCode = HAL_I2C_ERROR_AF;
+		xfer.callback = HAL_I2C_ErrorCallback;
+	}
+	return HAL_OK;
+}
+
+extern "C" {
+
+uint32_t HAL_GetTick(void)
+{
+	emu_advance(EMU_POLL_US);
+	return (uint32_t)(clock_us / 1000);
+}
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c)
+{
+	hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c)
+{
+	ds3231_emu.bus_reset();
+	xfer.pending = false;
+	xfer.hung = false;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size)
+{
+	uint8_t index = (uint8_t)MemAddress;
+	return emu_start(DevAddress, &index, 1, pData, Size, HAL_I2C_MemRxCpltCallback);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size)
+{
+	uint8_t buf[1 + 255];
+	if(Size > 255) return HAL_ERROR;
+	buf[0] = (uint8_t)MemAddress;
+	memcpy(buf + 1, pData, Size);
+	return emu_start(DevAddress, buf, 1 + Size, NULL, 0, HAL_I2C_MemTxCpltCallback);
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Receive_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size)
+{
+	return emu_start(DevAddress, NULL, 0, pData, Size, HAL_I2C_MasterRxCpltCallback);
+}
+
+HAL_StatusTypeDef HAL_I2C_Master_Transmit_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size)
+{
+	return emu_start(DevAddress, pData, Size, NULL, 0, HAL_I2C_MasterTxCpltCallback);
+}
+
+} // extern "C"
@@ -0,0 +1,103 @@
+// ds3231_emu.h, host (Linux) DS3231 emulator behind a stand-in for the I2C1 HAL
+//
+// Models the DS3231 as the firmware sees it over I2C:
+// * The 19 registers 00h - 12h with their read-only / write-0-to-clear bits, and the register
+//   pointer, which auto-increments and wraps from 12h to 00h.
+// * BCD time keeping: 12 / 24 hour mode, day of week, month lengths, leap years, century.
+//   Writing the seconds register resets the 1Hz countdown chain.
+// * Oscillator Stop Flag, alarm 1 / alarm 2 matching (mask bits, DY/DT) setting A1F / A2F.
+// * The INT/SQW pin: 1Hz - 8.192kHz square wave (INTCN = 0) or the alarm interrupt (INTCN = 1).
+// * Injected faults: an address NACK, or a device holding SDA (the transfer never completes).
+// * Bus traffic counters, counted the same way as cl_i2c.c's i2c_stats.
+//
+// Time only moves when the virtual clock is advanced - emu_advance(), or 1us per
+// HAL_GetTick() call, which is what the firmware's busy-wait loops poll.  A transfer started
+// with HAL_I2C_xxx_IT() completes ("interrupts") after its 100kHz bus time, from the next
+// HAL_GetTick() call made with interrupts enabled.  Each transaction sees the registers at
+// one instant, as the DS3231's user buffers latch the time at each START.
+//
+// Build and test: see Tools/ds3231_test.cpp
+
+#ifndef __DS3231_EMU_H__
+#define __DS3231_EMU_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Ds3231 {
+public:
+	static const uint8_t ADDRESS = 0x68; // 7-bit
+	static const uint8_t REGS = 0x13;    // 00h - 12h
+
+	// Register indexes and bits used by the model
+	enum {
+		SECONDS = 0x00, MINUTES = 0x01, HOURS = 0x02, DAY = 0x03, DATE = 0x04, MONTH = 0x05, YEAR = 0x06,
+		A1_SECONDS = 0x07, A2_MINUTES = 0x0B, CONTROL = 0x0E, STATUS = 0x0F, AGING = 0x10,
+		TEMP_MSB = 0x11, TEMP_LSB = 0x12,
+	};
+	enum {
+		CTL_EOSC = 0x80, CTL_CONV = 0x20, CTL_RS = 0x18, CTL_INTCN = 0x04, CTL_A2IE = 0x02, CTL_A1IE = 0x01,
+		STS_OSF = 0x80, STS_EN32KHZ = 0x08, STS_BSY = 0x04, STS_A2F = 0x02, STS_A1F = 0x01,
+	};
+
+	enum Fault {
+		FAULT_NONE,
+		FAULT_NACK,    // address not acknowledged
+		FAULT_TIMEOUT, // SDA held low, the transfer never completes
+	};
+
+	struct Counters {
+		uint32_t transactions; // START ... STOP sequences, a repeated START doesn't count
+		uint32_t bytes;        // bytes on the bus, including address bytes
+		uint32_t nacks;        // transactions ended by an address NACK
+		uint32_t timeouts;     // transactions that hung the bus
+		uint32_t resets;       // bus recoveries (HAL_I2C_DeInit())
+	};
+
+	Ds3231();
+
+	void power_on();                  // registers to their power-on values, OSF set
+	void advance(uint64_t us);        // run the oscillator
+	void stop_oscillator();           // sets OSF, time stands still until start_oscillator()
+	void start_oscillator();
+	void set_temperature(int16_t quarters); // 1/4 degree C
+	void inject(Fault fault, unsigned count = 1); // the next count transactions fail
+
+	// One bus transaction: address + write bytes, then (repeated START) address + read bytes.
+	// Either part may be empty.  Returns the fault that ended it, FAULT_NONE on success.
+	Fault transfer(uint8_t address, const uint8_t * wr, size_t wr_len, uint8_t * rd, size_t rd_len);
+	void bus_reset();                 // release a hung bus
+
+	// Back door for the tests - no bus traffic, no side effects beyond the register
+	uint8_t reg(uint8_t index) const { return regs_[index]; }
+	void set_reg(uint8_t index, uint8_t value) { regs_[index] = value; }
+	uint8_t pointer() const { return ptr_; }
+
+	unsigned sqw_hz() const;          // square wave frequency, 0 when INT/SQW is the interrupt output
+	int sqw_level() const;            // INT/SQW pin (open drain with pull-up): 1 high, 0 low
+
+	uint64_t now_us() const { return now_; }
+	Counters counters;
+
+private:
+	void write_reg(uint8_t index, uint8_t value);
+	void tick();                      // one second
+	void check_alarms();
+
+	uint8_t regs_[REGS];
+	uint8_t ptr_;
+	uint64_t now_;                    // oscillator time, us
+	uint64_t chain_;                  // time of the last seconds update / countdown chain reset
+	bool running_;
+	Fault fault_;
+	unsigned fault_count_;
+};
+
+// The DS3231 on the emulated I2C1
+extern Ds3231 ds3231_emu;
+
+void emu_advance(uint64_t us);    // advance the virtual clock, deliver a due I2C completion
+uint64_t emu_now_us(void);
+int emu_i2c_busy(void);           // a transfer is in flight (or hung)
+
+#endif // __DS3231_EMU_H__
@@ -0,0 +1,622 @@
+// ds3231_test.cpp, host test of the DS3231 driver and I2C1 queue against the DS3231 emulator
+//
+// Build (Linux, from the repository root):
+//   gcc -O2 -DTRACE_RING_SIZE=0 -ITools/host -ICore/Inc -c Core/Src/DS3231.c Core/Src/cl_i2c.c
+//       Core/Src/i2c_queue.c Core/Src/RTClib.c
+//   g++ -O2 -ITools/host -ICore/Inc -ITools -o ds3231_test Tools/ds3231_test.cpp Tools/ds3231_emu.cpp
+//       DS3231.o cl_i2c.o i2c_queue.o RTClib.o
+// Use:
+//   ds3231_test
+//
+// Core/Src/DS3231.c, cl_i2c.c and i2c_queue.c are built unmodified on the Tools/host HAL
+// stand-in, with the emulated DS3231 (Tools/ds3231_emu.cpp) on the bus.  Checks the register
+// map, the calendar against RTClib for every day 2000 - 2099, OSF, alarm matching, the SQW
+// rates, NACK / timeout recovery, "i2cfault", queue ordering and that i2c_stats agrees with
+// the bus.  Then benchmarks bus transactions, bytes and time per driver call, with and without
+// merged reads.
+// Returns 1 if a check fails.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "ds3231_emu.h"
+extern "C" {
+#include "command_line.h" // argc, argv, PrintHalStatus() - the header has no extern "C" of its own
+}
+#include "DS3231.h"
+#include "i2c_queue.h"
+#include "i2c_probe.h"
+#include "rtc_backend.h"
+#include "timezone.h"
+#include "fmt.h"
+#include "DS3231_sqw.h"
+#include "task.h"
+#include "power.h"
+
+static int errors;
+
+#define CHECK(cond, ...) do { if(!(cond)) { errors++; printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } while(0)
+
+//=============================================================================
+// Stand-ins for the firmware modules DS3231.c and cl_i2c.c call, not under test
+
+int argc;
+char * argv[MAXWORDS];
+I2C_INVENTORY i2c_inventory;
+
+char * PrintHalStatus(int status)
+{
+	static char s[12];
+	snprintf(s, sizeof(s), "%d", status);
+	return s;
+}
+
+// The DS3231 is the only backend
+HAL_StatusTypeDef rtc_read(DATE_TIME * dt) { return read_ds3231(dt); }
+HAL_StatusTypeDef rtc_write(const DATE_TIME * dt) { return write_ds3231(dt); }
+void tz_to_local(DATE_TIME * dt) {}
+void tz_to_utc(DATE_TIME * dt) {}
+void i2c_probe_scan(void) {}
+void i2c_probe_rescan(void) {}
+int i2c_probe_present(uint8_t addr) { return addr == DS3231_ADDRESS; }
+
+// As DS3231_sqw.c, without the TIM2 capture: back to the 1Hz square wave
+HAL_StatusTypeDef sqw_start(void)
+{
+	uint8_t index = 0x0E;
+	uint8_t control;
+	HAL_StatusTypeDef rc = i2c_write_read(DS3231_ADDRESS, &index, sizeof(index), &control, sizeof(control));
+	if(HAL_OK != rc) return rc;
+	uint8_t index_control[2] = {0x0E, (uint8_t)(control & ~0x1F)};
+	return i2c_write_read(DS3231_ADDRESS, index_control, sizeof(index_control), NULL, 0);
+}
+
+// Power mode off (power.c)
+HAL_StatusTypeDef power_int_restore(void) { return sqw_start(); }
+
+// One task at a time, run by run_task()
+static TASK * task;
+int task_start(TASK * t) { t->resume = 0; task = t; return 1; }
+int task_running(const TASK * t) { return task == t; }
+
+// fmt.c writes to the UART, collect the output instead
+static char fmt_out[1024];
+static size_t fmt_len;
+
+void fmt_begin(FMT * f) { f->len = 0; }
+void fmt_end(FMT * f)
+{
+	if(fmt_len + f->len < sizeof(fmt_out)) {
+		memcpy(fmt_out + fmt_len, f->buf, f->len);
+		fmt_len += f->len;
+		fmt_out[fmt_len] = 0;
+	}
+	f->len = 0;
+}
+void fmt_char(FMT * f, char c) { if(f->len == FMT_BUF_SIZE) fmt_end(f); f->buf[f->len++] = c; }
+void fmt_str(FMT * f, const char * s) { while(*s) fmt_char(f, *s++); }
+static void fmt_printf(FMT * f, const char * format, ...) __attribute__((format(printf, 2, 3)));
+static void fmt_printf(FMT * f, const char * format, ...)
+{
+	char s[32];
+	va_list ap;
+	va_start(ap, format);
+	vsnprintf(s, sizeof(s), format, ap);
+	va_end(ap);
+	fmt_str(f, s);
+}
+void fmt_u(FMT * f, uint32_t v, uint8_t width, char pad) { fmt_printf(f, pad == '0' ? "%0*u" : "%*u", width, v); }
+void fmt_x(FMT * f, uint32_t v, uint8_t width) { fmt_printf(f, "%0*X", width, v); }
+void fmt_fixed(FMT * f, int32_t v, uint8_t frac_bits, uint8_t decimals) { fmt_printf(f, "%.*f", decimals, v / (double)(1 << frac_bits)); }
+
+//=============================================================================
+
+// Run a command line function
+static int run_cmd(int (*cmd)(void), const char * arg)
+{
+	static char arg_buf[16];
+	argc = 1;
+	argv[0] = (char *)"cmd";
+	if(arg) {
+		snprintf(arg_buf, sizeof(arg_buf), "%s", arg);
+		argv[argc++] = arg_buf;
+	}
+	return cmd();
+}
+
+// Run the started task to completion, as the superloop would, checking every 10ms
+static void run_task(uint32_t max_ms)
+{
+	for(uint32_t ms = 0; task && ms < max_ms; ms += 10) {
+		if(TASK_DONE == task->run(task)) task = NULL;
+		emu_advance(10000);
+	}
+}
+
+static void dt_set(DATE_TIME * dt, int y, int m, int d, int hh, int mm, int ss)
+{
+	dt->yOff = (uint8_t)(y - 2000);
+	dt->m = (uint8_t)m;
+	dt->d = (uint8_t)d;
+	dt->hh = (uint8_t)hh;
+	dt->mm = (uint8_t)mm;
+	dt->ss = (uint8_t)ss;
+}
+
+static int dt_equal(const DATE_TIME * a, const DATE_TIME * b)
+{
+	return a->yOff == b->yOff && a->m == b->m && a->d == b->d && a->hh == b->hh && a->mm == b->mm && a->ss == b->ss;
+}
+
+static uint8_t bin2bcd(uint8_t val) { return val + 6 * (val / 10); }
+
+// Load the time registers through the back door, day of week 1 (Sunday) - 7
+static void emu_set_time(const DATE_TIME * dt)
+{
+	DATE_TIME t = *dt;
+	ds3231_emu.set_reg(Ds3231::SECONDS, bin2bcd(dt->ss));
+	ds3231_emu.set_reg(Ds3231::MINUTES, bin2bcd(dt->mm));
+	ds3231_emu.set_reg(Ds3231::HOURS, bin2bcd(dt->hh));
+	ds3231_emu.set_reg(Ds3231::DAY, dayOfTheWeek(&t) + 1);
+	ds3231_emu.set_reg(Ds3231::DATE, bin2bcd(dt->d));
+	ds3231_emu.set_reg(Ds3231::MONTH, bin2bcd(dt->m));
+	ds3231_emu.set_reg(Ds3231::YEAR, bin2bcd(dt->yOff));
+}
+
+//=============================================================================
+
+// Power-on state, OSF, time set / read through the driver
+static void test_power_on(void)
+{
+	ds3231_emu.power_on();
+	CHECK(ds3231_emu.reg(Ds3231::CONTROL) == 0x1C && ds3231_emu.reg(Ds3231::STATUS) == 0x88,
+			"power-on control %02X status %02X", ds3231_emu.reg(Ds3231::CONTROL), ds3231_emu.reg(Ds3231::STATUS));
+	CHECK(ds3231_check() == HAL_ERROR, "OSF not reported after power-on");
+
+	DATE_TIME dt, rd;
+	dt_set(&dt, 2024, 2, 28, 23, 59, 58);
+	CHECK(write_ds3231(&dt) == HAL_OK, "write_ds3231() failed");
+	CHECK(ds3231_check() == HAL_OK, "OSF not cleared by write_ds3231()");
+	CHECK(ds3231_emu.reg(0) == 0x58 && ds3231_emu.reg(1) == 0x59 && ds3231_emu.reg(2) == 0x23
+			&& ds3231_emu.reg(4) == 0x28 && ds3231_emu.reg(5) == 0x02 && ds3231_emu.reg(6) == 0x24,
+			"BCD registers %02X %02X %02X %02X %02X %02X", ds3231_emu.reg(0), ds3231_emu.reg(1),
+			ds3231_emu.reg(2), ds3231_emu.reg(4), ds3231_emu.reg(5), ds3231_emu.reg(6));
+	emu_advance(3000000);
+	CHECK(read_ds3231(&rd) == HAL_OK, "read_ds3231() failed");
+	dt_set(&dt, 2024, 2, 29, 0, 0, 1);
+	CHECK(dt_equal(&rd, &dt), "after 3s: %02u/%02u/%02u %02u:%02u:%02u", rd.d, rd.m, rd.yOff, rd.hh, rd.mm, rd.ss);
+
+	// A stopped oscillator sets OSF and holds the time
+	ds3231_emu.stop_oscillator();
+	emu_advance(5000000);
+	read_ds3231(&rd);
+	CHECK(dt_equal(&rd, &dt) && ds3231_check() == HAL_ERROR, "stopped oscillator: %02u:%02u:%02u", rd.hh, rd.mm, rd.ss);
+	ds3231_emu.start_oscillator();
+	ds3231_clearOSF();
+	CHECK(ds3231_check() == HAL_OK, "OSF not cleared by ds3231_clearOSF()");
+	emu_advance(2000000);
+	read_ds3231(&rd);
+	CHECK(rd.ss == 3, "oscillator restarted: %02u:%02u:%02u", rd.hh, rd.mm, rd.ss);
+}
+
+// All 19 registers, read-only and write-0-to-clear bits, pointer auto-increment and wrap
+static void test_registers(void)
+{
+	ds3231_emu.power_on();
+	uint8_t wr[1 + Ds3231::REGS] = {0x00,
+			0x59, 0x59, 0x23, 0x07, 0x31, 0x92, 0x99,   // time, century set
+			0x81, 0x82, 0x83, 0xC4, 0x85, 0x86, 0x87,   // alarms
+			0x3C, 0xFF, 0x81, 0xAA, 0xBB};              // control (CONV), status, aging, temperature
+	uint8_t expect[Ds3231::REGS] = {
+			0x59, 0x59, 0x23, 0x07, 0x31, 0x92, 0x99,
+			0x81, 0x82, 0x83, 0xC4, 0x85, 0x86, 0x87,
+			0x1C, 0x88, 0x81, 0x19, 0x00};              // CONV done, OSF kept, temperature read-only
+	uint8_t rd[Ds3231::REGS];
+	uint8_t index = 0;
+	CHECK(i2c_write_read(DS3231_ADDRESS, wr, sizeof(wr), NULL, 0) == HAL_OK, "19 register write failed");
+	CHECK(ds3231_emu.pointer() == 0, "pointer after 19 register write: %02X", ds3231_emu.pointer());
+	CHECK(i2c_write_read(DS3231_ADDRESS, &index, 1, rd, sizeof(rd)) == HAL_OK, "19 register read failed");
+	for(unsigned i = 0; i < Ds3231::REGS; i++)
+		CHECK(rd[i] == expect[i], "register %02X: %02X, expected %02X", i, rd[i], expect[i]);
+
+	// Reads wrap from 12h to 00h, a read without an index continues at the pointer
+	index = 0x12;
+	uint8_t three[3];
+	i2c_write_read(DS3231_ADDRESS, &index, 1, three, sizeof(three));
+	CHECK(three[0] == 0x00 && three[1] == 0x59 && three[2] == 0x59 && ds3231_emu.pointer() == 2,
+			"wrap: %02X %02X %02X, pointer %02X", three[0], three[1], three[2], ds3231_emu.pointer());
+	i2c_write_read(DS3231_ADDRESS, NULL, 0, three, 2);
+	CHECK(three[0] == 0x23 && three[1] == 0x07 && ds3231_emu.pointer() == 4,
+			"read at pointer: %02X %02X, pointer %02X", three[0], three[1], ds3231_emu.pointer());
+
+	// Writes wrap too, the temperature registers ignore them
+	uint8_t wrap[4] = {0x11, 0x55, 0x66, 0x12};
+	i2c_write_read(DS3231_ADDRESS, wrap, sizeof(wrap), NULL, 0);
+	CHECK(ds3231_emu.reg(0x11) == 0x19 && ds3231_emu.reg(0x12) == 0x00 && ds3231_emu.reg(0) == 0x12,
+			"write wrap: %02X %02X %02X", ds3231_emu.reg(0x11), ds3231_emu.reg(0x12), ds3231_emu.reg(0));
+
+	// A1F / A2F / OSF can only be cleared, EN32kHz follows the write
+	ds3231_emu.set_reg(Ds3231::STATUS, 0x8B);
+	uint8_t status[2] = {0x0F, 0x03};
+	i2c_write_read(DS3231_ADDRESS, status, sizeof(status), NULL, 0);
+	CHECK(ds3231_emu.reg(Ds3231::STATUS) == 0x03, "status after writing 03: %02X", ds3231_emu.reg(Ds3231::STATUS));
+	status[1] = 0x8A;
+	i2c_write_read(DS3231_ADDRESS, status, sizeof(status), NULL, 0);
+	CHECK(ds3231_emu.reg(Ds3231::STATUS) == 0x0A, "status after writing 8A: %02X", ds3231_emu.reg(Ds3231::STATUS));
+
+	// The register dump decodes the temperature
+	ds3231_emu.set_temperature(-4 * 5 - 3); // -5.75C
+	fmt_len = 0;
+	run_cmd(cl_ds3231_dump, NULL);
+	CHECK(strstr(fmt_out, "0x87   Alarm2 Day-Date") && strstr(fmt_out, "Temperature: -5.75 C"), "dump:\n%s", fmt_out);
+}
+
+// Every day 2000 - 2099 rolls over to the next, as RTClib computes it
+static void test_calendar(void)
+{
+	ds3231_emu.power_on();
+	DATE_TIME dt, next;
+	unsigned days = 0;
+	dt_set(&dt, 2000, 1, 1, 23, 59, 59);
+	for(;;) {
+		emu_set_time(&dt);
+		next = dt;
+		rtcAddSeconds(&next, 1);
+		ds3231_emu.advance(1000000);
+		uint8_t century = next.yOff == 100 ? 0x80 : 0; // 2100: year 00, century bit toggled
+		uint8_t expect[7] = {0x00, 0x00, 0x00, (uint8_t)(dayOfTheWeek(&next) + 1), bin2bcd(next.d),
+				(uint8_t)(century | bin2bcd(next.m)), bin2bcd(next.yOff % 100)};
+		for(int i = 0; i < 7; i++) {
+			if(ds3231_emu.reg(i) != expect[i]) {
+				CHECK(0, "%02u/%02u/%02u 23:59:59 + 1s: register %d %02X, expected %02X",
+						dt.d, dt.m, dt.yOff, i, ds3231_emu.reg(i), expect[i]);
+				break;
+			}
+		}
+		days++;
+		if(dt.yOff == 99 && dt.m == 12 && dt.d == 31) break;
+		dt = next;
+		dt.hh = 23; dt.mm = 59; dt.ss = 59;
+	}
+	CHECK(days == 36525, "%u days checked", days);
+
+	// A whole year, second by second
+	dt_set(&dt, 2023, 1, 1, 0, 0, 0);
+	emu_set_time(&dt);
+	ds3231_emu.advance(365ULL * 86400 * 1000000);
+	CHECK(ds3231_emu.reg(Ds3231::YEAR) == 0x24 && ds3231_emu.reg(Ds3231::MONTH) == 0x01 && ds3231_emu.reg(Ds3231::DATE) == 0x01
+			&& ds3231_emu.reg(Ds3231::HOURS) == 0x00 && ds3231_emu.reg(Ds3231::SECONDS) == 0x00,
+			"2023 + 365 days: %02X/%02X/%02X %02X", ds3231_emu.reg(4), ds3231_emu.reg(5), ds3231_emu.reg(6), ds3231_emu.reg(2));
+
+	// 12 hour mode: bit 6 set, bit 5 PM
+	static const struct { uint8_t from; uint8_t to; } hours12[] = {
+			{0x51, 0x72}, // 11 AM -> 12 PM
+			{0x72, 0x61}, // 12 PM -> 1 PM
+			{0x71, 0x52}, // 11 PM -> 12 AM, next day
+			{0x52, 0x41}, // 12 AM -> 1 AM
+	};
+	for(unsigned i = 0; i < sizeof(hours12) / sizeof(hours12[0]); i++) {
+		dt_set(&dt, 2024, 3, 10, 0, 59, 59);
+		emu_set_time(&dt);
+		ds3231_emu.set_reg(Ds3231::HOURS, hours12[i].from);
+		ds3231_emu.advance(1000000);
+		CHECK(ds3231_emu.reg(Ds3231::HOURS) == hours12[i].to, "12 hour %02X -> %02X, expected %02X",
+				hours12[i].from, ds3231_emu.reg(Ds3231::HOURS), hours12[i].to);
+		uint8_t date = hours12[i].from == 0x71 ? 0x11 : 0x10;
+		CHECK(ds3231_emu.reg(Ds3231::DATE) == date, "12 hour %02X: date %02X", hours12[i].from, ds3231_emu.reg(Ds3231::DATE));
+	}
+
+	// Writing the seconds register restarts the 1s countdown
+	ds3231_emu.advance(700000);
+	uint8_t wr[2] = {0x00, 0x10};
+	ds3231_emu.transfer(Ds3231::ADDRESS, wr, sizeof(wr), NULL, 0);
+	ds3231_emu.advance(999999);
+	CHECK(ds3231_emu.reg(Ds3231::SECONDS) == 0x10, "seconds updated %02X, before 1s after the write", ds3231_emu.reg(0));
+	ds3231_emu.advance(1);
+	CHECK(ds3231_emu.reg(Ds3231::SECONDS) == 0x11, "seconds %02X, 1s after the write", ds3231_emu.reg(0));
+}
+
+// Seconds from Sunday 2024-03-10 10:20:30 until the alarm flag is set
+static uint32_t alarm_seconds(uint8_t first, const uint8_t * regs, uint8_t count, uint8_t flag, uint32_t limit)
+{
+	DATE_TIME dt;
+	dt_set(&dt, 2024, 3, 10, 10, 20, 30);
+	emu_set_time(&dt);
+	for(uint8_t i = 0; i < count; i++) ds3231_emu.set_reg(first + i, regs[i]);
+	ds3231_emu.set_reg(Ds3231::STATUS, 0);
+	for(uint32_t s = 1; s <= limit; s++) {
+		ds3231_emu.advance(1000000);
+		if(ds3231_emu.reg(Ds3231::STATUS) & flag) return s;
+	}
+	return 0;
+}
+
+static void test_alarms(void)
+{
+	static const struct { const char * name; uint8_t regs[4]; uint32_t seconds; } a1[] = {
+			{"every second",    {0x80, 0x80, 0x80, 0x80}, 1},
+			{"seconds",         {0x45, 0x80, 0x80, 0x80}, 15},
+			{"minutes seconds", {0x00, 0x21, 0x80, 0x80}, 30},
+			{"hours",           {0x00, 0x00, 0x11, 0x80}, 2370},
+			{"hours, 12h",      {0x00, 0x00, 0x71, 0x80}, 45570},           // 11 PM
+			{"date",            {0x30, 0x20, 0x10, 0x11}, 86400},
+			{"day of week",     {0x29, 0x20, 0x10, 0x43}, 2 * 86400 - 1},   // Tuesday, day 1 is Sunday
+	};
+	static const struct { const char * name; uint8_t regs[3]; uint32_t seconds; } a2[] = {
+			{"every minute",    {0x80, 0x80, 0x80}, 30},
+			{"minutes",         {0x25, 0x80, 0x80}, 270},
+			{"hours minutes",   {0x00, 0x12, 0x80}, 5970},
+			{"date",            {0x00, 0x00, 0x12}, 135570},
+	};
+	ds3231_emu.power_on();
+	// Date 0 never matches, keeping the other alarm quiet
+	for(unsigned i = 0; i < sizeof(a1) / sizeof(a1[0]); i++) {
+		ds3231_emu.set_reg(Ds3231::A2_MINUTES + 2, 0x00);
+		uint32_t s = alarm_seconds(Ds3231::A1_SECONDS, a1[i].regs, 4, Ds3231::STS_A1F, 3 * 86400);
+		CHECK(s == a1[i].seconds, "alarm 1 %s: A1F after %u s, expected %u", a1[i].name, s, a1[i].seconds);
+		CHECK(!(ds3231_emu.reg(Ds3231::STATUS) & Ds3231::STS_A2F), "alarm 1 %s set A2F", a1[i].name);
+	}
+	for(unsigned i = 0; i < sizeof(a2) / sizeof(a2[0]); i++) {
+		ds3231_emu.set_reg(Ds3231::A1_SECONDS + 3, 0x00);
+		uint32_t s = alarm_seconds(Ds3231::A2_MINUTES, a2[i].regs, 3, Ds3231::STS_A2F, 3 * 86400);
+		CHECK(s == a2[i].seconds, "alarm 2 %s: A2F after %u s, expected %u", a2[i].name, s, a2[i].seconds);
+	}
+
+	// The "alarm" command: alarm 1 five seconds ahead on INT, a task polls A1F, then back to 1Hz SQW
+	ds3231_emu.power_on();
+	DATE_TIME dt;
+	dt_set(&dt, 2024, 3, 10, 10, 20, 30);
+	write_ds3231(&dt);
+	run_cmd(cl_alarm, NULL);
+	uint8_t ctl = ds3231_emu.reg(Ds3231::CONTROL);
+	CHECK((ctl & (Ds3231::CTL_INTCN | Ds3231::CTL_A1IE)) == (Ds3231::CTL_INTCN | Ds3231::CTL_A1IE) && ds3231_emu.sqw_level(),
+			"alarm set: control %02X, INT %d", ctl, ds3231_emu.sqw_level());
+	uint64_t start = emu_now_us();
+	uint32_t asserted_ms = 0;
+	for(uint32_t ms = 0; ms < 6000 && !asserted_ms; ms += 10) {
+		emu_advance(10000);
+		if(!ds3231_emu.sqw_level()) asserted_ms = (uint32_t)((emu_now_us() - start) / 1000);
+	}
+	CHECK(asserted_ms > 4000 && asserted_ms <= 5010, "INT asserted after %u ms", asserted_ms);
+	run_task(1000);
+	CHECK(!task && ds3231_emu.sqw_hz() == 1, "alarm task: %s, SQW %u Hz", task ? "running" : "done", ds3231_emu.sqw_hz());
+}
+
+// Count INT/SQW falling edges over one second
+static unsigned sqw_edges(void)
+{
+	unsigned hz = ds3231_emu.sqw_hz();
+	uint64_t step = hz ? 1000000 / (8 * hz) : 1000;
+	unsigned edges = 0;
+	int level = ds3231_emu.sqw_level();
+	for(uint64_t t = 0; t < 1000000; t += step) {
+		ds3231_emu.advance(step);
+		int now = ds3231_emu.sqw_level();
+		edges += level && !now;
+		level = now;
+	}
+	return edges;
+}
+
+static void test_sqw(void)
+{
+	static const unsigned rates[4] = {1, 1024, 4096, 8192};
+	ds3231_emu.power_on();
+	CHECK(ds3231_emu.sqw_hz() == 0 && ds3231_emu.sqw_level() == 1, "power-on: SQW %u Hz", ds3231_emu.sqw_hz());
+	for(unsigned rs = 0; rs < 4; rs++) {
+		char arg[2] = {(char)('0' + rs), 0};
+		run_cmd(cl_sqw_test, arg);
+		CHECK(ds3231_emu.reg(Ds3231::CONTROL) == rs << 3 && ds3231_emu.sqw_hz() == rates[rs],
+				"sqwtest %u: control %02X, %u Hz", rs, ds3231_emu.reg(Ds3231::CONTROL), ds3231_emu.sqw_hz());
+		unsigned edges = sqw_edges();
+		CHECK(edges >= rates[rs] - 1 && edges <= rates[rs] + 1, "sqwtest %u: %u edges in 1s", rs, edges);
+	}
+
+	// 1Hz: the falling edge is the seconds update
+	run_cmd(cl_sqw_test, "0");
+	uint8_t ss = ds3231_emu.reg(Ds3231::SECONDS);
+	int level = ds3231_emu.sqw_level();
+	unsigned misses = 0;
+	for(int ms = 0; ms < 3000; ms++) {
+		ds3231_emu.advance(1000);
+		int now = ds3231_emu.sqw_level();
+		misses += (level && !now) != (ds3231_emu.reg(Ds3231::SECONDS) != ss);
+		level = now;
+		ss = ds3231_emu.reg(Ds3231::SECONDS);
+	}
+	CHECK(!misses, "1Hz: %u falling edges not at a seconds update", misses);
+
+	run_cmd(cl_sqw_test, NULL);
+	CHECK(ds3231_emu.sqw_hz() == 0 && sqw_edges() == 0, "sqwtest: SQW still on");
+}
+
+// NACK, a hung bus, an absent device, and injected failures
+static void test_faults(void)
+{
+	DATE_TIME dt;
+	ds3231_emu.power_on();
+	ds3231_emu.inject(Ds3231::FAULT_NACK);
+	uint32_t errors_before = i2c_stats.errors;
+	CHECK(read_ds3231(&dt) == HAL_ERROR && ds3231_emu.counters.nacks == 1, "NACK: not reported");
+	CHECK(i2c_stats.errors == errors_before + 1, "NACK: i2c_stats.errors %u", i2c_stats.errors - errors_before);
+	CHECK(read_ds3231(&dt) == HAL_OK, "NACK: the next read failed");
+
+	uint8_t index = 0;
+	uint8_t data;
+	CHECK(i2c_write_read(0x57, &index, 1, &data, 1) == HAL_ERROR && ds3231_emu.counters.nacks == 2, "absent device ACKed");
+
+	// The hung transfer is aborted after I2C_XFER_TIMEOUT, the bus re-initialized
+	uint32_t aborts = i2c_queue_stats.aborts;
+	ds3231_emu.inject(Ds3231::FAULT_TIMEOUT);
+	uint64_t start = emu_now_us();
+	HAL_StatusTypeDef rc = read_ds3231(&dt);
+	uint64_t ms = (emu_now_us() - start) / 1000;
+	CHECK(rc == HAL_TIMEOUT && ms >= I2C_XFER_TIMEOUT && ms <= I2C_XFER_TIMEOUT + 2, "timeout: rc %d after %u ms", rc, (unsigned)ms);
+	CHECK(i2c_queue_stats.aborts == aborts + 1 && ds3231_emu.counters.resets == 1 && ds3231_emu.counters.timeouts == 1,
+			"timeout: %u aborts, %u resets", i2c_queue_stats.aborts - aborts, ds3231_emu.counters.resets);
+	CHECK(!emu_i2c_busy() && read_ds3231(&dt) == HAL_OK, "timeout: bus not recovered");
+
+	// write_ds3231() stops at the first failure, the registers are untouched
+	uint8_t seconds = ds3231_emu.reg(Ds3231::SECONDS);
+	dt_set(&dt, 2030, 6, 15, 12, 0, 0);
+	ds3231_emu.inject(Ds3231::FAULT_NACK, 2);
+	CHECK(write_ds3231(&dt) == HAL_ERROR && ds3231_emu.reg(Ds3231::SECONDS) == seconds, "write_ds3231() after a NACK");
+	CHECK(ds3231_check() == HAL_ERROR && ds3231_emu.counters.nacks == 4, "second NACK not reported");
+	CHECK(ds3231_emu.reg(Ds3231::STATUS) & Ds3231::STS_OSF, "OSF cleared, the write never happened");
+
+	// "i2cfault 2": the next two calls fail without touching the bus
+	uint32_t transactions = ds3231_emu.counters.transactions;
+	uint32_t injected = i2c_stats.injected;
+	run_cmd(cl_i2c_fault, "2");
+	CHECK(read_ds3231(&dt) == HAL_ERROR && ds3231_check() == HAL_ERROR && read_ds3231(&dt) == HAL_OK,
+			"i2cfault 2: not exactly two failures");
+	CHECK(i2c_stats.injected == injected + 2 && ds3231_emu.counters.transactions == transactions + 1,
+			"i2cfault 2: %u injected, %u bus transactions", i2c_stats.injected - injected,
+			ds3231_emu.counters.transactions - transactions);
+}
+
+// A read queued behind a write to the same registers must not be merged into an earlier read
+static void test_queue_order(void)
+{
+	ds3231_emu.power_on();
+	uint8_t status, alarm[4], after;
+	uint8_t seconds = 0x45;
+	I2C_REQUEST req[4] = {};
+	for(int i = 0; i < 4; i++) {
+		req[i].dev = DS3231_ADDRESS;
+		req[i].op = I2C_OP_MEM_READ;
+	}
+	req[0].reg = 0x0F; req[0].data = &status;  req[0].len = 1; // starts at once, the rest queue
+	req[1].reg = 0x07; req[1].data = alarm;    req[1].len = sizeof(alarm);
+	req[2].reg = 0x07; req[2].data = &seconds; req[2].len = 1; req[2].op = I2C_OP_MEM_WRITE;
+	req[3].reg = 0x07; req[3].data = &after;   req[3].len = 1;
+	uint32_t transactions = ds3231_emu.counters.transactions;
+	for(int i = 0; i < 4; i++) i2c_submit(&req[i]);
+	while(req[3].state != I2C_REQ_DONE) i2c_queue_poll();
+	CHECK(alarm[0] == 0x00 && after == 0x45, "write then read: read 0x%02X before, 0x%02X after the write", alarm[0], after);
+	CHECK(ds3231_emu.counters.transactions == transactions + 4, "write then read: %u bus transactions",
+			ds3231_emu.counters.transactions - transactions);
+}
+
+// cl_i2c.c's i2c_stats must agree with the bus for successful transfers
+static void test_counters(void)
+{
+	ds3231_emu.power_on();
+	i2c_stats = I2C_STATS();
+	DATE_TIME dt;
+	for(int i = 0; i < 10; i++) read_ds3231(&dt);
+	dt_set(&dt, 2025, 1, 2, 3, 4, 5);
+	write_ds3231(&dt);
+	ds3231_check();
+	run_cmd(cl_ds3231_dump, NULL);
+	run_cmd(cl_sqw_test, "2");
+	run_cmd(cl_i2c_read, NULL);
+	run_cmd(cl_i2c_write, NULL);
+	CHECK(i2c_stats.transactions == ds3231_emu.counters.transactions && i2c_stats.bytes == ds3231_emu.counters.bytes,
+			"i2c_stats %u transactions %u bytes, bus %u transactions %u bytes", i2c_stats.transactions, i2c_stats.bytes,
+			ds3231_emu.counters.transactions, ds3231_emu.counters.bytes);
+	printf("i2c_stats: %u transactions, %u bytes - matches the bus\n", i2c_stats.transactions, i2c_stats.bytes);
+}
+
+//=============================================================================
+// Benchmarks: bus cost of each driver call, and host time per emulated call
+
+typedef struct {
+	uint32_t transactions;
+	uint32_t bytes;
+	uint64_t bus_us;
+	double host_ns;
+} COST;
+
+static uint64_t ns_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static COST measure(void (*op)(void), unsigned n)
+{
+	COST c;
+	Ds3231::Counters before = ds3231_emu.counters;
+	uint64_t bus = emu_now_us();
+	uint64_t t0 = ns_now();
+	for(unsigned i = 0; i < n; i++) op();
+	c.host_ns = (double)(ns_now() - t0) / n;
+	c.transactions = ds3231_emu.counters.transactions - before.transactions;
+	c.bytes = ds3231_emu.counters.bytes - before.bytes;
+	c.bus_us = emu_now_us() - bus;
+	return c;
+}
+
+static void op_read_time(void) { DATE_TIME dt; read_ds3231(&dt); }
+static void op_check(void) { ds3231_check(); }
+static void op_write_time(void) { DATE_TIME dt = {24, 3, 10, 10, 20, 30}; write_ds3231(&dt); }
+static void op_dump(void) { fmt_len = 0; run_cmd(cl_ds3231_dump, NULL); }
+
+// A status read, the clock display's time read and an alarm 1 read, one after the other
+static void op_time_alarm_serial(void)
+{
+	uint8_t status, time[7], alarm[4];
+	uint8_t index = 0x0F;
+	i2c_write_read(DS3231_ADDRESS, &index, 1, &status, 1);
+	index = 0x00;
+	i2c_write_read(DS3231_ADDRESS, &index, 1, time, sizeof(time));
+	index = 0x07;
+	i2c_write_read(DS3231_ADDRESS, &index, 1, alarm, sizeof(alarm));
+}
+
+// The same reads queued together: the status read starts at once, i2c_queue.c merges the
+// other two into one burst
+static void op_time_alarm_queued(void)
+{
+	uint8_t status, time[7], alarm[4];
+	I2C_REQUEST req[3] = {};
+	req[0].dev = req[1].dev = req[2].dev = DS3231_ADDRESS;
+	req[0].op = req[1].op = req[2].op = I2C_OP_MEM_READ;
+	req[0].reg = 0x0F; req[0].data = &status; req[0].len = 1;
+	req[1].reg = 0x00; req[1].data = time;    req[1].len = sizeof(time);
+	req[2].reg = 0x07; req[2].data = alarm;   req[2].len = sizeof(alarm);
+	for(int i = 0; i < 3; i++) i2c_submit(&req[i]);
+	while(req[0].state != I2C_REQ_DONE || req[1].state != I2C_REQ_DONE || req[2].state != I2C_REQ_DONE)
+		i2c_queue_poll();
+}
+
+static void bench(void)
+{
+	static const struct { const char * name; void (*op)(void); } ops[] = {
+			{"read_ds3231()", op_read_time},
+			{"ds3231_check()", op_check},
+			{"write_ds3231()", op_write_time},
+			{"ds3231dump", op_dump},
+			{"3 reads, serial", op_time_alarm_serial},
+			{"3 reads, queued", op_time_alarm_queued},
+	};
+	const unsigned n = 10000;
+	ds3231_emu.power_on();
+	printf("\n%-22s %8s %8s %8s %8s   (per call, I2C1 at 100kHz)\n", "", "trans", "bytes", "bus us", "host ns");
+	for(unsigned i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+		uint32_t merged = i2c_queue_stats.merged;
+		COST c = measure(ops[i].op, n);
+		printf("%-22s %8.2f %8.2f %8.1f %8.0f", ops[i].name, (double)c.transactions / n, (double)c.bytes / n,
+				(double)c.bus_us / n, c.host_ns);
+		if(i2c_queue_stats.merged != merged) printf("   %.2f merged", (double)(i2c_queue_stats.merged - merged) / n);
+		printf("\n");
+	}
+}
+
+int main(void)
+{
+	test_power_on();
+	test_registers();
+	test_calendar();
+	test_alarms();
+	test_sqw();
+	test_faults();
+	test_queue_order();
+	test_counters();
+	bench();
+	printf("%d errors\n", errors);
+	return errors != 0;
+}
@@ -0,0 +1,81 @@
+// stm32f1xx_hal.h, host (Linux) stand-in for the STM32F1 HAL
+//
+// Just enough of the HAL for the I2C1 modules (Core/Src/DS3231.c, cl_i2c.c, i2c_queue.c) to
+// compile on the host.  Put Tools/host ahead of Core/Inc on the include path and main.h picks
+// this file up instead of the real HAL.  HAL_GetTick() and the HAL_I2C_xxx() functions are
+// implemented by the DS3231 emulator, Tools/ds3231_emu.cpp.
+
+#ifndef __STM32F1XX_HAL_H
+#define __STM32F1XX_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	HAL_OK      = 0x00U,
+	HAL_ERROR   = 0x01U,
+	HAL_BUSY    = 0x02U,
+	HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+#define HAL_I2C_ERROR_NONE    0x00000000U
+#define HAL_I2C_ERROR_AF      0x00000004U // acknowledge failure (NACK)
+#define HAL_I2C_ERROR_TIMEOUT 0x00000020U
+#define I2C_MEMADD_SIZE_8BIT  0x00000001U
+
+typedef struct {
+	uint32_t ErrorCode;
+} I2C_HandleTypeDef;
+
+typedef struct {
+	uint32_t IDR;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef host_gpioa, host_gpiob, host_gpioc;
+#define GPIOA (&host_gpioa)
+#define GPIOB (&host_gpiob)
+#define GPIOC (&host_gpioc)
+
+#define GPIO_PIN_0  ((uint16_t)0x0001)
+#define GPIO_PIN_2  ((uint16_t)0x0004)
+#define GPIO_PIN_3  ((uint16_t)0x0008)
+#define GPIO_PIN_5  ((uint16_t)0x0020)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+
+#define EXTI15_10_IRQn 40
+
+// Interrupt mask.  The emulator delivers I2C completions ("interrupts") only while it is clear.
+extern volatile uint32_t host_primask;
+static inline uint32_t __get_PRIMASK(void) { return host_primask; }
+static inline void __set_PRIMASK(uint32_t primask) { host_primask = primask; }
+static inline void __disable_irq(void) { host_primask = 1; }
+static inline void __enable_irq(void) { host_primask = 0; }
+
+uint32_t HAL_GetTick(void);
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c);
+HAL_StatusTypeDef HAL_I2C_Mem_Read_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Mem_Write_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress, uint16_t MemAddSize, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Master_Receive_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_I2C_Master_Transmit_IT(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint8_t *pData, uint16_t Size);
+
+// Completion callbacks, implemented by i2c_queue.c
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c);
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __STM32F1XX_HAL_H
@@ -0,0 +1,103 @@
+// proto_host.c, host (Linux) side of the binary control protocol, see proto_host.h
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "proto.h" // PROTO_SYN
+#include "proto_host.h"
+
+// Serial port, 115200 8N1 raw (the clock's USART2)
+int proto_host_open(PROTO_HOST * h, const char * tty)
+{
+	int fd = open(tty, O_RDWR | O_NOCTTY);
+	if(fd < 0) return -1;
+	struct termios t;
+	if(tcgetattr(fd, &t) < 0) {
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&t);
+	cfsetspeed(&t, B115200);
+	t.c_cflag |= CLOCAL | CREAD;
+	t.c_cc[VMIN] = 0;
+	t.c_cc[VTIME] = 0;
+	if(tcsetattr(fd, TCSANOW, &t) < 0) {
+		close(fd);
+		return -1;
+	}
+	proto_host_attach(h, fd);
+	return 0;
+}
+
+void proto_host_attach(PROTO_HOST * h, int fd)
+{
+	memset(h, 0, sizeof(*h));
+	h->fd = fd;
+	proto_decoder_reset(&h->dec);
+}
+
+void proto_host_close(PROTO_HOST * h)
+{
+	close(h->fd);
+	h->fd = -1;
+}
+
+static int write_all(int fd, const uint8_t * p, size_t len)
+{
+	while(len) {
+		ssize_t n = write(fd, p, len);
+		if(n <= 0) return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// Switch the clock's command line to binary mode
+int proto_host_enter(PROTO_HOST * h)
+{
+	static const uint8_t syn[2] = {PROTO_SYN, PROTO_SYN};
+	return write_all(h->fd, syn, sizeof(syn));
+}
+
+// Start a request frame with the next sequence number
+void proto_host_begin(PROTO_HOST * h, PROTO_ENCODER * req)
+{
+	proto_encode_begin(req, ++h->seq);
+}
+
+// Finish and send the request, wait for its response in h->dec.
+// Return 0, or -1 after PROTO_HOST_RETRIES timeouts or an I/O error.
+int proto_host_transact(PROTO_HOST * h, PROTO_ENCODER * req)
+{
+	uint16_t len = proto_encode_end(req);
+	h->requests++;
+	for(int attempt = 0; attempt <= PROTO_HOST_RETRIES; attempt++) {
+		if(attempt) h->retries++;
+		if(write_all(h->fd, req->buf, len)) return -1;
+		struct pollfd p = {h->fd, POLLIN, 0};
+		while(poll(&p, 1, PROTO_HOST_TIMEOUT_MS) > 0) {
+			uint8_t buf[64];
+			ssize_t n = read(h->fd, buf, sizeof(buf));
+			if(n <= 0) return -1;
+			for(ssize_t i = 0; i < n; i++) {
+				switch(proto_decode(&h->dec, buf[i])) {
+				case PROTO_FRAME:
+					if(h->dec.seq == h->seq) return 0; // bytes after it are not expected
+					h->bad_frames++; // response to an earlier, retried request
+					break;
+				case PROTO_BAD_CRC:
+				case PROTO_BAD_LEN:
+					h->bad_frames++;
+					break;
+				default:
+					break;
+				}
+			}
+		}
+	}
+	return -1;
+}
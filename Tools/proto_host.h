@@ -0,0 +1,52 @@
+// proto_host.h, host (Linux) side of the binary control protocol
+//
+// Sends request frames built with proto_frame.c's encoder to the clock and waits for the
+// response with the same sequence number, retrying on a timeout.  Works on a serial port
+// (proto_host_open()) or any other file descriptor (proto_host_attach(), e.g. a socket pair
+// in Tools/proto_test.c).
+//
+//   PROTO_HOST h;
+//   PROTO_ENCODER e;
+//   PROTO_ITEM item;
+//   uint8_t pos = 0;
+//   proto_host_open(&h, "/dev/ttyACM0");
+//   proto_host_enter(&h);
+//   proto_host_begin(&h, &e);
+//   proto_encode_request(&e, PROTO_OP_GET_TIME, NULL, 0);
+//   if(proto_host_transact(&h, &e) == 0)
+//       while(proto_next_response(h.dec.payload, h.dec.len, &pos, &item)) ...
+
+#ifndef __PROTO_HOST_H__
+#define __PROTO_HOST_H__
+
+#include <stdint.h>
+#include "proto_frame.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROTO_HOST_TIMEOUT_MS 500
+#define PROTO_HOST_RETRIES    3
+
+typedef struct {
+	int fd;
+	uint8_t seq;          // of the last request
+	PROTO_DECODER dec;    // holds the last response frame
+	uint32_t requests;
+	uint32_t retries;     // requests sent again after a timeout
+	uint32_t bad_frames;  // CRC / length errors and stale sequence numbers
+} PROTO_HOST;
+
+int proto_host_open(PROTO_HOST * h, const char * tty);
+void proto_host_attach(PROTO_HOST * h, int fd);
+void proto_host_close(PROTO_HOST * h);
+int proto_host_enter(PROTO_HOST * h);
+void proto_host_begin(PROTO_HOST * h, PROTO_ENCODER * req);
+int proto_host_transact(PROTO_HOST * h, PROTO_ENCODER * req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __PROTO_HOST_H__
@@ -0,0 +1,295 @@
+// proto_test.c, Linux loopback test of the binary control protocol
+//
+// Build (Linux, from the repository root):
+//   gcc -O2 -ICore/Inc -ITools -o proto_test Tools/proto_test.c Tools/proto_host.c Core/Src/proto_frame.c
+// Use:
+//   proto_test
+//
+// A child process plays the clock on one end of a socket pair: it decodes frames with
+// proto_decode() and answers them with proto_serve(), the same code the firmware runs, over a
+// small model of the clock's state.  It prints a line of text before each response, like the
+// command line can.  The parent drives it through the host library (proto_host.c) and checks
+// pipelining, argument checks (SET_DATE against the days in the month), truncated and
+// oversized requests, unknown operations, retry after a lost frame, then measures operations
+// per second one per frame and pipelined.  Returns 1 if a check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "proto_frame.h"
+#include "proto_host.h"
+
+#define OP_DROP_ONCE 0x60 // test only: the clock drops the first frame holding it
+#define BENCH_OPS    20000
+
+typedef struct { // model of the clock
+	uint8_t time[3], date[3];
+	uint8_t bright[2];
+	uint8_t exit;
+	uint32_t frames, ops;
+} CLOCK;
+
+static int errors;
+
+#define CHECK(cond, ...) do { if(!(cond)) { errors++; printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } while(0)
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// PROTO_HANDLER of the clock model
+static uint8_t clock_op(const PROTO_ITEM * req, uint8_t * data, uint8_t * len, void * ctx)
+{
+	CLOCK * c = ctx;
+	const uint8_t * a = req->data;
+	switch(req->op) {
+	case PROTO_OP_GET_TIME:   memcpy(data, c->time, 3); *len = 3; return PROTO_OK;
+	case PROTO_OP_SET_TIME:   memcpy(c->time, a, 3); return PROTO_OK;
+	case PROTO_OP_GET_DATE:   memcpy(data, c->date, 3); *len = 3; return PROTO_OK;
+	case PROTO_OP_SET_DATE:   memcpy(c->date, a, 3); return PROTO_OK;
+	case PROTO_OP_GET_BRIGHT: memcpy(data, c->bright, 2); *len = 2; return PROTO_OK;
+	case PROTO_OP_SET_BRIGHT: memcpy(c->bright, a, 2); return PROTO_OK;
+	case PROTO_OP_READ_REG:
+		for(uint8_t i = 0; i < a[2]; i++) data[i] = a[1] + i;
+		*len = a[2];
+		return PROTO_OK;
+	case PROTO_OP_GET_STATS:
+		memset(data, 0, PROTO_STATS_COUNT * 4);
+		memcpy(&data[5 * 4], &c->frames, 4); // protocol frames, little endian host
+		*len = PROTO_STATS_COUNT * 4;
+		return PROTO_OK;
+	case PROTO_OP_EXIT:       c->exit = 1; return PROTO_OK;
+	case OP_DROP_ONCE:        return PROTO_OK;
+	default:                  return PROTO_ERR_OP;
+	}
+}
+
+// The clock end of the socket pair
+static void clock_run(int fd)
+{
+	static const char noise[] = "text output\r\n>";
+	CLOCK c = {{12, 34, 56}, {18, 10, 26}, {4, 1}, 0, 0, 0};
+	PROTO_DECODER dec;
+	PROTO_ENCODER out;
+	int dropped = 0;
+	proto_decoder_reset(&dec);
+	while(!c.exit) {
+		uint8_t buf[256];
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if(n <= 0) break;
+		for(ssize_t i = 0; i < n && !c.exit; i++) {
+			if(PROTO_FRAME != proto_decode(&dec, buf[i])) continue;
+			if(dec.payload[0] == OP_DROP_ONCE && !dropped++) continue;
+			c.frames++;
+			c.ops += proto_serve(dec.payload, dec.len, dec.seq, &out, clock_op, &c);
+			if(write(fd, noise, sizeof(noise) - 1) < 0 || write(fd, out.buf, out.len) < 0) return;
+		}
+	}
+}
+
+// Next response operation, NULL at the end
+static const PROTO_ITEM * next(PROTO_HOST * h, uint8_t * pos)
+{
+	static PROTO_ITEM item;
+	return proto_next_response(h->dec.payload, h->dec.len, pos, &item) ? &item : NULL;
+}
+
+static void expect(const PROTO_ITEM * item, uint8_t op, uint8_t status, const char * what)
+{
+	CHECK(item && item->op == op && item->status == status, "%s: op %02X status %u, expected op %02X status %u",
+			what, item ? item->op : 0, item ? item->status : 0, op, status);
+}
+
+// Send a request payload as is, bypassing the encoder (truncated operations)
+static int transact_raw(PROTO_HOST * h, const uint8_t * payload, uint8_t len)
+{
+	PROTO_ENCODER e;
+	proto_host_begin(h, &e);
+	memcpy(&e.buf[e.len], payload, len);
+	e.len += len;
+	return proto_host_transact(h, &e);
+}
+
+static void test_pipeline(PROTO_HOST * h)
+{
+	static const uint8_t reg[3] = {0x68, 0x0E, 2};
+	PROTO_ENCODER e;
+	uint8_t pos = 0;
+	const PROTO_ITEM * item;
+	proto_host_begin(h, &e);
+	proto_encode_request(&e, PROTO_OP_GET_TIME, NULL, 0);
+	proto_encode_request(&e, PROTO_OP_GET_DATE, NULL, 0);
+	proto_encode_request(&e, PROTO_OP_READ_REG, reg, sizeof(reg));
+	proto_encode_request(&e, 0x55, NULL, 0); // unknown, later operations still run
+	proto_encode_request(&e, PROTO_OP_GET_BRIGHT, NULL, 0);
+	proto_encode_request(&e, PROTO_OP_GET_STATS, NULL, 0);
+	CHECK(proto_host_transact(h, &e) == 0, "pipeline: no response");
+	item = next(h, &pos); expect(item, PROTO_OP_GET_TIME, PROTO_OK, "GET_TIME");
+	CHECK(item && item->len == 3 && item->data[0] == 12 && item->data[2] == 56, "GET_TIME data");
+	item = next(h, &pos); expect(item, PROTO_OP_GET_DATE, PROTO_OK, "GET_DATE");
+	item = next(h, &pos); expect(item, PROTO_OP_READ_REG, PROTO_OK, "READ_REG");
+	CHECK(item && item->len == 2 && item->data[0] == 0x0E && item->data[1] == 0x0F, "READ_REG data");
+	item = next(h, &pos); expect(item, 0x55, PROTO_ERR_OP, "unknown op");
+	item = next(h, &pos); expect(item, PROTO_OP_GET_BRIGHT, PROTO_OK, "GET_BRIGHT");
+	item = next(h, &pos); expect(item, PROTO_OP_GET_STATS, PROTO_OK, "GET_STATS");
+	CHECK(item && item->len == PROTO_STATS_COUNT * 4, "GET_STATS length");
+	CHECK(!next(h, &pos), "pipeline: extra operations");
+}
+
+static void test_set_get(PROTO_HOST * h)
+{
+	static const uint8_t t[3] = {23, 59, 58};
+	PROTO_ENCODER e;
+	uint8_t pos = 0;
+	const PROTO_ITEM * item;
+	proto_host_begin(h, &e);
+	proto_encode_request(&e, PROTO_OP_SET_TIME, t, sizeof(t));
+	proto_encode_request(&e, PROTO_OP_GET_TIME, NULL, 0);
+	CHECK(proto_host_transact(h, &e) == 0, "set/get: no response");
+	item = next(h, &pos); expect(item, PROTO_OP_SET_TIME, PROTO_OK, "SET_TIME");
+	item = next(h, &pos); expect(item, PROTO_OP_GET_TIME, PROTO_OK, "GET_TIME after SET_TIME");
+	CHECK(item && item->len == 3 && !memcmp(item->data, t, 3), "time not set");
+}
+
+// SET_DATE is checked against the days in the month, leap years included
+static void test_dates(PROTO_HOST * h)
+{
+	static const struct { uint8_t d, m, y, status; } dates[] = {
+		{29, 2, 24, PROTO_OK}, {29, 2, 23, PROTO_ERR_ARG}, {28, 2, 23, PROTO_OK}, {29, 2, 0, PROTO_OK},
+		{31, 4, 26, PROTO_ERR_ARG}, {30, 4, 26, PROTO_OK}, {31, 12, 99, PROTO_OK}, {31, 1, 26, PROTO_OK},
+		{0, 1, 26, PROTO_ERR_ARG}, {1, 0, 26, PROTO_ERR_ARG}, {1, 13, 26, PROTO_ERR_ARG}, {1, 1, 100, PROTO_ERR_ARG},
+		{31, 6, 26, PROTO_ERR_ARG}, {31, 9, 26, PROTO_ERR_ARG}, {31, 11, 26, PROTO_ERR_ARG}, {32, 1, 26, PROTO_ERR_ARG},
+	};
+	PROTO_ENCODER e;
+	uint8_t pos = 0;
+	proto_host_begin(h, &e);
+	for(unsigned i = 0; i < sizeof(dates) / sizeof(dates[0]); i++) {
+		uint8_t a[3] = {dates[i].d, dates[i].m, dates[i].y};
+		proto_encode_request(&e, PROTO_OP_SET_DATE, a, sizeof(a));
+	}
+	CHECK(proto_host_transact(h, &e) == 0, "dates: no response");
+	for(unsigned i = 0; i < sizeof(dates) / sizeof(dates[0]); i++) {
+		const PROTO_ITEM * item = next(h, &pos);
+		CHECK(item && item->op == PROTO_OP_SET_DATE && item->status == dates[i].status,
+				"SET_DATE %u/%u/%u: status %u, expected %u", dates[i].d, dates[i].m, dates[i].y,
+				item ? item->status : 0, dates[i].status);
+	}
+}
+
+// Malformed requests still get a response that decodes
+static void test_malformed(PROTO_HOST * h)
+{
+	static const uint8_t truncated[] = {PROTO_OP_GET_TIME, 0, PROTO_OP_SET_TIME, 3, 12};
+	static const uint8_t one_byte[] = {PROTO_OP_GET_TIME};
+	static const uint8_t bad_len[] = {PROTO_OP_SET_TIME, 2, 12, 34};
+	uint8_t pos = 0;
+	const PROTO_ITEM * item;
+
+	CHECK(transact_raw(h, truncated, sizeof(truncated)) == 0, "truncated: no response");
+	item = next(h, &pos); expect(item, PROTO_OP_GET_TIME, PROTO_OK, "before the truncated op");
+	item = next(h, &pos); expect(item, PROTO_OP_SET_TIME, PROTO_ERR_ARG, "truncated op");
+	CHECK(!next(h, &pos), "truncated: extra operations");
+
+	pos = 0;
+	CHECK(transact_raw(h, one_byte, sizeof(one_byte)) == 0, "one byte payload: no response");
+	item = next(h, &pos); expect(item, PROTO_OP_GET_TIME, PROTO_ERR_ARG, "one byte payload");
+
+	pos = 0;
+	CHECK(transact_raw(h, bad_len, sizeof(bad_len)) == 0, "argument length: no response");
+	item = next(h, &pos); expect(item, PROTO_OP_SET_TIME, PROTO_ERR_ARG, "argument length");
+}
+
+// Operations that might not fit in the response are answered with PROTO_ERR_ROOM
+static void test_room(PROTO_HOST * h)
+{
+	static const uint8_t reg[3] = {0x68, 0x00, PROTO_DATA_MAX};
+	PROTO_ENCODER e;
+	uint8_t pos = 0;
+	unsigned ok = 0;
+	const PROTO_ITEM * item;
+	proto_host_begin(h, &e);
+	for(int i = 0; i < 10; i++) proto_encode_request(&e, PROTO_OP_READ_REG, reg, sizeof(reg));
+	CHECK(proto_host_transact(h, &e) == 0, "room: no response");
+	while((item = next(h, &pos)) && item->status == PROTO_OK) ok++;
+	unsigned expected = PROTO_PAYLOAD_MAX / (3 + PROTO_DATA_MAX);
+	CHECK(ok == expected, "room: %u operations executed, expected %u", ok, expected);
+	expect(item, PROTO_OP_READ_REG, PROTO_ERR_ROOM, "room");
+	CHECK(!next(h, &pos), "room: operations after PROTO_ERR_ROOM");
+}
+
+// A lost frame is sent again after the timeout
+static void test_retry(PROTO_HOST * h)
+{
+	PROTO_ENCODER e;
+	uint32_t retries = h->retries;
+	proto_host_begin(h, &e);
+	proto_encode_request(&e, OP_DROP_ONCE, NULL, 0);
+	CHECK(proto_host_transact(h, &e) == 0, "retry: no response");
+	CHECK(h->retries == retries + 1, "retry: %u retries", h->retries - retries);
+}
+
+// Operations per second, one per frame and pipelined
+static void bench(PROTO_HOST * h)
+{
+	static const unsigned sizes[] = {1, 8, 32}; // 32 GET_TIME responses fit in a frame
+	for(unsigned k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+		unsigned per_frame = sizes[k];
+		double start = now_ns();
+		for(unsigned done = 0; done < BENCH_OPS; done += per_frame) {
+			PROTO_ENCODER e;
+			proto_host_begin(h, &e);
+			for(unsigned i = 0; i < per_frame; i++) proto_encode_request(&e, PROTO_OP_GET_TIME, NULL, 0);
+			if(proto_host_transact(h, &e)) {
+				CHECK(0, "bench: no response");
+				return;
+			}
+		}
+		double s = (now_ns() - start) / 1e9;
+		printf("%2u ops per frame: %8.0f ops/s, %6.1f us per round trip\n", per_frame, BENCH_OPS / s,
+				s * 1e6 * per_frame / BENCH_OPS);
+	}
+}
+
+int main(void)
+{
+	int sv[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	pid_t pid = fork();
+	if(pid == 0) {
+		close(sv[0]);
+		clock_run(sv[1]);
+		_exit(0);
+	}
+	close(sv[1]);
+
+	PROTO_HOST h;
+	proto_host_attach(&h, sv[0]);
+	proto_host_enter(&h);
+	test_pipeline(&h);
+	test_set_get(&h);
+	test_dates(&h);
+	test_malformed(&h);
+	test_room(&h);
+	test_retry(&h);
+	bench(&h);
+
+	PROTO_ENCODER e;
+	proto_host_begin(&h, &e);
+	proto_encode_request(&e, PROTO_OP_EXIT, NULL, 0);
+	CHECK(proto_host_transact(&h, &e) == 0, "exit: no response");
+	int status;
+	waitpid(pid, &status, 0);
+	proto_host_close(&h);
+	printf("%u requests, %u retries, %u bad frames, %d errors\n", h.requests, h.retries, h.bad_frames, errors);
+	return errors != 0;
+}
@@ -0,0 +1,276 @@
+// rtclib_test.c, host test and benchmark of the RTClib conversions (Core/Src/RTClib.c)
+//
+// Build (Linux, from the repository root):
+//   gcc -O2 -ICore/Inc -o rtclib_test Tools/rtclib_test.c Core/Src/RTClib.c
+// Use:
+//   rtclib_test
+//
+// RTClib.c is compiled unmodified.  Every second from 2000-01-01 00:00:00 through
+// 2099-12-31 23:59:59 is checked: unix2rtc() against an independent field-by-field clock and
+// against gmtime_r(), rtc2unix() back and against timegm(), rtc2seconds(), and rtcAddSeconds()
+// one second on.  dayOfTheWeek() is checked against gmtime_r() for every day, and buildTime()
+// for every month / day in the __DATE__ format.  Then the closed form conversions are timed
+// against the loop based originals kept as the reference, at the start, middle and end of the
+// range - the host version of the "rtctest" cycle table - and every RTClib function, with
+// gmtime_r() and timegm() for scale, is timed in ns per call over dates across the range.
+// The libc comparison makes the full run take about 12 minutes.
+// Returns 1 if a check fails.
+
+#define _DEFAULT_SOURCE // timegm()
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "RTClib.h"
+
+#define DAYS       36525 // 2000-01-01 through 2099-12-31
+#define BENCH_CALLS 1000000
+
+// Unix time of second s of day (from 2000-01-01)
+#define TIME_OF(day, s) (SECONDS_FROM_1970_TO_2000 + (uint32_t)(day) * (uint32_t)SECONDS_PER_DAY + (uint32_t)(s))
+
+static uint32_t errors;
+static volatile uint32_t sink;
+
+static void fail(const char * what, uint32_t t, const DATE_TIME * dt, const DATE_TIME * ref)
+{
+	if(errors++ < 10)
+		printf("%s at %u: %02u-%02u-%02u %02u:%02u:%02u expected %02u-%02u-%02u %02u:%02u:%02u\n", what, t,
+				dt->yOff, dt->m, dt->d, dt->hh, dt->mm, dt->ss, ref->yOff, ref->m, ref->d, ref->hh, ref->mm, ref->ss);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int is_leap(unsigned y)
+{
+	return y % 4 == 0 && (y % 100 != 0 || y % 400 == 0);
+}
+
+static unsigned month_days(unsigned y, unsigned m)
+{
+	static const uint8_t days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	return m == 2 && is_leap(y) ? 29 : days[m - 1];
+}
+
+// Independent clock: advance the fields by one second
+static void tick(DATE_TIME * dt)
+{
+	if(++dt->ss < 60) return;
+	dt->ss = 0;
+	if(++dt->mm < 60) return;
+	dt->mm = 0;
+	if(++dt->hh < 24) return;
+	dt->hh = 0;
+	if(++dt->d <= month_days(2000 + dt->yOff, dt->m)) return;
+	dt->d = 1;
+	if(++dt->m <= 12) return;
+	dt->m = 1;
+	dt->yOff++;
+}
+
+// Reference: original RTClib date2days(), loops over the months
+static uint16_t ref_date2days(uint16_t y, uint8_t m, uint8_t d)
+{
+	static const uint8_t days_in_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	if (y >= 2000U) y -= 2000U;
+	uint16_t days = d;
+	for (uint8_t i = 1; i < m; ++i)
+		days += days_in_month[i - 1];
+	if (m > 2 && y % 4 == 0) ++days;
+	return days + 365 * y + (y + 3) / 4 - 1;
+}
+
+// Reference: original RTClib unix2rtc(), loops once per year and once per month
+static void ref_unix2rtc(DATE_TIME * dt, uint32_t t)
+{
+	static const uint8_t days_in_month[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	t -= SECONDS_FROM_1970_TO_2000;
+	dt->ss = t % 60;
+	t /= 60;
+	dt->mm = t % 60;
+	t /= 60;
+	dt->hh = t % 24;
+	uint16_t days = t / 24;
+	uint8_t leap;
+	for (dt->yOff = 0;; ++dt->yOff) {
+		leap = dt->yOff % 4 == 0;
+		if (days < 365U + leap) break;
+		days -= 365 + leap;
+	}
+	for (dt->m = 1; dt->m < 12; ++dt->m) {
+		uint8_t daysPerMonth = days_in_month[dt->m - 1];
+		if (leap && dt->m == 2) ++daysPerMonth;
+		if (days < daysPerMonth) break;
+		days -= daysPerMonth;
+	}
+	dt->d = days + 1;
+}
+
+static uint32_t ref_rtc2unix(DATE_TIME * dt)
+{
+	uint16_t days = ref_date2days(dt->yOff, dt->m, dt->d);
+	return ((days * 24UL + dt->hh) * 60 + dt->mm) * 60 + dt->ss + SECONDS_FROM_1970_TO_2000;
+}
+
+static void from_tm(DATE_TIME * dt, const struct tm * tm)
+{
+	dt->yOff = tm->tm_year - 100;
+	dt->m = tm->tm_mon + 1;
+	dt->d = tm->tm_mday;
+	dt->hh = tm->tm_hour;
+	dt->mm = tm->tm_min;
+	dt->ss = tm->tm_sec;
+}
+
+// Every second of the range, against the independent clock and libc
+static uint64_t check_every_second(void)
+{
+	uint64_t checked = 0;
+	DATE_TIME ref = {0, 1, 1, 0, 0, 0};
+	for(uint32_t t = TIME_OF(0, 0);; t++) {
+		DATE_TIME dt, lib;
+		unix2rtc(&dt, t);
+		if(memcmp(&dt, &ref, sizeof(dt)) != 0) fail("unix2rtc", t, &dt, &ref);
+		if(rtc2unix(&ref) != t) fail("rtc2unix", t, &ref, &ref);
+		if(rtc2seconds(&ref) != t - SECONDS_FROM_1970_TO_2000) fail("rtc2seconds", t, &ref, &ref);
+		// libc round trip
+		time_t tt = t;
+		struct tm tm;
+		gmtime_r(&tt, &tm);
+		from_tm(&lib, &tm);
+		if(memcmp(&dt, &lib, sizeof(dt)) != 0) fail("gmtime_r", t, &dt, &lib);
+		if((time_t)rtc2unix(&dt) != timegm(&tm)) fail("timegm", t, &dt, &lib);
+		checked += 5;
+		if(t == TIME_OF(DAYS, 0) - 1) break;
+		dt = ref;
+		rtcAddSeconds(&dt, 1);
+		tick(&ref);
+		checked++;
+		if(memcmp(&dt, &ref, sizeof(dt)) != 0) fail("rtcAddSeconds", t, &dt, &ref);
+	}
+	return checked;
+}
+
+// dayOfTheWeek() for every day, against gmtime_r()
+static uint32_t check_every_day(void)
+{
+	uint32_t checked = 0;
+	for(uint32_t day = 0; day < DAYS; day++) {
+		time_t tt = TIME_OF(day, 0);
+		struct tm tm;
+		DATE_TIME dt;
+		gmtime_r(&tt, &tm);
+		from_tm(&dt, &tm);
+		checked++;
+		if(dayOfTheWeek(&dt) != tm.tm_wday) fail("dayOfTheWeek", (uint32_t)tt, &dt, &dt);
+	}
+	return checked;
+}
+
+// buildTime() for every month and day, in the __DATE__ "Mmm dd yyyy" format
+static uint32_t check_build_time(void)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	uint32_t checked = 0;
+	for(uint8_t m = 1; m <= 12; m++) {
+		for(uint8_t d = 1; d <= 31; d++) {
+			char date[12], time[9];
+			DATE_TIME dt, ref = {(uint8_t)(d + m), m, d, (uint8_t)(m + 11), (uint8_t)(d + 28), (uint8_t)(d * m % 60)};
+			snprintf(date, sizeof(date), "%.3s %2u %04u", &months[(m - 1) * 3], d, 2000 + ref.yOff);
+			snprintf(time, sizeof(time), "%02u:%02u:%02u", ref.hh, ref.mm, ref.ss);
+			buildTime(&dt, date, time);
+			checked++;
+			if(memcmp(&dt, &ref, sizeof(dt)) != 0) fail("buildTime", 0, &dt, &ref);
+		}
+	}
+	return checked;
+}
+
+// ns per call of each RTClib function, and of libc for scale, over dates across the range
+static void timing(void)
+{
+	enum { UNIX2RTC, RTC2UNIX, RTC2SECONDS, DAYOFTHEWEEK, ADDSECONDS, ADDMINUTES, NEXTMINUTE, BUILDTIME,
+		GMTIME, TIMEGM, FUNCTIONS };
+	static const char * const names[FUNCTIONS] = {"unix2rtc", "rtc2unix", "rtc2seconds", "dayOfTheWeek",
+			"rtcAddSeconds", "rtcAddMinutes", "rtcNextMinute", "buildTime", "gmtime_r", "timegm"};
+	static DATE_TIME dts[1024];
+	static struct tm tms[1024];
+	uint32_t ts[1024];
+	for(unsigned i = 0; i < 1024; i++) {
+		ts[i] = TIME_OF(i * (DAYS / 1024), i * 83 % SECONDS_PER_DAY);
+		unix2rtc(&dts[i], ts[i]);
+		time_t tt = ts[i];
+		gmtime_r(&tt, &tms[i]);
+	}
+	printf("Function       ns per call\n");
+	for(int f = 0; f < FUNCTIONS; f++) {
+		double start = now_ns();
+		for(uint32_t n = 0; n < BENCH_CALLS; n++) {
+			unsigned i = n & 1023;
+			DATE_TIME * dt = &dts[i];
+			time_t tt = ts[i];
+			switch(f) {
+			case UNIX2RTC:     unix2rtc(dt, ts[i]); break;
+			case RTC2UNIX:     sink += rtc2unix(dt); break;
+			case RTC2SECONDS:  sink += rtc2seconds(dt); break;
+			case DAYOFTHEWEEK: sink += dayOfTheWeek(dt); break;
+			case ADDSECONDS:   { DATE_TIME next = *dt; rtcAddSeconds(&next, 1); sink += next.ss; } break;
+			case ADDMINUTES:   { DATE_TIME next = *dt; rtcAddMinutes(&next, 1); sink += next.mm; } break;
+			case NEXTMINUTE:   { DATE_TIME next = *dt; rtcNextMinute(&next); sink += next.mm; } break;
+			case BUILDTIME:    { DATE_TIME next; buildTime(&next, "Oct 29 2024", "13:51:40"); sink += next.ss; } break;
+			case GMTIME:       { struct tm tm; gmtime_r(&tt, &tm); sink += tm.tm_sec; } break;
+			case TIMEGM:       { struct tm tm = tms[i]; sink += (uint32_t)timegm(&tm); } break;
+			}
+		}
+		printf("%-14s %.1f\n", names[f], (now_ns() - start) / BENCH_CALLS);
+	}
+}
+
+// ns per call of the closed form conversions and the loop references, at unix time t
+static void bench(uint32_t t)
+{
+	DATE_TIME at, dt;
+	double ns[5], start;
+	unix2rtc(&at, t);
+	dt = at;
+
+	start = now_ns();
+	for(uint32_t i = 0; i < BENCH_CALLS; i++) { unix2rtc(&dt, t + (i & 1)); sink += dt.ss; }
+	ns[0] = now_ns() - start;
+	start = now_ns();
+	for(uint32_t i = 0; i < BENCH_CALLS; i++) { ref_unix2rtc(&dt, t + (i & 1)); sink += dt.ss; }
+	ns[1] = now_ns() - start;
+	start = now_ns();
+	for(uint32_t i = 0; i < BENCH_CALLS; i++) { dt.ss = i & 1; sink += rtc2unix(&dt); }
+	ns[2] = now_ns() - start;
+	start = now_ns();
+	for(uint32_t i = 0; i < BENCH_CALLS; i++) { dt.ss = i & 1; sink += ref_rtc2unix(&dt); }
+	ns[3] = now_ns() - start;
+	start = now_ns();
+	for(uint32_t i = 0; i < BENCH_CALLS; i++) { DATE_TIME next = dt; rtcAddSeconds(&next, 1); sink += next.ss; }
+	ns[4] = now_ns() - start;
+	printf("%04u-%02u-%02u  %-8.1f %-8.1f %-8.1f %-8.1f %.1f\n", 2000 + at.yOff, at.m, at.d,
+			ns[0] / BENCH_CALLS, ns[1] / BENCH_CALLS, ns[2] / BENCH_CALLS, ns[3] / BENCH_CALLS, ns[4] / BENCH_CALLS);
+}
+
+int main(void)
+{
+	printf("Checking every second, %u days, against libc...\n", DAYS);
+	uint64_t checked = check_every_second();
+	checked += check_every_day();
+	checked += check_build_time();
+	printf("%llu checks, %u errors\n", (unsigned long long)checked, errors);
+
+	printf("ns per call, closed form vs loops:\n");
+	printf("Date        unix2rtc ref      rtc2unix ref      +1 second\n");
+	bench(TIME_OF(0, 0));
+	bench(TIME_OF(DAYS / 2, 43200));
+	bench(TIME_OF(DAYS, 0) - 1);
+	timing();
+	return errors != 0;
+}
@@ -0,0 +1,200 @@
+// trace_analyze.c, host analyzer for the firmware "trace dump" output
+//
+// Build (Linux, from the repository root):
+//   gcc -O2 -ICore/Inc -o trace_analyze Tools/trace_analyze.c Core/Src/proto_frame.c
+// Use:
+//   trace_analyze capture.bin [trace.json]
+//
+// capture.bin is the raw serial capture - text before and after the dump is skipped.
+// Prints a latency histogram per traced function / interrupt handler and, given a second file
+// name, writes a Chrome trace JSON timeline (chrome://tracing or https://ui.perfetto.dev).
+//
+// Latencies are inclusive: interrupt handlers that ran during a function are counted in the
+// function's time.  Interrupt handlers are shown on a separate timeline row.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "trace_format.h"
+#include "proto_frame.h" // proto_crc16()
+
+#define HIST_BUCKETS 18 // < 1us, < 2us, < 4us ... >= 65536us
+#define STACK_MAX    32
+
+#define TRACE_NAME(id, name) name,
+static const char * const names[TRACE_ID_COUNT] = {"-", TRACE_IDS(TRACE_NAME)};
+#undef TRACE_NAME
+
+typedef struct {
+	uint32_t count;
+	double min_us, max_us, total_us;
+	uint32_t hist[HIST_BUCKETS];
+} STATS;
+
+typedef struct {
+	uint8_t id;
+	double start_us;
+} OPEN;
+
+static uint32_t get32(const uint8_t * p)
+{
+	return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint8_t * read_file(const char * path, long * size)
+{
+	FILE * f = fopen(path, "rb");
+	if(!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t * data = malloc(*size ? *size : 1);
+	if(data && fread(data, 1, *size, f) != (size_t)*size) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	return data;
+}
+
+// Find the last complete dump with a good CRC in the capture
+static const uint8_t * find_dump(const uint8_t * data, long size, uint16_t * count)
+{
+	const uint8_t * found = NULL;
+	for(long i = 0; i + 14 <= size; i++) {
+		if(memcmp(&data[i], TRACE_MAGIC, 4)) continue;
+		const uint8_t * p = &data[i + 4];
+		uint16_t n = p[8] | p[9] << 8;
+		long len = 10 + (long)n * TRACE_EVENT_SIZE; // HZ, TOTAL, COUNT, EVENTS
+		if(i + 4 + len + 2 > size) continue;
+		uint16_t crc = proto_crc16(0xFFFF, p, (uint16_t)len);
+		if(crc != (p[len] | p[len + 1] << 8)) {
+			fprintf(stderr, "Dump at offset %ld: CRC error, skipped\n", i);
+			continue;
+		}
+		found = p;
+		*count = n;
+	}
+	return found;
+}
+
+static void stats_add(STATS * s, double us)
+{
+	if(!s->count || us < s->min_us) s->min_us = us;
+	if(us > s->max_us) s->max_us = us;
+	s->total_us += us;
+	s->count++;
+	int b = 0;
+	while(b < HIST_BUCKETS - 1 && us >= (double)(1u << b)) b++;
+	s->hist[b]++;
+}
+
+static void print_stats(const STATS * stats)
+{
+	for(int id = 1; id < TRACE_ID_COUNT; id++) {
+		const STATS * s = &stats[id];
+		if(!s->count) continue;
+		printf("\n%s: %u calls, min %.2f us, avg %.2f us, max %.2f us\n", names[id], s->count,
+				s->min_us, s->total_us / s->count, s->max_us);
+		uint32_t peak = 0;
+		for(int b = 0; b < HIST_BUCKETS; b++) if(s->hist[b] > peak) peak = s->hist[b];
+		for(int b = 0; b < HIST_BUCKETS; b++) {
+			if(!s->hist[b]) continue;
+			int bar = (int)((s->hist[b] * 40ull + peak - 1) / peak);
+			if(b == HIST_BUCKETS - 1) printf("  >= %6u us %7u ", 1u << (b - 1), s->hist[b]);
+			else printf("  <  %6u us %7u ", 1u << b, s->hist[b]);
+			while(bar--) putchar('#');
+			putchar('\n');
+		}
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	if(argc < 2) {
+		fprintf(stderr, "Usage: %s capture.bin [trace.json]\n", argv[0]);
+		return 2;
+	}
+	long size;
+	uint8_t * data = read_file(argv[1], &size);
+	if(!data) {
+		perror(argv[1]);
+		return 1;
+	}
+	uint16_t count;
+	const uint8_t * p = find_dump(data, size, &count);
+	if(!p) {
+		fprintf(stderr, "%s: no valid trace dump found\n", argv[1]);
+		return 1;
+	}
+	uint32_t hz = get32(p);
+	uint32_t total = get32(p + 4);
+	const uint8_t * events = p + 10;
+	double cycles_per_us = hz / 1e6;
+	printf("%u events (%u recorded, %u overwritten), %.1f MHz\n", count, total, total - count, cycles_per_us);
+
+	FILE * json = NULL;
+	if(argc > 2) {
+		json = fopen(argv[2], "w");
+		if(!json) {
+			perror(argv[2]);
+			return 1;
+		}
+		fprintf(json, "{\"traceEvents\":[\n");
+		fprintf(json, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}},\n");
+		fprintf(json, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"interrupts\"}}");
+	}
+
+	STATS stats[TRACE_ID_COUNT] = {0};
+	OPEN stack[STACK_MAX];
+	int depth = 0;
+	uint32_t unmatched = 0;
+	double now_us = 0;
+	uint32_t last = count ? get32(events) : 0;
+	for(unsigned i = 0; i < count; i++) {
+		const uint8_t * e = &events[i * TRACE_EVENT_SIZE];
+		uint32_t cycles = get32(e);
+		uint8_t id = e[4] & ~TRACE_EXIT_FLAG;
+		now_us += (uint32_t)(cycles - last) / cycles_per_us; // wraps every 2^32 cycles
+		last = cycles;
+		if(!id || id >= TRACE_ID_COUNT) {
+			unmatched++;
+			continue;
+		}
+		if(!(e[4] & TRACE_EXIT_FLAG)) {
+			if(depth == STACK_MAX) {
+				unmatched++;
+				continue;
+			}
+			stack[depth].id = id;
+			stack[depth++].start_us = now_us;
+			continue;
+		}
+		// Exit: match the innermost open enter with the same ID.  Enters above it lost their
+		// exit (overwritten events or a dump during the call).
+		int d = depth;
+		while(d && stack[d - 1].id != id) d--;
+		if(!d) { // enter was overwritten in the ring
+			unmatched++;
+			continue;
+		}
+		unmatched += depth - d;
+		depth = d - 1;
+		double start_us = stack[depth].start_us;
+		stats_add(&stats[id], now_us - start_us);
+		if(json) fprintf(json, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				names[id], id >= TRACE_IRQ_FIRST ? 2 : 1, start_us, now_us - start_us);
+	}
+	unmatched += depth;
+	if(unmatched) printf("%u events without a matching enter / exit\n", unmatched);
+	print_stats(stats);
+
+	if(json) {
+		fprintf(json, "\n],\"displayTimeUnit\":\"ns\"}\n");
+		fclose(json);
+		printf("\nTimeline written to %s\n", argv[2]);
+	}
+	free(data);
+	return 0;
+}